@@ -1,6 +1,7 @@
 #pragma once
 
 #include <main.hh>
+#include <lib/avltree.hh>
 #include <memory>
 #include <queue>
 #include <core.hh>
@@ -122,4 +123,21 @@ namespace Link
     {
         return ReadKernelLinkedList(list.First, out);
     }
+
+    /* Reads the values of an AVL tree in order, one node at a time */
+    template<class T> inline bool ReadKernelAvlTree(
+        uptr node, std::vector<T> &out)
+    {
+        AvlNode<T> read;
+
+        if (!node)
+            return true;
+
+        if (!ReadKernelObject<AvlNode<T>>(node, &read) ||
+            !ReadKernelAvlTree<T>(read.Left, out))
+            return false;
+
+        out.push_back(read.Value);
+        return ReadKernelAvlTree<T>(read.Right, out);
+    }
 };
\ No newline at end of file
@@ -449,11 +449,17 @@ std::shared_ptr<ObjView> ObjPrint::Processes(
             std::string name;
             TRY_PRINT(Link::ReadKernelString(read.Name, name), table->ValueStr('"' + name + '"'));
 
+            std::vector<PzVirtualRegionEntry> entries;
             std::vector<PzUserVirtualRegion> regs;
             std::vector<PzHandleTableEntry> handles;
             std::vector<uptr> modules, threads;
 
-            TRY_PRINT(Link::ReadKernelLinkedList(read.VirtualAllocations, regs),
+            bool read_regions = Link::ReadKernelAvlTree(read.VirtualAllocations.Tree.Root, entries);
+
+            for (auto &entry : entries)
+                regs.push_back(entry.Region);
+
+            TRY_PRINT(read_regions,
                 table->ValueTable(VirtualAllocations("Show", regs)));
             TRY_PRINT(Link::ReadKernelLinkedList(read.HandleTable, handles),
                 table->ValueTable(Handles("Show", handles)));
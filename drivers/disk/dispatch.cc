@@ -1,6 +1,7 @@
 #include "driver.hh"
 #include <sched/scheduler.hh>
 #include <mm/physical.hh>
+#include <mm/mdl.hh>
 #include <lib/string.hh>
 
 #define	ATA_DATA         0
@@ -164,9 +165,46 @@ PzStatus IdeDetectDevices()
 
 #include <processor.hh>
 
+/* Largest transfer made straight from a descriptor list. Every page takes at most two
+   PRDT entries, so the PRDT fits a transfer of this size wherever the buffer lies. */
+#define MAX_DIRECT_TRANSFER (1024 * PAGE_SIZE)
+
+/* Fills in the PRDT for `bytes` bytes of a locked buffer starting at `offset` into it,
+   merging physically contiguous pages as long as they don't cross a 64K boundary. */
+static void AtaBuildPrdtFromMdl(PzMemoryDescriptorList *mdl, u32 offset, u32 bytes)
+{
+    int count = 0;
+    u32 entry_size = 0;
+
+    offset += mdl->ByteOffset;
+
+    while (bytes) {
+        uptr physical = mdl->Pages[offset / PAGE_SIZE] + offset % PAGE_SIZE;
+        u32 size = Min<u32>(bytes, PAGE_SIZE - offset % PAGE_SIZE);
+
+        if (count && physical & 0xFFFF &&
+            Prdt[count - 1].PhysicalAddress + entry_size == physical)
+            entry_size += size;
+        else {
+            Prdt[count++].PhysicalAddress = u32(physical);
+            entry_size = size;
+        }
+
+        /* 65536 bytes will wrap around to 0 */
+        Prdt[count - 1].ByteCount = entry_size & 0xFFFF;
+        Prdt[count - 1].Reserved = 0;
+
+        offset += size;
+        bytes -= size;
+    }
+
+    /* Set bit 15 of the last entry */
+    Prdt[count - 1].Reserved = 1 << 15;
+}
+
 bool AtaDmaTransfer(
-    MbrDisk *disk, void *buffer, bool write,
-    u64 start, u32 bytes, u32 &transferred)
+    MbrDisk *disk, void *buffer, PzMemoryDescriptorList *mdl,
+    bool write, u64 start, u32 bytes, u32 &transferred)
 {
     transferred = 0;
 
@@ -195,6 +233,9 @@ bool AtaDmaTransfer(
     int max_sectors = lba48 ? 65535 : 255;
     u32 max_size = max_sectors * disk->BytesPerSector;
 
+    if (mdl)
+        max_size = Min<u32>(max_size, MAX_DIRECT_TRANSFER);
+
     bool secondary = !!(disk->Number & 2);
     int disk_select = disk->Number & 1;
 
@@ -204,29 +245,38 @@ bool AtaDmaTransfer(
         u32 ptrans;
 
         while (bytes > max_size) {
-            errors |= AtaDmaTransfer(disk, byte_buffer, write, start, max_size, ptrans);
+            errors |= AtaDmaTransfer(disk, byte_buffer, mdl, write, start, max_size, ptrans);
             byte_buffer += max_size;
             start += max_size;
             transferred += ptrans;
             bytes -= max_size;
         }
 
-        errors |= AtaDmaTransfer(disk, byte_buffer, write, start, bytes, ptrans);
+        errors |= AtaDmaTransfer(disk, byte_buffer, mdl, write, start, bytes, ptrans);
         transferred += ptrans;
         return errors;
     }
 
+    u64 start_sector = start / disk->BytesPerSector;
+    int skipped_bytes = start % disk->BytesPerSector;
+    u16 sector_count = ALIGN(bytes + skipped_bytes, disk->BytesPerSector) / disk->BytesPerSector;
+    u32 dma_bytes = sector_count * disk->BytesPerSector;
+
+    /* Whole, word-aligned sectors can be transferred straight to or from the caller's pages */
+    bool direct = mdl && !skipped_bytes && dma_bytes == bytes && !(uptr(byte_buffer) & 1);
+
     PsWaitForObject(IoLock);
 
     bool allocated = false;
-    u8 *active_buffer;
+    u8 *active_buffer = nullptr;
 
-    if (bytes < 65536) {
+    if (direct)
+        AtaBuildPrdtFromMdl(mdl, byte_buffer - (u8 *)mdl->VirtualAddress, bytes);
+    else if (dma_bytes <= 65536)
         active_buffer = Dma64KBuffer;
-    }
     else {
         allocated = true;
-        active_buffer = (u8 *)MmAllocateDmaMemory(bytes, 16, nullptr, PAGE_READWRITE);
+        active_buffer = (u8 *)MmAllocateDmaMemory(dma_bytes, 16, nullptr, PAGE_READWRITE);
 
         if (!active_buffer) {
             PsReleaseMutex(IoLock);
@@ -234,13 +284,9 @@ bool AtaDmaTransfer(
         }
     }
 
-    u64 start_sector = start / disk->BytesPerSector;
-    int skipped_bytes = start % disk->BytesPerSector;
-    u16 sector_count = ALIGN(bytes + skipped_bytes, disk->BytesPerSector) / disk->BytesPerSector;
-    u32 dma_bytes = sector_count * disk->BytesPerSector;
-    uptr tmp_dma = MmVirtualToPhysical(active_buffer, 0);
+    uptr tmp_dma = active_buffer ? MmVirtualToPhysical(active_buffer, 0) : 0;
 
-    for (int i = 0; dma_bytes && i < 4096; i++) {
+    for (int i = 0; !direct && dma_bytes && i < 4096; i++) {
         int csize = Min(dma_bytes, 65536u);
         uptr bb = tmp_dma;
 
@@ -304,11 +350,11 @@ bool AtaDmaTransfer(
     PsWaitForObject(IoComplete);
     transferred = bytes;
 
-    if (!write)
+    if (!write && !direct)
         MemCopy(buffer, active_buffer + skipped_bytes, bytes);
 
     if (allocated)
-        MmFreeDmaMemory(active_buffer, 16, bytes);
+        MmFreeDmaMemory(active_buffer, 16, dma_bytes);
 
     PsReleaseMutex(IoLock);
 
@@ -351,7 +397,7 @@ PzStatus DriverDispatch(
         }
 
         u32 read;
-        if (!AtaDmaTransfer(disk, &disk->Partitions, false,
+        if (!AtaDmaTransfer(disk, &disk->Partitions, nullptr, false,
             446, sizeof(MbrDisk::PartitionEntry) * 4, read)) {
             PzHeapFree(disk);
             return STATUS_TRANSFER_FAILED;
@@ -369,7 +415,7 @@ PzStatus DriverDispatch(
             0;
 
         if (AtaDmaTransfer(
-            disk, output,
+            disk, output, irp->Mdl,
             false, offset + stack->Parameters.Read.Offset,
             stack->Parameters.Read.Length, read)) {
             irp->UserStatus->Information = stack->Parameters.Read.Length;
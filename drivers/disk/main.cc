@@ -9,7 +9,7 @@ extern "C" PzStatus DriverEntry(PzDriverObject *driver)
     driver->UnloadFunction = nullptr;
     PzDeviceObject *device;
 
-    if (IoCreateDevice(driver, DEVICE_BLOCK, 0, &DeviceName, &device) != STATUS_SUCCESS)
+    if (IoCreateDevice(driver, DEVICE_BLOCK, DEVICE_FLAG_DIRECT_IO, &DeviceName, &device) != STATUS_SUCCESS)
         return STATUS_FAILED;
 
     for (int i = 0; i < MJ_FUNC_MAX; i++)
@@ -88,8 +88,9 @@ PzStatus DriverInitialize(PzDriverObject *driver)
 
 	VbeFramebufferSize = VbeData->Pitch * VbeData->Height * VbeData->BitsPerPixel / 8;
 
+	/* Frames are only ever written in bulk, so let the CPU combine the writes */
 	VbeFramebuffer = MmVirtualMapPhysical(nullptr,
-		VbeData->Framebuffer, VbeFramebufferSize, PAGE_READWRITE);
+		VbeData->Framebuffer, VbeFramebufferSize, PAGE_READWRITE | PAGE_CACHE_WC);
 
 	if (!VbeFramebuffer) {
 		MmVirtualFreeMemory(VbeData, sizeof(VbeVideoModeData));
@@ -7,6 +7,9 @@
 #include <obj/manager.hh>
 #include <mm/virtual.hh>
 #include <obj/directory.hh>
+#include <processor.hh>
+#include <lib/util.hh>
+#include <obj/event.hh>
 
 static PzSpinlock DbgSpinlockRead, DbgSpinlockWrite;
 
@@ -274,30 +277,206 @@ extern "C" int HalReadIfFlag();
 
 bool DbgSchedulerEnabled = false;
 
-void DbgPrintStrUnformatted(const char *str, int size)
+/* Set once a thread sends the log rings to the debugger,
+   before which every message is sent as soon as it is logged */
+static bool DbgLogDrainRunning;
+/* Signaled whenever a record is finished, which wakes the drain thread */
+static PzEventObject *DbgLogEvent;
+
+static void DbgWriteFormatted(const char *format, ...)
+{
+    va_list params;
+    va_start(params, format);
+    PrintfWithCallbackV(DbgWriteChar, format, params);
+    va_end(params);
+}
+
+/* Where a message is being formatted into a log ring */
+struct DbgLogWriter
+{
+    PzLogRing *Ring;
+    u32 Position, End;
+};
+
+/* Claims room for a message of `length` bytes in a log ring, without ever waiting */
+static bool DbgClaimLogRecord(PzLogRing *ring, u32 length, u32 *head)
+{
+    u32 record = ALIGN(sizeof(u32) + length, sizeof(u32));
+    u32 start = __atomic_load_n(&ring->Head, __ATOMIC_RELAXED);
+
+    do {
+        if (start + record - __atomic_load_n(&ring->Tail, __ATOMIC_ACQUIRE) > LOG_RING_SIZE) {
+            __atomic_fetch_add(&ring->Dropped, 1, __ATOMIC_RELAXED);
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&ring->Head, &start, start + record,
+        true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    *head = start;
+    return true;
+}
+
+/* Hands a record whose text has been written over to the drain thread */
+static void DbgCommitLogRecord(PzLogRing *ring, u32 head, u32 length)
+{
+    __atomic_store_n((u32 *)&ring->Data[head & (LOG_RING_SIZE - 1)],
+        length | LOG_RECORD_READY, __ATOMIC_RELEASE);
+
+    /* The same store PsSetEvent does, minus the handle lookup, so it works in any context */
+    if (PzEventObject *event = __atomic_load_n(&DbgLogEvent, __ATOMIC_ACQUIRE))
+        __atomic_store_n(&event->Signaled, true, __ATOMIC_RELEASE);
+}
+
+static void DbgWriteLogChar(void *context, char c)
+{
+    auto *writer = (DbgLogWriter *)context;
+
+    if (writer->Position < writer->End)
+        writer->Ring->Data[writer->Position++ & (LOG_RING_SIZE - 1)] = c;
+}
+
+static void DbgCountChar(void *context, char c)
 {
+    ++*(u32 *)context;
+}
+
+/* Sends the finished records at the start of a ring to the debugger.
+   Must be called with DbgSpinlockWrite held. */
+static void DbgDrainLogRing(PzLogRing *ring)
+{
+    u32 tail = ring->Tail;
+
+    if (u32 dropped = __atomic_exchange_n(&ring->Dropped, 0, __ATOMIC_RELAXED)) {
+        DbgWrite32(EVENT_LOG_STRING);
+        DbgWriteFormatted("[DbgLog] %u messages dropped, the log ring was full\r\n", dropped);
+        DbgWriteChar('\0');
+    }
+
+    for (;;) {
+        u32 *header = (u32 *)&ring->Data[tail & (LOG_RING_SIZE - 1)];
+        u32 value = __atomic_load_n(header, __ATOMIC_ACQUIRE);
+
+        /* Records are handed over in order, even if a later one is done first */
+        if (!(value & LOG_RECORD_READY))
+            break;
+
+        u32 length = value & ~LOG_RECORD_READY;
+        u32 record = ALIGN(sizeof(u32) + length, sizeof(u32));
+
+        DbgWrite32(EVENT_LOG_STRING);
+
+        for (u32 i = 0; i < length; i++)
+            DbgWriteChar(ring->Data[(tail + sizeof(u32) + i) & (LOG_RING_SIZE - 1)]);
+
+        DbgWriteChar('\0');
+
+        /* Zero the record, so that a length word is never found in leftover text */
+        for (u32 i = 0; i < record; i += sizeof(u32))
+            *(u32 *)&ring->Data[(tail + i) & (LOG_RING_SIZE - 1)] = 0;
+
+        tail += record;
+        __atomic_store_n(&ring->Tail, tail, __ATOMIC_RELEASE);
+    }
+}
+
+void DbgFlushLog()
+{
+    /* Code interrupting the sender leaves its messages for the sender to pick up */
+    if (PzIsSpinlockAcquired(DbgSpinlockWrite))
+        return;
+
     PzAcquireSpinlock(&DbgSpinlockWrite);
-    DbgWrite32(EVENT_LOG_STRING);
 
-    //DbgWrite32(DbgSchedulerEnabled ? PsGetCurrentThread()->Id : 0);
-    for (int i = 0; i < size; i++)
-        DbgWriteChar(str[i]);
+    for (int i = 0; i < MAX_PROCESSORS; i++)
+        DbgDrainLogRing(&PzGetProcessor(i)->LogRing);
 
-    DbgWriteChar('\0');
     PzReleaseSpinlock(&DbgSpinlockWrite);
 }
 
-void DbgPrintStr(const char *str, ...)
+static int DbgLogDrainThread(void *param)
 {
-    PzAcquireSpinlock(&DbgSpinlockWrite);
-    DbgWrite32(EVENT_LOG_STRING);
-    //DbgWrite32(DbgSchedulerEnabled ? PsGetCurrentThread()->Id : 0);
+    PzHandle event = (PzHandle)param;
+    DbgLogDrainRunning = true;
+
+    for (;;) {
+        /* Resetting before draining lets a record finished meanwhile signal the event again */
+        PsWaitForObject(event);
+        PsResetEvent(event);
+        DbgFlushLog();
+    }
 
-    va_list params;
+    return 0;
+}
+
+PzHandle DbgStartLogDrain()
+{
+    PzHandle handle = INVALID_HANDLE_VALUE, event;
+    PzEventObject *event_obj;
+
+    /* Without an event messages are still sent, just by whoever logs them */
+    if (PsCreateEvent(&event, PZ_KPROC, nullptr) != STATUS_SUCCESS)
+        return handle;
+
+    if (PsResetEvent(event) != STATUS_SUCCESS ||
+        !ObReferenceObjectByHandle(PZ_OBJECT_EVENT, nullptr, event, (ObPointer *)&event_obj)) {
+        ObCloseHandle(event);
+        return handle;
+    }
+
+    __atomic_store_n(&DbgLogEvent, event_obj, __ATOMIC_RELEASE);
+
+    if (PsCreateThread(&handle, false, 0, DbgLogDrainThread,
+        (void *)event, 0, THREAD_PRIORITY_LOW) != STATUS_SUCCESS) {
+        __atomic_store_n(&DbgLogEvent, nullptr, __ATOMIC_RELEASE);
+        ObDereferenceObject(event_obj);
+        ObCloseHandle(event);
+        return INVALID_HANDLE_VALUE;
+    }
+
+    return handle;
+}
+
+void DbgPrintStrUnformatted(const char *str, int size)
+{
+    PzLogRing *ring = &PzGetCurrentProcessor()->LogRing;
+    u32 length = Clamp(size, 0, LOG_MAX_MESSAGE);
+    u32 head;
+
+    if (DbgClaimLogRecord(ring, length, &head)) {
+        for (u32 i = 0; i < length; i++)
+            ring->Data[(head + sizeof(u32) + i) & (LOG_RING_SIZE - 1)] = str[i];
+
+        DbgCommitLogRecord(ring, head, length);
+    }
+
+    if (!DbgLogDrainRunning)
+        DbgFlushLog();
+}
+
+void DbgPrintStr(const char *str, ...)
+{
+    va_list params, count_params;
     va_start(params, str);
-    PrintfWithCallbackV(DbgWriteChar, str, params);
-    DbgWriteChar('\0');
+    va_copy(count_params, params);
+
+    /* The message is measured first and then formatted straight into the ring,
+       so callers don't need stack room for the longest message */
+    u32 length = 0;
+    PrintfWithContextV(DbgCountChar, &length, str, count_params);
+    va_end(count_params);
+
+    PzLogRing *ring = &PzGetCurrentProcessor()->LogRing;
+    length = Min(length, u32(LOG_MAX_MESSAGE));
+    u32 head;
+
+    if (DbgClaimLogRecord(ring, length, &head)) {
+        DbgLogWriter writer = { ring, head + sizeof(u32), head + sizeof(u32) + length };
+        PrintfWithContextV(DbgWriteLogChar, &writer, str, params);
+        DbgCommitLogRecord(ring, head, length);
+    }
+
     va_end(params);
 
-    PzReleaseSpinlock(&DbgSpinlockWrite);
+    if (!DbgLogDrainRunning)
+        DbgFlushLog();
 }
\ No newline at end of file
@@ -4,6 +4,10 @@
 #include <processor.hh>
 #include <debug.hh>
 #include <core.hh>
+#include <mm/slab.hh>
+
+static PzObjectCache RegistrationCache =
+    OBJECT_CACHE_INITIALIZER("ExRegistration", sizeof(PzExceptionRegistration), nullptr);
 
 void ExCallNextHandler(CpuInterruptState *user_state)
 {
@@ -25,22 +29,29 @@ void ExContinueExecution()
     HalSwitchContextUser();
 }
 
-void ExPushExceptionHandler(PzExceptionHandler handler, uptr stack_context)
+bool ExPushExceptionHandler(PzExceptionHandler handler, uptr stack_context)
 {
     auto &current = PsGetCurrentThread()->CurrentExHandler;
-    auto *reg = new PzExceptionRegistration;
+    auto *reg = (PzExceptionRegistration *)MmCacheAllocate(&RegistrationCache);
+
+    if (!reg)
+        return false;
+
     reg->Handler = handler;
     reg->StackContext = stack_context;
     reg->Previous = current;
     current = reg;
+    return true;
 }
 
 void ExPopExceptionHandler()
 {
     auto &handler = PsGetCurrentThread()->CurrentExHandler;
 
-    if (handler)
-        handler = handler->Previous;
+    if (auto *reg = handler) {
+        handler = reg->Previous;
+        MmCacheFree(&RegistrationCache, reg);
+    }
 }
 
 extern "C" u32 HalReadCr2();
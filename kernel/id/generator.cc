@@ -1,31 +1,22 @@
 #include <id/generator.hh>
-#include <spinlock.hh>
 
 uptr CurrentKernelObjectId  = -7,
      CurrentUserObjectId    =  1,
      CurrentThreadProcessId =  1;
 
-PzSpinlock IdSpinlock;
-
 uptr IdGenerateUniqueId(int id_namespace)
 {
-    PzAcquireSpinlock(&IdSpinlock);
-
-    uptr id = -1;
+    /* Only uniqueness is needed, which the read-modify-write gives on its own */
     switch (id_namespace) {
     case NAMESPACE_KERNEL_OBJECT:
-        id = CurrentKernelObjectId--;
-        break;
+        return __atomic_fetch_sub(&CurrentKernelObjectId, 1, __ATOMIC_RELAXED);
 
     case NAMESPACE_USER_OBJECT:
-        id = CurrentUserObjectId++;
-        break;
+        return __atomic_fetch_add(&CurrentUserObjectId, 1, __ATOMIC_RELAXED);
 
     case NAMESPACE_THREAD_PROCESS:
-        id = CurrentThreadProcessId++;
-        break;
+        return __atomic_fetch_add(&CurrentThreadProcessId, 1, __ATOMIC_RELAXED);
     }
 
-    PzReleaseSpinlock(&IdSpinlock);
-    return id;
+    return -1;
 }
\ No newline at end of file
@@ -1,5 +1,8 @@
 #include <io/manager.hh>
 #include <lib/malloc.hh>
+#include <mm/slab.hh>
+#include <mm/section.hh>
+#include <mm/mdl.hh>
 #include <obj/device.hh>
 #include <obj/manager.hh>
 #include <obj/module.hh>
@@ -8,18 +11,32 @@
 #include <ipc/pipes.hh>
 #include <debug.hh>
 
+static PzObjectCache IrpCache =
+    OBJECT_CACHE_INITIALIZER("Irp", sizeof(PzIoRequestPacket), nullptr);
+static PzObjectCache StackLocationCache =
+    OBJECT_CACHE_INITIALIZER("IoStackLocation", sizeof(PzIoStackLocation), nullptr);
+
 PzIoRequestPacket *IoAllocateIrp(int locations)
 {
-    auto irp = (PzIoRequestPacket *)PzHeapAllocate(sizeof(PzIoRequestPacket), 0);
-    irp->CurrentLocation = (PzIoStackLocation *)PzHeapAllocate(sizeof(PzIoStackLocation), 0);
+    auto irp = (PzIoRequestPacket *)MmCacheAllocate(&IrpCache);
+
+    if (!irp)
+        return nullptr;
+
+    if (!(irp->CurrentLocation = (PzIoStackLocation *)MmCacheAllocate(&StackLocationCache))) {
+        MmCacheFree(&IrpCache, irp);
+        return nullptr;
+    }
+
+    irp->Mdl = nullptr;
     return irp;
 }
 
 void IoFreeIrp(PzIoRequestPacket *irp)
 {
     //ObDereferenceObject(irp->AssociatedThread);
-    PzHeapFree(irp->CurrentLocation);
-    PzHeapFree(irp);
+    MmCacheFree(&StackLocationCache, irp->CurrentLocation);
+    MmCacheFree(&IrpCache, irp);
 }
 
 PzStatus IoCallDriver(PzDeviceObject *device, PzIoRequestPacket *irp)
@@ -103,8 +120,68 @@ failed:
     return drv_status;
 }
 
+PzStatus IoReopenFile(
+    PzIoControlBlock *control_block, u32 access, PzIoControlBlock **reopened)
+{
+    PzIoStatusBlock iosb;
+    PzIoControlBlock *new_block;
+
+    if (!ObCreateUnnamedObject(ObGetObjectDirectory(PZ_OBJECT_IOCB),
+        (ObPointer *)&new_block, PZ_OBJECT_IOCB, 0, false))
+        return STATUS_FAILED;
+
+    PzIoRequestPacket *irp = IoAllocateIrp(1);
+
+    if (!irp) {
+        ObDereferenceObject(new_block);
+        return STATUS_ALLOCATION_FAILED;
+    }
+
+    ObReferenceObject(control_block->Device);
+    new_block->Device = control_block->Device;
+    new_block->Filename = PzDuplicateString(control_block->Filename);
+    new_block->Irp = irp;
+    new_block->CurrentOffset = 0;
+    new_block->Context = 0;
+
+    irp->AssociatedThread = PsGetCurrentThread();
+    irp->UserStatus = &iosb;
+    irp->Iocb = new_block;
+    irp->CurrentLocation->MajorFunction = IRP_MJ_CREATE;
+    irp->CurrentLocation->MinorFunction = 0;
+    irp->CurrentLocation->Parameters.Create.Access = access;
+    irp->CurrentLocation->Parameters.Create.Disposition = OPEN_EXISTING;
+
+    PzStatus drv_status = IoCallDriver(new_block->Device, irp);
+
+    if (drv_status != STATUS_SUCCESS) {
+        IoFreeIrp(irp);
+        ObDereferenceObject(new_block);
+        return drv_status;
+    }
+
+    *reopened = new_block;
+    return STATUS_SUCCESS;
+}
+
 #include <window/console.hh>
 
+/* Describes the buffer of a read or write for devices that transfer to it directly.
+   Without a list, which is also the case if the buffer can't be locked, drivers use SystemBuffer. */
+static PzMemoryDescriptorList *IoCreateTransferMdl(
+    PzDeviceObject *device, void *buffer, u32 bytes, bool write)
+{
+    return device->Flags & DEVICE_FLAG_DIRECT_IO ? MmCreateMdl(buffer, bytes, write) : nullptr;
+}
+
+static void IoFreeTransferMdl(PzIoRequestPacket *irp)
+{
+    if (irp->Mdl) {
+        MmFreeMdl(irp->Mdl);
+        irp->Mdl = nullptr;
+    }
+}
+
 PzStatus PzReadFileRaw(
     PzIoControlBlock *control_block,
     void *buffer, PzIoStatusBlock *iosb,
@@ -113,6 +190,7 @@ PzStatus PzReadFileRaw(
     PzIoStackLocation *stack_loc = control_block->Irp->CurrentLocation;
     control_block->Irp->SystemBuffer = buffer;
     control_block->Irp->UserStatus = iosb;
+    control_block->Irp->Mdl = IoCreateTransferMdl(control_block->Device, buffer, bytes, true);
     stack_loc->MajorFunction = IRP_MJ_READ;
     stack_loc->MinorFunction = 0;
     stack_loc->Parameters.Read.Length = bytes;
@@ -120,6 +198,7 @@ PzStatus PzReadFileRaw(
 
     PzStatus drv_status = IoCallDriver(control_block->Device, control_block->Irp);
     iosb->Status = drv_status;
+    IoFreeTransferMdl(control_block->Irp);
 
     if (drv_status == STATUS_SUCCESS) {
         /* Automatically advance the internal file offset by the number of bytes read */
@@ -167,6 +246,7 @@ PzStatus PzWriteFileRaw(
 
     control_block->Irp->SystemBuffer = (void *)buffer;
     control_block->Irp->UserStatus = iosb;
+    control_block->Irp->Mdl = IoCreateTransferMdl(control_block->Device, (void *)buffer, bytes, false);
     stack_loc->MajorFunction = IRP_MJ_WRITE;
     stack_loc->MinorFunction = 0;
     stack_loc->Parameters.Write.Length = bytes;
@@ -174,6 +254,7 @@ PzStatus PzWriteFileRaw(
 
     PzStatus drv_status = IoCallDriver(control_block->Device, control_block->Irp);
     iosb->Status = drv_status;
+    IoFreeTransferMdl(control_block->Irp);
 
     if (drv_status == STATUS_SUCCESS) {
         /* Automatically advance the internal file offset by the number of bytes written */
@@ -284,7 +365,7 @@ PzStatus IoLoadDriver(const PzString *path, PzDriverObject **driver)
         &status, ACCESS_READ, OPEN_EXISTING))
         return cf_status;
 
-    /* Retrieve the file's length so we can allocate a buffer of sufficient size for it. */
+    /* Retrieve the file's length so we know how much of it to map. */
     PzFileInformationBasic basic;
     if (PzStatus q_status = PzQueryInformationFile(handle, &status,
         FILE_INFORMATION_BASIC, &basic,
@@ -293,24 +374,24 @@ PzStatus IoLoadDriver(const PzString *path, PzDriverObject **driver)
         return q_status;
     }
 
-    /* Allocate a buffer for the file and read it */
-    void *buffer = MmVirtualAllocateMemory(nullptr, basic.Size, PAGE_READWRITE, nullptr);
+    PzIoControlBlock *control_block;
+    ObReferenceObjectByHandle(PZ_OBJECT_IOCB, nullptr, handle, (ObPointer *)&control_block);
+
+    /* Map a view of the file and read it in, rather than copying it into a buffer */
+    void *view;
+    PzStatus load_status = MmiMapViewOfFile(PZ_KPROC, control_block, 0, basic.Size, &view);
 
-    if (!buffer) {
-        PzCloseHandle(handle);
-        return STATUS_ALLOCATION_FAILED;
-    }
+    ObDereferenceObject(control_block);
 
-    if (PzStatus rd_status = PzReadFile(handle, buffer, &status, basic.Size, nullptr)) {
+    if (load_status) {
         PzCloseHandle(handle);
-        MmVirtualFreeMemory(buffer, basic.Size);
-        return rd_status;
+        return load_status;
     }
 
-    PzStatus load_status = IoLoadMemoryDriver(buffer, basic.Size, driver);
+    if (!(load_status = MmiPopulateView(PZ_KPROC, view, basic.Size)))
+        load_status = IoLoadMemoryDriver(view, basic.Size, driver);
 
-    /* Free buffer */
-    MmVirtualFreeMemory(buffer, basic.Size);
+    MmiUnmapViewOfFile(PZ_KPROC, view);
     PzCloseHandle(handle);
     return load_status;
 }
@@ -4,12 +4,15 @@
 #include <serial.hh>
 #include <mm/physical.hh>
 #include <mm/virtual.hh>
+#include <mm/selftest.hh>
 #include <x86/gdt.hh>
 #include <x86/idt.hh>
 #include <lib/malloc.hh>
+#include <lib/util.hh>
 #include <ldr/peldr.hh>
 #include <io/manager.hh>
 #include <sched/scheduler.hh>
+#include <sched/rcu.hh>
 #include <pci/pci.hh>
 #include <acpi/tables.hh>
 #include <x86/apic.hh>
@@ -17,6 +20,8 @@
 #include <gfx/link.hh>
 
 //#define PRIZM_DEBUG_BUILD
+//#define PRIZM_MEMORY_BENCHMARK
+//#define PRIZM_MM_SELFTEST
 
 #if 0
 /* Stack trace test, ignore */
@@ -70,6 +75,8 @@ int PzInitThread(void *param)
 #ifdef PRIZM_DEBUG_BUILD
     DbgStartListener();
 #endif
+    DbgStartLogDrain();
+    SchStartRcuWorker();
 
     auto *boot_info = (KernelBootInfo *)param;
     LdrInitializeLoader(boot_info);
@@ -145,6 +152,10 @@ int PzInitThread(void *param)
 
     DbgPrintStr("[PzInitThread] PzCreateProcess returned: %i\r\n", creation);
 
+#ifdef PRIZM_SPINLOCK_STATISTICS
+    PzPrintSpinlockStatistics();
+#endif
+
     if (creation != STATUS_SUCCESS)
         PzPanic(nullptr, PANIC_REASON_FAILED_INIT_PROCESS, "Failed to create init process");
 
@@ -165,6 +176,7 @@ extern "C" void HalEnableSSE();
 PZ_KERNEL_EXPORT void PzKernelInit(KernelBootInfo *boot)
 {
     HalEnableSSE();
+    MemInitializeRoutines();
     SerialInitializePort(1, 115200);
 
     AttachDebugger();
@@ -182,9 +194,18 @@ PZ_KERNEL_EXPORT void PzKernelInit(KernelBootInfo *boot)
     HalIdtInitialize();
     PzHeapInitialize();
 
+#ifdef PRIZM_MEMORY_BENCHMARK
+    MemRunBenchmark();
+#endif
+
+#ifdef PRIZM_MM_SELFTEST
+    MmRunSelfTests();
+#endif
+
     //AcpiInitialize();
     //AcpiInitializeTables();
     ObInitializeObjManager();
+    SerialInitializeDevices();
     //HalApicInitialize();
     SchInitializeScheduler(PzInitThread, boot);
 
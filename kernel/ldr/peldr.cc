@@ -285,6 +285,7 @@ bool LdriCreateModule(
 #include <io/manager.hh>
 #include <core.hh>
 #include <mm/virtual.hh>
+#include <mm/section.hh>
 
 PzStatus LdrLoadImageFile(
     PzHandle process,
@@ -299,7 +300,7 @@ PzStatus LdrLoadImageFile(
         &status, ACCESS_READ, OPEN_EXISTING))
         return cf_status;
 
-    /* Retrieve the file's length so we can allocate a buffer of sufficient size for it. */
+    /* Retrieve the file's length so we know how much of it to map. */
     PzFileInformationBasic basic;
 
     if (PzStatus q_status = PzQueryInformationFile(handle, &status,
@@ -309,33 +310,40 @@ PzStatus LdrLoadImageFile(
         return q_status;
     }
 
-    /* Allocate a buffer for the file and read it */
-    void *buffer = MmVirtualAllocateMemory(nullptr, basic.Size, PAGE_READWRITE, nullptr);
+    PzIoControlBlock *control_block;
+    ObReferenceObjectByHandle(PZ_OBJECT_IOCB, nullptr, handle, (ObPointer *)&control_block);
 
-    if (!buffer) {
+    /* Map a view of the file instead of copying it into a buffer. LdrLoadImage
+       copies user images with the IRQL raised, so the view has to be read in up front. */
+    void *view;
+    PzStatus map_status = MmiMapViewOfFile(PZ_KPROC, control_block, 0, basic.Size, &view);
+
+    ObDereferenceObject(control_block);
+
+    if (map_status) {
         PzCloseHandle(handle);
-        return STATUS_ALLOCATION_FAILED;
+        return map_status;
     }
 
-    if (PzStatus rd_status = PzReadFile(handle, buffer, &status, basic.Size, nullptr)) {
+    if (PzStatus rd_status = MmiPopulateView(PZ_KPROC, view, basic.Size)) {
+        MmiUnmapViewOfFile(PZ_KPROC, view);
         PzCloseHandle(handle);
-        MmVirtualFreeMemory(buffer, basic.Size);
         return rd_status;
     }
 
     PzProcessObject *proc;
     ObReferenceObjectByHandle(PZ_OBJECT_PROCESS, nullptr, process, (ObPointer *)&proc);
 
-    if (!LdrLoadImage(proc, image_name->Buffer, buffer, basic.Size, mod_handle)) {
+    if (!LdrLoadImage(proc, image_name->Buffer, view, basic.Size, mod_handle)) {
         ObDereferenceObject(proc);
-        MmVirtualFreeMemory(buffer, basic.Size);
+        MmiUnmapViewOfFile(PZ_KPROC, view);
         PzCloseHandle(handle);
         return -1;
     }
 
-    /* Free buffer and close executable file handle */
+    /* Unmap the view and close executable file handle */
     ObDereferenceObject(proc);
-    MmVirtualFreeMemory(buffer, basic.Size);
+    MmiUnmapViewOfFile(PZ_KPROC, view);
     PzCloseHandle(handle);
 
     return STATUS_SUCCESS;
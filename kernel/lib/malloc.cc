@@ -5,7 +5,7 @@ PzKernelPool KernelPool;
 
 void PzHeapInitialize()
 {
-    PlInitializeKernelPool(&KernelPool, 1024 * 1024 * 2);
+    PlInitializeKernelPool(&KernelPool);
 }
 
 void *PzHeapAllocate(u32 bytes, u32 flags)
@@ -28,6 +28,11 @@ void PzHeapFree(void *mem)
     PlFreeMemory(&KernelPool, mem);
 }
 
+void PzHeapQuery(PzKernelPoolInformation *info)
+{
+    PlQueryPool(&KernelPool, info);
+}
+
 void *operator new(size_t size)
 {
     return PzHeapAllocate(size, 0);
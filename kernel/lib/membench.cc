@@ -0,0 +1,89 @@
+#include <lib/util.hh>
+#include <mm/virtual.hh>
+#include <x86/cpu.hh>
+#include <x86/port.hh>
+#include <debug.hh>
+
+#define PIT_FREQUENCY 1193182
+#define BENCHMARK_BUFFER_SIZE (4 * 1024 * 1024)
+/* Every size is repeated until about this many bytes have gone through */
+#define BENCHMARK_BYTES_PER_SIZE (64 * 1024 * 1024)
+
+/* Measures the TSC frequency against 10 ms counted down by PIT channel 2,
+   whose output can be polled without taking interrupts */
+static u64 MeasureTscFrequency()
+{
+    u16 count = PIT_FREQUENCY / 100;
+    u8 gate = HalPortIn8(0x61);
+
+    /* Keep the speaker off and have the gate low while the count is loaded */
+    HalPortOut8(0x61, gate & ~0x03);
+    HalPortOut8(0x43, 0xB0); /* Channel 2, interrupt on terminal count */
+    HalPortOut8(0x42, count & 0xFF);
+    HalPortOut8(0x42, count >> 8);
+
+    HalPortOut8(0x61, (gate & ~0x02) | 0x01);
+    u64 start = HalReadTsc();
+
+    while (!(HalPortIn8(0x61) & 0x20));
+
+    u64 end = HalReadTsc();
+    HalPortOut8(0x61, gate);
+
+    return (end - start) * 100;
+}
+
+static void PrintThroughput(const char *name, int size, u64 bytes, u64 cycles, u64 frequency)
+{
+    /* Hundredths of a GB/s */
+    u64 rate = cycles ? bytes * 100 * frequency / cycles / 1000000000 : 0;
+    DbgPrintStr("[MemRunBenchmark] %s %8i bytes: %u.%02u GB/s\r\n",
+        name, size, u32(rate / 100), u32(rate % 100));
+}
+
+void MemRunBenchmark()
+{
+    static const int sizes[] = {
+        8, 16, 64, 256, 1024, 4096, 64 * 1024, 256 * 1024, 1024 * 1024, 4 * 1024 * 1024
+    };
+
+    u8 *source = (u8 *)MmVirtualAllocateMemory(nullptr, BENCHMARK_BUFFER_SIZE, PAGE_READWRITE, nullptr);
+    u8 *dest = (u8 *)MmVirtualAllocateMemory(nullptr, BENCHMARK_BUFFER_SIZE, PAGE_READWRITE, nullptr);
+
+    if (!source || !dest) {
+        DbgPrintStr("[MemRunBenchmark] Not enough memory for the buffers\r\n");
+
+        if (source)
+            MmVirtualFreeMemory(source, BENCHMARK_BUFFER_SIZE);
+
+        if (dest)
+            MmVirtualFreeMemory(dest, BENCHMARK_BUFFER_SIZE);
+
+        return;
+    }
+
+    u64 frequency = MeasureTscFrequency();
+    DbgPrintStr("[MemRunBenchmark] TSC runs at %u MHz\r\n", u32(frequency / 1000000));
+
+    /* Touch both buffers, so that the first size doesn't pay for it */
+    MemSet(source, 0x5A, BENCHMARK_BUFFER_SIZE);
+    MemSet(dest, 0, BENCHMARK_BUFFER_SIZE);
+
+    for (int size : sizes) {
+        int iterations = Max(BENCHMARK_BYTES_PER_SIZE / size, 1);
+        u64 bytes = u64(iterations) * size;
+
+        u64 start = HalReadTsc();
+        for (int i = 0; i < iterations; i++)
+            MemCopy(dest, source, size);
+        PrintThroughput("MemCopy", size, bytes, HalReadTsc() - start, frequency);
+
+        start = HalReadTsc();
+        for (int i = 0; i < iterations; i++)
+            MemSet(dest, i, size);
+        PrintThroughput("MemSet ", size, bytes, HalReadTsc() - start, frequency);
+    }
+
+    MmVirtualFreeMemory(source, BENCHMARK_BUFFER_SIZE);
+    MmVirtualFreeMemory(dest, BENCHMARK_BUFFER_SIZE);
+}
\ No newline at end of file
@@ -12,13 +12,14 @@ enum {
     LengthLd
 };
 
-void PrintfWithCallbackV(void (*print_func)(char), const char *format, va_list params)
+void PrintfWithContextV(void (*print_func)(void *context, char),
+    void *context, const char *format, va_list params)
 {
     char buffer[128];
-    int total_written;
+    int total_written = 0;
 
     #define PRINT_BUF do { char *start = buffer; while (*start) PRINT_CHAR(*start++); } while(0)
-    #define PRINT_CHAR(x) do { print_func((x)); total_written++; } while(0)
+    #define PRINT_CHAR(x) do { print_func(context, (x)); total_written++; } while(0)
 
     while (*format) {
         if (*format == '%') {
@@ -267,4 +268,40 @@ void PrintfWithCallbackV(void (*print_func)(char), const char *format, va_list p
         else
             PRINT_CHAR(*format++);
     }
+}
+
+static void PrintThroughCallback(void *context, char c)
+{
+    ((void (*)(char))context)(c);
+}
+
+void PrintfWithCallbackV(void (*print_func)(char), const char *format, va_list params)
+{
+    PrintfWithContextV(PrintThroughCallback, (void *)print_func, format, params);
+}
+
+struct FormatBuffer
+{
+    char *Buffer;
+    int Size, Length;
+};
+
+static void PrintToBuffer(void *context, char c)
+{
+    auto *buffer = (FormatBuffer *)context;
+
+    if (buffer->Length < buffer->Size - 1)
+        buffer->Buffer[buffer->Length++] = c;
+}
+
+int FormatStringV(char *buffer, int size, const char *format, va_list params)
+{
+    FormatBuffer out = { buffer, size, 0 };
+
+    if (size <= 0)
+        return 0;
+
+    PrintfWithContextV(PrintToBuffer, &out, format, params);
+    buffer[out.Length] = '\0';
+    return out.Length;
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include <lib/string.hh>
 #include <lib/util.hh>
 #include <lib/malloc.hh>
+#include <mm/usercopy.hh>
 
 char *Utf8EncodeNext(char *buffer, int codepoint)
 {
@@ -221,4 +222,28 @@ bool PzValidateString(bool as_usermode, const PzString *str, bool write)
 {
     return MmVirtualProbeMemory(as_usermode, (uptr)str, sizeof(PzString), write) &&
         MmVirtualProbeMemory(as_usermode, (uptr)str->Buffer, str->Size + 1, write);
+}
+
+PzString *PzCaptureUserString(const PzString *src)
+{
+    PzString header;
+
+    if (!MmCopyFromUser(&header, src, sizeof header) || header.Size + 1 == 0)
+        return nullptr;
+
+    PzString *dest = PzAllocateString();
+
+    if (!dest)
+        return nullptr;
+
+    /* Only the size read above counts, whatever the caller changes meanwhile */
+    if (!(dest->Buffer = new char[header.Size + 1]) ||
+        !MmCopyFromUser(dest->Buffer, header.Buffer, header.Size)) {
+        PzFreeString(dest);
+        return nullptr;
+    }
+
+    dest->Buffer[header.Size] = 0;
+    dest->Size = header.Size;
+    return dest;
 }
\ No newline at end of file
@@ -1,15 +1,94 @@
 #include <lib/util.hh>
+#include <x86/cpu.hh>
 
 extern "C" void HalRepMemcpy(void *dest, const void *src, int count);
+extern "C" void HalRepMemset(void *dest, u32 pattern, int count);
+extern "C" void HalSse2Copy(void *dest, const void *src, int count, bool nontemporal);
+extern "C" void HalSse2Fill(void *dest, u32 pattern, int count, bool nontemporal);
+
+/* Sizes below which the string instructions are slower than plain moves,
+   at or above which SSE2 pays for saving its registers, and at or above
+   which the data would only push everything else out of the caches. */
+#define MEM_SMALL_LIMIT 16
+#define MEM_SSE2_THRESHOLD 256
+#define MEM_NONTEMPORAL_THRESHOLD (256 * 1024)
+
+typedef u32 UnalignedU32 __attribute__((aligned(1), may_alias));
+
+static bool MemSse2Supported;
+
+void MemInitializeRoutines()
+{
+    u32 eax, ebx, ecx, edx;
+    HalCpuid(CPUID_LEAF_FEATURES, &eax, &ebx, &ecx, &edx);
+
+    /* HalEnableSSE has set up CR0 and CR4 by now, so only the processor matters */
+    MemSse2Supported = edx & CPUID_EDX_FXSR && edx & CPUID_EDX_SSE2;
+}
 
 void MemCopy(void *dest, const void *src, int count)
 {
-    if (count > 0)
+    auto *d = (u8 *)dest;
+    auto *s = (const u8 *)src;
+
+    if (count <= 0)
+        return;
+
+    /* Small copies load both ends before storing, with the halves overlapping if need be */
+    if (count < MEM_SMALL_LIMIT) {
+        if (count >= 8) {
+            u32 a = *(UnalignedU32 *)s, b = *(UnalignedU32 *)(s + 4);
+            u32 c = *(UnalignedU32 *)(s + count - 8), e = *(UnalignedU32 *)(s + count - 4);
+            *(UnalignedU32 *)d = a;
+            *(UnalignedU32 *)(d + 4) = b;
+            *(UnalignedU32 *)(d + count - 8) = c;
+            *(UnalignedU32 *)(d + count - 4) = e;
+        }
+        else if (count >= 4) {
+            u32 a = *(UnalignedU32 *)s, b = *(UnalignedU32 *)(s + count - 4);
+            *(UnalignedU32 *)d = a;
+            *(UnalignedU32 *)(d + count - 4) = b;
+        }
+        else {
+            u8 a = s[0], b = s[count / 2], c = s[count - 1];
+            d[0] = a;
+            d[count / 2] = b;
+            d[count - 1] = c;
+        }
+    }
+    else if (count >= MEM_SSE2_THRESHOLD && MemSse2Supported)
+        HalSse2Copy(dest, src, count, count >= MEM_NONTEMPORAL_THRESHOLD);
+    else
         HalRepMemcpy(dest, src, count);
 }
 
 void MemSet(void *dest, int value, int count)
 {
-    for (int i = 0; i < count; i++)
-        ((char *)dest)[i] = value;
+    auto *d = (u8 *)dest;
+    u32 pattern = (u8)value * 0x01010101u;
+
+    if (count <= 0)
+        return;
+
+    if (count < MEM_SMALL_LIMIT) {
+        if (count >= 8) {
+            *(UnalignedU32 *)d = pattern;
+            *(UnalignedU32 *)(d + 4) = pattern;
+            *(UnalignedU32 *)(d + count - 8) = pattern;
+            *(UnalignedU32 *)(d + count - 4) = pattern;
+        }
+        else if (count >= 4) {
+            *(UnalignedU32 *)d = pattern;
+            *(UnalignedU32 *)(d + count - 4) = pattern;
+        }
+        else {
+            d[0] = value;
+            d[count / 2] = value;
+            d[count - 1] = value;
+        }
+    }
+    else if (count >= MEM_SSE2_THRESHOLD && MemSse2Supported)
+        HalSse2Fill(dest, pattern, count, count >= MEM_NONTEMPORAL_THRESHOLD);
+    else
+        HalRepMemset(dest, pattern, count);
 }
\ No newline at end of file
@@ -0,0 +1,232 @@
+#include <mm/kva.hh>
+#include <lib/avltree.hh>
+#include <lib/util.hh>
+
+struct KvaExtent
+{
+    u32 Start, Pages;
+    /* Size of the largest extent in the subtree rooted at this one */
+    u32 LargestPages;
+};
+
+typedef AvlNode<KvaExtent> KvaNode;
+
+struct KvaExtentOps
+{
+    static int Compare(const KvaExtent &a, const KvaExtent &b)
+    {
+        return a.Start < b.Start ? -1 : a.Start > b.Start;
+    }
+
+    static void Update(KvaNode *node)
+    {
+        u32 largest = node->Value.Pages;
+
+        if (node->Left)
+            largest = Max(largest, node->Left->Value.LargestPages);
+
+        if (node->Right)
+            largest = Max(largest, node->Right->Value.LargestPages);
+
+        node->Value.LargestPages = largest;
+    }
+};
+
+static AvlTree<KvaExtent, KvaExtentOps> FreeExtents;
+
+/* Descriptors used before the virtual memory manager can donate pages of them */
+static KvaNode BootstrapDescriptors[64];
+static KvaNode *SpareDescriptors;
+static u32 SpareCount;
+
+static KvaNode *NewDescriptor(u32 start, u32 pages)
+{
+    KvaNode *node = SpareDescriptors;
+
+    if (!node)
+        return nullptr;
+
+    SpareDescriptors = node->Left;
+    SpareCount--;
+
+    node->Value = KvaExtent { start, pages, pages };
+    return node;
+}
+
+static void DeleteDescriptor(KvaNode *node)
+{
+    node->Left = SpareDescriptors;
+    SpareDescriptors = node;
+    SpareCount++;
+}
+
+void MmKvaAddDescriptors(void *memory, u32 bytes)
+{
+    auto *nodes = (KvaNode *)memory;
+
+    for (u32 i = 0; i < bytes / sizeof(KvaNode); i++)
+        DeleteDescriptor(nodes + i);
+}
+
+bool MmKvaNeedsDescriptors()
+{
+    return SpareCount < KVA_DESCRIPTORS_LOW;
+}
+
+void MmKvaInitialize(u32 total_pages)
+{
+    MmKvaAddDescriptors(BootstrapDescriptors, sizeof BootstrapDescriptors);
+    FreeExtents.Insert(NewDescriptor(0, total_pages));
+}
+
+/* Shrinks an extent from either end, deleting it once it becomes empty */
+static void ShrinkExtent(KvaNode *node, u32 new_start, u32 new_pages)
+{
+    if (!new_pages) {
+        FreeExtents.Remove(node);
+        DeleteDescriptor(node);
+        return;
+    }
+
+    node->Value.Start = new_start;
+    node->Value.Pages = new_pages;
+    FreeExtents.Updated(node);
+}
+
+/* Finds the extent with the greatest start index not above `index` */
+static KvaNode *FindFloor(u32 index)
+{
+    KvaNode *floor = nullptr;
+
+    for (KvaNode *node = FreeExtents.Root; node;) {
+        if (node->Value.Start <= index) {
+            floor = node;
+            node = node->Right;
+        }
+        else
+            node = node->Left;
+    }
+
+    return floor;
+}
+
+/* Finds the lowest extent of at least `pages` pages */
+static KvaNode *FindLowestFit(u32 pages)
+{
+    KvaNode *node = FreeExtents.Root;
+
+    if (!node || node->Value.LargestPages < pages)
+        return nullptr;
+
+    /* Descend towards the lowest extent that fits, guided by the subtree maxima */
+    for (;;) {
+        if (node->Left && node->Left->Value.LargestPages >= pages)
+            node = node->Left;
+        else if (node->Value.Pages >= pages)
+            return node;
+        else
+            node = node->Right;
+    }
+}
+
+int MmKvaAllocate(u32 pages)
+{
+    KvaNode *node = pages ? FindLowestFit(pages) : nullptr;
+
+    if (!node)
+        return -1;
+
+    u32 index = node->Value.Start;
+    ShrinkExtent(node, index + pages, node->Value.Pages - pages);
+    return index;
+}
+
+int MmKvaAllocateAligned(u32 pages, u32 alignment, u32 offset)
+{
+    if (!pages || !alignment || alignment & (alignment - 1) || pages + alignment - 1 < pages)
+        return -1;
+
+    /* Any extent this large holds an aligned range, wherever it starts */
+    KvaNode *node = FindLowestFit(pages + alignment - 1);
+
+    if (!node)
+        return -1;
+
+    u32 index = node->Value.Start + ((offset - node->Value.Start) & (alignment - 1));
+    return MmKvaReserve(index, pages) ? index : -1;
+}
+
+bool MmKvaReserve(u32 index, u32 pages)
+{
+    KvaNode *node = FindFloor(index);
+
+    if (!pages || !node)
+        return false;
+
+    u32 start = node->Value.Start, end = start + node->Value.Pages;
+
+    if (index + pages > end)
+        return false;
+
+    if (index == start)
+        ShrinkExtent(node, index + pages, end - index - pages);
+    else if (index + pages == end)
+        ShrinkExtent(node, start, index - start);
+    else {
+        /* The range lies in the middle of the extent, so it has to be split in two */
+        KvaNode *upper = NewDescriptor(index + pages, end - index - pages);
+
+        if (!upper)
+            return false;
+
+        ShrinkExtent(node, start, index - start);
+        FreeExtents.Insert(upper);
+    }
+
+    return true;
+}
+
+bool MmKvaFree(u32 index, u32 pages)
+{
+    if (!pages)
+        return false;
+
+    KvaNode *lower = FindFloor(index);
+    KvaNode *upper = lower ? FreeExtents.Next(lower) : FreeExtents.First();
+
+    /* Refuse to free ranges that are partially free already */
+    if (lower && lower->Value.Start + lower->Value.Pages > index ||
+        upper && upper->Value.Start < index + pages)
+        return false;
+
+    bool merge_lower = lower && lower->Value.Start + lower->Value.Pages == index;
+    bool merge_upper = upper && upper->Value.Start == index + pages;
+
+    if (merge_lower && merge_upper) {
+        u32 upper_pages = upper->Value.Pages;
+        FreeExtents.Remove(upper);
+        DeleteDescriptor(upper);
+
+        lower->Value.Pages += pages + upper_pages;
+        FreeExtents.Updated(lower);
+    }
+    else if (merge_lower) {
+        lower->Value.Pages += pages;
+        FreeExtents.Updated(lower);
+    }
+    else if (merge_upper) {
+        upper->Value.Start = index;
+        upper->Value.Pages += pages;
+        FreeExtents.Updated(upper);
+    }
+    else {
+        KvaNode *node = NewDescriptor(index, pages);
+
+        if (!node)
+            return false;
+
+        FreeExtents.Insert(node);
+    }
+
+    return true;
+}
\ No newline at end of file
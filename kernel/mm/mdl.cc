@@ -0,0 +1,50 @@
+#include <mm/mdl.hh>
+#include <mm/virtual.hh>
+#include <lib/malloc.hh>
+#include <lib/util.hh>
+#include <obj/manager.hh>
+#include <obj/process.hh>
+#include <sched/scheduler.hh>
+
+PzMemoryDescriptorList *MmCreateMdl(void *buffer, u32 bytes, bool write)
+{
+    uptr start = uptr(buffer);
+    bool user = start < KERNEL_SPACE_START;
+
+    if (!bytes || start + bytes < start)
+        return nullptr;
+
+    u32 offset = start % PAGE_SIZE;
+    u32 pages = PAGES_IN(offset + bytes);
+    auto *mdl = (PzMemoryDescriptorList *)PzHeapAllocate(
+        sizeof(PzMemoryDescriptorList) + pages * sizeof(uptr), 0);
+
+    if (!mdl)
+        return nullptr;
+
+    mdl->VirtualAddress = buffer;
+    mdl->ByteCount = bytes;
+    mdl->ByteOffset = offset;
+    mdl->PageCount = pages;
+    mdl->Process = user ? PsGetCurrentProcess() : nullptr;
+
+    if (!MmiLockPages(mdl->Process, start & -PAGE_SIZE, pages, write, mdl->Pages)) {
+        PzHeapFree(mdl);
+        return nullptr;
+    }
+
+    if (mdl->Process)
+        ObReferenceObject(mdl->Process);
+
+    return mdl;
+}
+
+void MmFreeMdl(PzMemoryDescriptorList *mdl)
+{
+    if (mdl->Process) {
+        MmiUnlockPages(mdl->Process, uptr(mdl->VirtualAddress) & -PAGE_SIZE, mdl->PageCount);
+        ObDereferenceObject(mdl->Process);
+    }
+
+    PzHeapFree(mdl);
+}
\ No newline at end of file
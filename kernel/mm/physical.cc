@@ -1,5 +1,7 @@
 #include <mm/physical.hh>
 #include <mm/virtual.hh>
+#include <mm/query.hh>
+#include <mm/tlb.hh>
 #include <x86/e820.hh>
 #include <lib/util.hh>
 #include <spinlock.hh>
@@ -7,14 +9,37 @@
 
 #define MAX_ORDER 7
 #define ORDERS ((MAX_ORDER) + 1)
+static_assert(ORDERS == PHYSICAL_ORDERS);
+#define MAX_ZONES 16
 
-struct AllocatorPhysRegion
+/* Blocks of the highest order are naturally aligned within physical memory */
+#define ZONE_ALIGNMENT (PAGE_SIZE << MAX_ORDER)
+
+/* Part of physical memory identity mapped by the bootloader's page tables */
+#define BOOT_IDENTITY_MAP_END 0x80000000u
+
+/* End of the bootloader's page tables and page directory, which stay in use until the
+   kernel switches to its own. Everything below them is real mode memory holding the
+   memory map, the loader and the bootstrap drivers. */
+#define BOOT_PAGE_TABLES_END 0x501000u
+
+/* Contiguous range of usable physical memory with a buddy bitmap of its own */
+struct AllocatorZone
 {
     uptr DataStart, DataEnd;
-    uptr BmpPhysicalStart;
-    u32 BmpTotalSize;
+    u32 TotalPages, FreePages;
     u32 BmpSizes[ORDERS], Search[ORDERS];
     u8 *Bitmaps[ORDERS];
+};
+
+/* Zones sorted by address. The bitmaps of all zones share a single block of
+   memory, carved out of the first zone that is reachable before paging is set up. */
+static struct
+{
+    AllocatorZone Zones[MAX_ZONES];
+    int ZoneCount;
+    uptr BmpPhysicalStart;
+    u32 BmpTotalSize;
 } Allocator;
 
 struct MemRegion
@@ -91,7 +116,16 @@ void EnumerateRegions(
         return;
     }
 
-    MemRegionLinked next_reg = { region->BaseLo, region->BaseLo + region->LengthLo, prev };
+    /* Memory above 4 GiB can't be addressed without PAE */
+    if (region->BaseHi) {
+        EnumerateRegions(
+            region + 1, prev, regions,
+            region_count, max_regions);
+        return;
+    }
+
+    u64 end = Min<u64>(u64(region->BaseLo) + (u64(region->LengthHi) << 32 | region->LengthLo), -PAGE_SIZE);
+    MemRegionLinked next_reg = { region->BaseLo, uptr(end), prev };
     EnumerateRegions(
         region + 1, CombineRegions(prev, &next_reg),
         regions, region_count, max_regions);
@@ -116,55 +150,103 @@ template<bool set> inline void BmpWriteBit(void *bmp, int index)
 
 template<bool set> void BmpWriteBits(u8 *bmp, int index, int count);
 
+/* Returns how many bytes the bitmaps of all orders take up for a zone of `pages` pages */
+static u32 ZoneBitmapBytes(u32 pages)
+{
+    u32 bytes = 0;
+
+    for (int i = 0; i < ORDERS; i++)
+        bytes += ALIGN(pages >> i, 32) / 8;
+
+    return bytes;
+}
+
 void MmPhysicalInitializeState(KernelBootInfo *info)
 {
+    PzTrackSpinlock(&MmPhysicalLock, "MmPhysicalLock");
+
     int reg_count;
     MemRegion regions[64];
     EnumerateRegions(info->MemMapPointer, nullptr, regions, reg_count, 64);
 
-    MemRegion *biggest = nullptr;
-    u32 sizeof_biggest = 0;
+    /* Keep the remainder of the kernel's last large page away from the allocator,
+       so that the virtual memory manager can map the whole image with 4 MiB pages. */
+    if (info->KernelPhysicalStart % LARGE_PAGE_SIZE == 0)
+        info->KernelPhysicalEnd = ALIGN(info->KernelPhysicalEnd, LARGE_PAGE_SIZE);
+
+    /* Usable memory is split around what the boot process still needs, in ascending order */
+    const MemRegion reserved[] = {
+        { 0, BOOT_PAGE_TABLES_END },
+        { info->KernelPhysicalStart, info->KernelPhysicalEnd },
+    };
+    u32 bitmap_bytes = 0;
 
     for (int i = 0; i < reg_count; i++) {
-        u32 size = regions[i].End - regions[i].Start;
-        if (size > sizeof_biggest) {
-            biggest = regions + i;
-            sizeof_biggest = size;
+        uptr next = regions[i].Start;
+
+        for (int j = 0; j <= 2 && Allocator.ZoneCount < MAX_ZONES; j++) {
+            uptr start = ALIGN(next, ZONE_ALIGNMENT);
+            uptr end = (j < 2 ? Min(regions[i].End, reserved[j].Start) : regions[i].End) & -PAGE_SIZE;
+
+            if (j < 2)
+                next = Max(next, reserved[j].End);
+
+            if (start >= end || start < regions[i].Start)
+                continue;
+
+            AllocatorZone *zone = &Allocator.Zones[Allocator.ZoneCount++];
+            zone->DataStart = start;
+            zone->DataEnd = end;
+            bitmap_bytes += ZoneBitmapBytes((end - start) / PAGE_SIZE);
         }
     }
 
-    if (info->KernelPhysicalEnd > biggest->Start)
-        biggest->Start = info->KernelPhysicalEnd;
+    /* Find room for the bitmaps where they can be written to right away */
+    AllocatorZone *host = nullptr;
 
-    uptr physical_start = ALIGN(biggest->Start, PAGE_SIZE);
-    uptr physical_end = ALIGN(biggest->End, PAGE_SIZE);
+    for (int i = 0; i < Allocator.ZoneCount && !host; i++) {
+        AllocatorZone *zone = &Allocator.Zones[i];
+        uptr bitmaps_end = zone->DataStart + bitmap_bytes;
 
-    DbgPrintStr("[MmPhysicalInit] physical_start=0x%p, physical_end=0x%p\r\n", physical_start, physical_end);
+        if (bitmaps_end <= BOOT_IDENTITY_MAP_END && ALIGN(bitmaps_end, ZONE_ALIGNMENT) < zone->DataEnd)
+            host = zone;
+    }
 
-    int total_pages = (physical_end - physical_start) / PAGE_SIZE;
-    int total_entry_count = 0;
+    if (!host) {
+        DbgPrintStr("[MmPhysicalInit] No room for the physical allocator's bitmaps\r\n");
+        Allocator.ZoneCount = 0;
+        return;
+    }
 
-    for (int i = 0, p = total_pages; i < ORDERS; i++, p >>= 1)
-        total_entry_count += (p + 31) & ~31;
+    Allocator.BmpPhysicalStart = host->DataStart;
+    host->DataStart = ALIGN(host->DataStart + bitmap_bytes, ZONE_ALIGNMENT);
 
-    // Correct available page count accounting for bitmap size
-    total_pages -= PAGES_IN(total_entry_count / 8);
-    Allocator.BmpPhysicalStart = physical_start;
+    u8 *bitmap = (u8 *)Allocator.BmpPhysicalStart;
 
-    for (int i = 0, p = total_pages; i < ORDERS; i++, p >>= 1) {
-        Allocator.Bitmaps[i] = (u8 *)physical_start;
-        Allocator.BmpSizes[i] = p;
-        Allocator.Search[i] = 0;
-        physical_start += ((p + 31) & ~31) / 8;
-        BmpWriteBits<true>(Allocator.Bitmaps[i], p, 31 - (p & 31));
-    }
+    for (int i = 0; i < Allocator.ZoneCount; i++) {
+        AllocatorZone *zone = &Allocator.Zones[i];
+        u32 pages = (zone->DataEnd - zone->DataStart) / PAGE_SIZE;
 
-    Allocator.BmpTotalSize = physical_start - Allocator.BmpPhysicalStart;
-    MemSet((void *)Allocator.BmpPhysicalStart, 0, Allocator.BmpTotalSize);
-    physical_start = ALIGN(physical_start, PAGE_SIZE << MAX_ORDER);
+        zone->TotalPages = zone->FreePages = pages;
 
-    Allocator.DataStart = physical_start;
-    Allocator.DataEnd = physical_end;
+        for (int j = 0; j < ORDERS; j++, pages >>= 1) {
+            u32 bytes = ALIGN(pages, 32) / 8;
+
+            zone->Bitmaps[j] = bitmap;
+            zone->BmpSizes[j] = pages;
+            zone->Search[j] = 0;
+
+            /* Bits past the end of the zone stay set, so they are never handed out */
+            MemSet(bitmap, 0, bytes);
+            BmpWriteBits<true>(bitmap, pages, ALIGN(pages, 32) - pages);
+            bitmap += bytes;
+        }
+
+        DbgPrintStr("[MmPhysicalInit] zone %i: physical_start=0x%p, physical_end=0x%p\r\n",
+            i, zone->DataStart, zone->DataEnd);
+    }
+
+    Allocator.BmpTotalSize = bitmap - (u8 *)Allocator.BmpPhysicalStart;
 }
 
 #include <mm/virtual.hh>
@@ -175,9 +257,10 @@ void MmiPhysicalPostVirtualInit()
         Allocator.BmpPhysicalStart,
         Allocator.BmpTotalSize, PAGE_READWRITE);
 
-    for (int i = 0; i < ORDERS; i++)
-        Allocator.Bitmaps[i] = RELOCATE(Allocator.Bitmaps[i],
-            Allocator.BmpPhysicalStart, new_addr);
+    for (int i = 0; i < Allocator.ZoneCount; i++)
+        for (int j = 0; j < ORDERS; j++)
+            Allocator.Zones[i].Bitmaps[j] = RELOCATE(Allocator.Zones[i].Bitmaps[j],
+                Allocator.BmpPhysicalStart, new_addr);
 }
 
 /* Utility routine to change a range of bits in a bitmap to be a certain value. */
@@ -253,7 +336,7 @@ u32 BmpSearchClearBit(void *bmp, u32 size, u32 start)
     int i = start / 32;
     int j = start / 32;
 
-    u32 dword_size = size / 32;
+    u32 dword_size = (size + 31) / 32;
     u32 *dword = (u32 *)bmp, value;
 
     /* There are two counters headed in opposite directions, both
@@ -285,55 +368,124 @@ u32 BmpSearchClearBit(void *bmp, u32 size, u32 start)
     as allocated or free, making necessary adjustments to the other
     orders' bitmaps as well.
 */
-template<bool free> void MarkPageAs(u32 order, u32 page)
+template<bool free> void MarkPageAs(AllocatorZone *zone, u32 order, u32 page)
 {
     for (int i = 0; i < order; i++)
-        BmpWriteBits<!free>(Allocator.Bitmaps[i], page << (order - i), 1 << (order - i));
+        BmpWriteBits<!free>(zone->Bitmaps[i], page << (order - i), 1 << (order - i));
 
-    BmpWriteBits<!free>(Allocator.Bitmaps[order], page, 1);
+    BmpWriteBits<!free>(zone->Bitmaps[order], page, 1);
 
-    if (!free) {
-        for (int i = order + 1; i < ORDERS; i++) {
+    for (int i = order + 1; i < ORDERS; i++) {
+        u32 parent = page >> (i - order);
+
+        /* Blocks that stick out past the end of the zone stay allocated */
+        if (parent >= zone->BmpSizes[i])
+            break;
+
+        if (!free) {
             /* Mark the entry containing this entry in the parent order as used */
-            BmpWriteBits<true>(Allocator.Bitmaps[i], page >> (i - order), 1);
+            BmpWriteBits<true>(zone->Bitmaps[i], parent, 1);
         }
-    }
-    else {
-        for (int i = order + 1; i < ORDERS; i++) {
+        else {
             /* If the sibling of the entry that was just cleared
                is also clear, the entry containing them both
                in the parent order is cleared. */
             int child_index = page >> (i - order - 1);
-            bool sibling_clear = !BmpReadBit(Allocator.Bitmaps[i - 1], child_index ^ 1);
+            bool sibling_clear = !BmpReadBit(zone->Bitmaps[i - 1], child_index ^ 1);
 
             if (sibling_clear)
-                BmpWriteBits<false>(Allocator.Bitmaps[i], page >> (i - order), 1);
+                BmpWriteBits<false>(zone->Bitmaps[i], parent, 1);
         }
     }
 }
 
+/* Returns the zone that a physical address lies in, or nullptr */
+static AllocatorZone *ZoneOf(uptr address)
+{
+    for (int i = 0; i < Allocator.ZoneCount; i++)
+        if (address >= Allocator.Zones[i].DataStart && address < Allocator.Zones[i].DataEnd)
+            return &Allocator.Zones[i];
+
+    return nullptr;
+}
+
+/* Allocates a single block of a certain order. Must be called with MmPhysicalLock held. */
+static uptr AllocatePageLocked(u32 order)
+{
+    /* Zones are tried from the lowest one up */
+    for (int i = 0; i < Allocator.ZoneCount; i++) {
+        AllocatorZone *zone = &Allocator.Zones[i];
+
+        if (zone->FreePages < 1u << order)
+            continue;
+
+        int index = BmpSearchClearBit(
+            zone->Bitmaps[order],
+            zone->BmpSizes[order],
+            zone->Search[order]);
+
+        if (index == -1)
+            continue;
+
+        zone->Search[order] = index;
+        zone->FreePages -= 1 << order;
+        MarkPageAs<false>(zone, order, index);
+        return zone->DataStart + (index << PAGE_SHIFT << order);
+    }
+
+    return 0;
+}
+
+/* Frees `number` consecutive blocks of a certain order. Must be called with MmPhysicalLock held. */
+static bool FreePagesLocked(uptr address, u32 order, u32 number)
+{
+    AllocatorZone *zone = ZoneOf(address);
+    int index = zone ? ((uptr)address - zone->DataStart) >> PAGE_SHIFT >> order : -1;
+
+    if (index < 0 || index + number > zone->BmpSizes[order])
+        return false;
+
+    zone->Search[order] = index;
+    zone->FreePages += number << order;
+
+    for (int i = 0; i < number; i++)
+        MarkPageAs<true>(zone, order, index + i);
+
+    return true;
+}
+
 uptr MmPhysicalAllocatePage(int order)
 {
     if (order > MAX_ORDER)
         return 0;
 
     PzAcquireSpinlock(&MmPhysicalLock);
-    int index = BmpSearchClearBit(
-        Allocator.Bitmaps[order],
-        Allocator.BmpSizes[order],
-        Allocator.Search[order]);
+    uptr addr = AllocatePageLocked(order);
+    PzReleaseSpinlock(&MmPhysicalLock);
 
-    if (index == -1) {
-        PzReleaseSpinlock(&MmPhysicalLock);
-        return 0;
+    return addr;
+}
+
+bool MmPhysicalAllocatePages(u32 order, u32 count, uptr *pages)
+{
+    if (order > MAX_ORDER)
+        return false;
+
+    PzAcquireSpinlock(&MmPhysicalLock);
+
+    for (u32 i = 0; i < count; i++) {
+        if (!(pages[i] = AllocatePageLocked(order))) {
+            /* Either all of the pages are allocated or none */
+            while (i--)
+                FreePagesLocked(pages[i], order, 1);
+
+            PzReleaseSpinlock(&MmPhysicalLock);
+            return false;
+        }
     }
 
-    Allocator.Search[order] = index;
-    MarkPageAs<false>(order, index);
-    uptr addr = Allocator.DataStart + (index << PAGE_SHIFT << order);
     PzReleaseSpinlock(&MmPhysicalLock);
-
-    return addr;
+    return true;
 }
 
 uptr MmPhysicalAllocateContiguousPages(u32 order, u32 count)
@@ -343,35 +495,39 @@ uptr MmPhysicalAllocateContiguousPages(u32 order, u32 count)
     else if (count == 1)
         return MmPhysicalAllocatePage(order);
 
-    /* Find the first cave in the order's bitmap that fits the
-       necessary amount of pages */
-    int streak = 0, streak_start = 0;
-    uptr cave_start = 0;
-
     PzAcquireSpinlock(&MmPhysicalLock);
-    for (int i = 0; i < Allocator.BmpSizes[order]; i += 32) {
-        u32 chunk = ~((u32 *)Allocator.Bitmaps[order])[i / 32];
-
-        for (int j = 0; j < 32; j++) {
-            if (chunk & 1 << j) {
-                if (streak == 0) {
-                    streak_start = i + j;
-                    cave_start = Allocator.DataStart
-                        + (streak_start << PAGE_SHIFT << order);
-                }
 
-                streak++;
+    /* Find the first cave in an order's bitmap that fits the
+       necessary amount of pages. Caves can't span two zones. */
+    for (int z = 0; z < Allocator.ZoneCount; z++) {
+        AllocatorZone *zone = &Allocator.Zones[z];
+        int streak = 0, streak_start = 0;
+
+        if (zone->FreePages < count << order)
+            continue;
 
-                if (streak == count) {
-                    for (int k = 0; k < streak; k++)
-                        MarkPageAs<false>(order, streak_start + k);
+        for (int i = 0; i < zone->BmpSizes[order]; i += 32) {
+            u32 chunk = ~((u32 *)zone->Bitmaps[order])[i / 32];
 
-                    PzReleaseSpinlock(&MmPhysicalLock);
-                    return cave_start;
+            for (int j = 0; j < 32; j++) {
+                if (chunk & 1 << j) {
+                    if (streak == 0)
+                        streak_start = i + j;
+
+                    streak++;
+
+                    if (streak == count) {
+                        for (int k = 0; k < streak; k++)
+                            MarkPageAs<false>(zone, order, streak_start + k);
+
+                        zone->FreePages -= count << order;
+                        PzReleaseSpinlock(&MmPhysicalLock);
+                        return zone->DataStart + (streak_start << PAGE_SHIFT << order);
+                    }
                 }
+                else
+                    streak = 0;
             }
-            else
-                streak = 0;
         }
     }
 
@@ -385,20 +541,94 @@ bool MmPhysicalFreePages(uptr address, u32 order, u32 number)
         return false;
 
     PzAcquireSpinlock(&MmPhysicalLock);
+    bool result = FreePagesLocked(address, order, number);
+    PzReleaseSpinlock(&MmPhysicalLock);
 
-    int index = ((uptr)address - Allocator.DataStart) >> PAGE_SHIFT >> order;
+    return result;
+}
 
-    if (index < 0 || index >= Allocator.BmpSizes[order]) {
-        PzReleaseSpinlock(&MmPhysicalLock);
+bool MmPhysicalFreePageArray(const uptr *pages, u32 order, u32 count)
+{
+    if (order > MAX_ORDER)
         return false;
+
+    bool result = true;
+    PzAcquireSpinlock(&MmPhysicalLock);
+
+    for (u32 i = 0; i < count; i++)
+        result &= FreePagesLocked(pages[i], order, 1);
+
+    PzReleaseSpinlock(&MmPhysicalLock);
+    return result;
+}
+
+void MmPageBatchInitialize(PzPageBatch *batch, PzTlbBatch *invalidations)
+{
+    batch->Count = 0;
+    batch->Invalidations = invalidations;
+}
+
+void MmPageBatchAdd(PzPageBatch *batch, uptr page)
+{
+    batch->Pages[batch->Count++] = page;
+
+    if (batch->Count == PAGE_BATCH_MAX_PAGES)
+        MmPageBatchFlush(batch);
+}
+
+void MmPageBatchFlush(PzPageBatch *batch)
+{
+    if (batch->Count) {
+        if (batch->Invalidations)
+            MmTlbBatchFlush(batch->Invalidations);
+
+        MmPhysicalFreePageArray(batch->Pages, 0, batch->Count);
     }
 
-    Allocator.Search[order] = index;
+    batch->Count = 0;
+}
+
+int MmPhysicalQueryZones(PzPhysicalZoneInfo *zones, int max_zones)
+{
+    PzAcquireSpinlock(&MmPhysicalLock);
 
-    for (int i = 0; i < number; i++)
-        MarkPageAs<true>(order, index + i);
+    for (int i = 0; i < Allocator.ZoneCount && i < max_zones; i++) {
+        AllocatorZone *zone = &Allocator.Zones[i];
 
+        zones[i].Start = zone->DataStart;
+        zones[i].End = zone->DataEnd;
+        zones[i].FreePages = zone->FreePages;
+        zones[i].UsedPages = zone->TotalPages - zone->FreePages;
+    }
+
+    int count = Allocator.ZoneCount;
     PzReleaseSpinlock(&MmPhysicalLock);
 
-    return true;
+    return count;
+}
+
+void MmPhysicalQueryUsage(PzPhysicalMemoryInformation *info)
+{
+    *info = PzPhysicalMemoryInformation {};
+    PzAcquireSpinlock(&MmPhysicalLock);
+
+    for (int i = 0; i < Allocator.ZoneCount; i++) {
+        AllocatorZone *zone = &Allocator.Zones[i];
+
+        info->TotalPages += zone->TotalPages;
+        info->FreePages += zone->FreePages;
+
+        /* Padding bits past the end of a bitmap are set, so they never count as free */
+        for (int j = 0; j < ORDERS; j++) {
+            u32 free_blocks = 0;
+
+            for (u32 k = 0; k < ALIGN(zone->BmpSizes[j], 32) / 32; k++)
+                free_blocks += __builtin_popcount(~((u32 *)zone->Bitmaps[j])[k]);
+
+            info->FreeBlocks[j] += free_blocks;
+            info->UsedBlocks[j] += zone->BmpSizes[j] - free_blocks;
+        }
+    }
+
+    PzReleaseSpinlock(&MmPhysicalLock);
 }
\ No newline at end of file
@@ -1,221 +1,307 @@
 #include <mm/pool.hh>
+#include <mm/query.hh>
 #include <lib/util.hh>
 #include <debug.hh>
 
-inline int RoundUp(int size, int granularity)
+static const u32 ClassSizes[PL_SIZE_CLASSES] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024
+};
+
+static inline PzPoolPage *PageOf(void *ptr)
 {
-    return (size + granularity - 1) & -granularity;
+    return (PzPoolPage *)(uptr(ptr) & -PAGE_SIZE);
 }
 
-/* Find an empty space of the specified size in the specified bitmap */
-int SearchCave(void *bmp, int bmp_size, int granularity, int needed)
+static void PageListRemove(PzPoolPage **list, PzPoolPage *page)
 {
-    u8 *bitmap = (u8 *)bmp;
-    int streak = 0, streak_start = 0;
+    if (page->Previous)
+        page->Previous->Next = page->Next;
+    else
+        *list = page->Next;
 
-    for (int i = 0; i < bmp_size; i++) {
-        if (bitmap[i] == 0) {
-            if (streak == 0)
-                streak_start = i;
+    if (page->Next)
+        page->Next->Previous = page->Previous;
+}
 
-            streak++;
+static void PageListPush(PzPoolPage **list, PzPoolPage *page)
+{
+    page->Previous = nullptr;
+    page->Next = *list;
 
-            if (streak == needed)
-                return streak_start;
-        }
-        else
-            streak = 0;
-    }
+    if (*list)
+        (*list)->Previous = page;
 
-    return -1;
+    *list = page;
 }
 
-void FillEntries(void *bmp, int size, int value)
+void PlInitializeKernelPool(PzKernelPool *pool)
 {
-    MemSet(bmp, value, size);
+    MemSet(pool, 0, sizeof *pool);
+
+    for (int i = 0, size_class = 0; i < PL_MAX_SMALL_SIZE / PL_ALIGNMENT; i++) {
+        if ((i + 1) * PL_ALIGNMENT > ClassSizes[size_class])
+            size_class++;
+
+        pool->SizeToClass[i] = size_class;
+    }
+
+    for (int i = 0; i < PL_SIZE_CLASSES; i++) {
+        pool->Classes[i].Size = ClassSizes[i];
+        pool->Classes[i].ObjectsPerPage = (PAGE_SIZE - sizeof(PzPoolPage)) / ClassSizes[i];
+        PzTrackSpinlock(&pool->Classes[i].Lock, "PoolSizeClass");
+    }
+
+    PzTrackSpinlock(&pool->LargeLock, "PoolLarge");
 }
 
-/* Replace consecutive values in bitmap starting at provided index with the specified value */
-int ReplaceEntries(void *bmp, int index, int value)
+/* Maps a page for a size class and chains all of its objects */
+static PzPoolPage *PlCreatePage(PzPoolSizeClass *size_class, u16 index)
 {
-    char *ch = (char *)bmp + index;
-    char first = ch[0];
+    auto *page = (PzPoolPage *)MmVirtualAllocateMemory(
+        nullptr, PAGE_SIZE, PAGE_READWRITE, nullptr);
 
-    if (first == 0)
-        return 0;
+    if (!page)
+        return nullptr;
 
-    int entries = 0;
+    page->Magic = PL_PAGE_MAGIC;
+    page->SizeClass = index;
+    page->InUse = 0;
+    page->Pages = 1;
+    page->FreeObjects = nullptr;
 
-    while (*ch == first) {
-        *ch = value;
-        entries++;
+    for (int i = size_class->ObjectsPerPage - 1; i >= 0; i--) {
+        void **object = (void **)(page->Data + i * size_class->Size);
+        *object = page->FreeObjects;
+        page->FreeObjects = object;
     }
 
-    return entries;
+    return page;
 }
 
-PzPoolBlockHeader *PlCreateBlock(PzKernelPool *pool, int size, int granularity)
+static void *PlAllocateSmall(PzKernelPool *pool, u32 bytes)
 {
-    PzAcquireSpinlock(&pool->Lock);
+    u16 index = pool->SizeToClass[(bytes - 1) / PL_ALIGNMENT];
+    PzPoolSizeClass *size_class = &pool->Classes[index];
 
-    int bmp_size;
-    bmp_size = RoundUp(size, granularity) / granularity;
-    bmp_size = RoundUp(bmp_size, 64);
+    PzAcquireSpinlock(&size_class->Lock);
 
-    int block_space = sizeof(PzPoolBlockHeader) + bmp_size + size;
+    PzPoolPage *page = size_class->PartialPages;
 
-    auto *start = (PzPoolBlockHeader *)MmVirtualAllocateMemory(
-        nullptr, block_space, PAGE_READWRITE, nullptr);
+    if (!page) {
+        if ((page = size_class->EmptyPage))
+            size_class->EmptyPage = nullptr;
+        else {
+            /* Mapping memory takes the virtual memory lock, so do it without holding ours */
+            PzReleaseSpinlock(&size_class->Lock);
+            page = PlCreatePage(size_class, index);
+            PzAcquireSpinlock(&size_class->Lock);
 
-    if (!start)
-        return nullptr;
+            if (!page) {
+                PzReleaseSpinlock(&size_class->Lock);
+                return nullptr;
+            }
+
+            size_class->PageCount++;
+        }
 
-    start->Previous = pool->LastBlock;
-    start->Next = nullptr;
-    start->Granularity = granularity;
-    start->LastIndex = 0;
-    start->Used = 0;
-    start->Size = size;
-    start->BitmapSize = bmp_size;
+        PageListPush(&size_class->PartialPages, page);
+    }
 
-    MemSet(start->BitmapStart, 0, start->BitmapSize);
+    void **object = (void **)page->FreeObjects;
+    page->FreeObjects = *object;
+    page->InUse++;
+    size_class->ObjectsInUse++;
 
-    auto *block = pool->LastBlock = pool->LastBlock ? (pool->LastBlock->Next = start) : start;
+    if (!page->FreeObjects)
+        PageListRemove(&size_class->PartialPages, page);
 
-    PzReleaseSpinlock(&pool->Lock);
-    return block;
+    PzReleaseSpinlock(&size_class->Lock);
+    return object;
 }
 
-void PlUnlinkBlock(PzKernelPool *pool, PzPoolBlockHeader *header)
+static void *PlAllocateLarge(PzKernelPool *pool, u32 bytes)
 {
-    PzAcquireSpinlock(&pool->Lock);
-
-    if (header == pool->FirstBlock)
-        pool->FirstBlock = header->Next;
+    u32 pages = PAGES_IN(sizeof(PzPoolPage) + bytes);
+    auto *page = (PzPoolPage *)MmVirtualAllocateMemory(
+        nullptr, pages * PAGE_SIZE, PAGE_READWRITE, nullptr);
 
-    if (header->Previous)
-        header->Previous->Next = header->Next;
+    if (!page)
+        return nullptr;
 
-    if (header->Next)
-        header->Next->Previous = header->Previous;
+    page->Magic = PL_PAGE_MAGIC;
+    page->SizeClass = PL_LARGE_CLASS;
+    page->Pages = pages;
 
-    MmVirtualFreeMemory(header, header->Size + header->BitmapSize + sizeof *header);
-    PzReleaseSpinlock(&pool->Lock);
-}
+    PzAcquireSpinlock(&pool->LargeLock);
+    pool->LargeAllocations++;
+    pool->LargePages += pages;
+    PzReleaseSpinlock(&pool->LargeLock);
 
-void PlInitializeKernelPool(PzKernelPool *pool, int init_size)
-{
-    pool->LastBlock = nullptr;
-    pool->FirstBlock = PlCreateBlock(pool, init_size, PL_DEFAULT_GRANULARITY);
+    return page->Data;
 }
 
 void *PlAllocateMemory(PzKernelPool *pool, int bytes, u32 flags)
 {
-    if (bytes == 0)
+    if (bytes <= 0)
         return nullptr;
 
-    #define MAKE_BLOCK \
-        do { PzReleaseSpinlock(&pool->Lock); \
-        if (!PlCreateBlock(pool, bytes, PL_DEFAULT_GRANULARITY)) return nullptr; \
-        PzAcquireSpinlock(&pool->Lock); } while (0)
+    if (bytes <= PL_MAX_SMALL_SIZE)
+        return PlAllocateSmall(pool, bytes);
 
-    PzAcquireSpinlock(&pool->Lock);
+    return PlAllocateLarge(pool, bytes);
+}
 
-    if (!pool->FirstBlock)
-        MAKE_BLOCK;
+/* Returns how many bytes an allocation can hold, or -1 if it does not belong to the pool */
+static int PlUsableSize(PzKernelPool *pool, PzPoolPage *page, void *ptr)
+{
+    /* Check that there is a descriptor to read before trusting anything in it.
+       It lies in a single page, which is looked up without MmVirtualLock. */
+    if (uptr(ptr) % PL_ALIGNMENT || !MmiIsKernelPageMapped(uptr(page)))
+        return -1;
 
-    for (PzPoolBlockHeader *header = pool->FirstBlock;
-        header; header = header->Next) {
-        /* Is there enough space in this block for the allocation?
-           (this is just an initial check which obviously can't
-           detect whether that space is contiguous) */
-        if (header->Used + bytes <= header->Size) {
-            int gran = header->Granularity;
-            int needed = RoundUp(bytes, gran) / gran;
-            int bmp_size = header->BitmapSize;
-            int index = SearchCave(header->BitmapStart, bmp_size, gran, needed);
+    if (page->Magic != PL_PAGE_MAGIC)
+        return -1;
 
-            if (index != -1) {
-                int  left_id = index == 0 ? 1 : header->BitmapStart[index - 1];
-                int right_id = index + needed >= bmp_size ? 1 : header->BitmapStart[index + needed];
-                int  this_id = 1;
+    if (page->SizeClass == PL_LARGE_CLASS)
+        return ptr == page->Data ? page->Pages * PAGE_SIZE - sizeof(PzPoolPage) : -1;
 
-                while (this_id == left_id || this_id == right_id)
-                    this_id++;
+    if (page->SizeClass >= PL_SIZE_CLASSES)
+        return -1;
 
-                FillEntries(header->BitmapStart + index, needed, this_id);
+    u32 size = pool->Classes[page->SizeClass].Size;
+    u32 offset = (u8 *)ptr - page->Data;
 
-                header->Used += ALIGN(bytes, gran);
-                header->LastIndex = index + needed;
+    if ((u8 *)ptr < page->Data || offset % size ||
+        offset / size >= pool->Classes[page->SizeClass].ObjectsPerPage)
+        return -1;
 
-                void *address = (void *)(header->BitmapStart + bmp_size + index * gran);
+    return size;
+}
 
-                PzReleaseSpinlock(&pool->Lock);
-                return address;
-            }
-        }
+/* Resizes a large allocation by mapping or unmapping pages after it, without moving it */
+static bool PlResizeLargeInPlace(PzKernelPool *pool, PzPoolPage *page, u32 bytes)
+{
+    u32 pages = PAGES_IN(sizeof(PzPoolPage) + bytes);
+    u8 *end = (u8 *)page + page->Pages * PAGE_SIZE;
 
-        if (!header->Next)
-            MAKE_BLOCK;
+    if (pages > page->Pages) {
+        if (!MmVirtualAllocateMemory(end, (pages - page->Pages) * PAGE_SIZE, PAGE_READWRITE, nullptr))
+            return false;
     }
+    else if (pages < page->Pages)
+        MmVirtualFreeMemory((u8 *)page + pages * PAGE_SIZE, (page->Pages - pages) * PAGE_SIZE);
 
-    #undef MAKE_BLOCK
-    PzReleaseSpinlock(&pool->Lock);
-    return nullptr;
+    PzAcquireSpinlock(&pool->LargeLock);
+    pool->LargePages += pages - page->Pages;
+    PzReleaseSpinlock(&pool->LargeLock);
+
+    page->Pages = pages;
+    return true;
 }
 
 void *PlReAllocateMemory(PzKernelPool *pool, void *ptr, int bytes)
 {
-    int old_size = PlFreeMemory(pool, ptr);
+    if (!ptr)
+        return PlAllocateMemory(pool, bytes, 0);
+
+    if (bytes <= 0) {
+        PlFreeMemory(pool, ptr);
+        return nullptr;
+    }
+
+    PzPoolPage *page = PageOf(ptr);
+    int old_size = PlUsableSize(pool, page, ptr);
 
     if (old_size == -1)
         return nullptr;
 
+    if (page->SizeClass == PL_LARGE_CLASS) {
+        if (bytes > PL_MAX_SMALL_SIZE && PlResizeLargeInPlace(pool, page, bytes))
+            return ptr;
+    }
+    /* Small allocations stay where they are as long as their size class fits */
+    else if (bytes <= old_size)
+        return ptr;
+
     void *new_location = PlAllocateMemory(pool, bytes, 0);
 
     if (!new_location)
         return nullptr;
 
     MemCopy(new_location, ptr, bytes > old_size ? old_size : bytes);
+    PlFreeMemory(pool, ptr);
     return new_location;
 }
 
 int PlFreeMemory(PzKernelPool *pool, void *ptr)
 {
-    PzAcquireSpinlock(&pool->Lock);
+    if (!ptr)
+        return -1;
 
-    for (PzPoolBlockHeader *header = pool->FirstBlock;
-        header; header = header->Next) {
-        u8 *data_start = header->BitmapStart + header->BitmapSize;
-        u32 gran = header->Granularity;
+    PzPoolPage *page = PageOf(ptr);
+    int bytes = PlUsableSize(pool, page, ptr);
 
-        if (ptr >= data_start && ptr <= data_start + header->Size) {
-            int index = ((u8 *)ptr - data_start) / gran;
+    if (bytes == -1)
+        return -1;
 
-            if (index >= 0 && header->BitmapStart[index] == header->BitmapStart[index - 1]) {
-                /* The bitmap region of consecutive values does not start at the location that was passed.
-                   Therefore, this must be invalid. Return -1 to prevent heap corruption. */
-                goto fail;
-            }
+    if (page->SizeClass == PL_LARGE_CLASS) {
+        PzAcquireSpinlock(&pool->LargeLock);
+        pool->LargeAllocations--;
+        pool->LargePages -= page->Pages;
+        PzReleaseSpinlock(&pool->LargeLock);
+
+        MmVirtualFreeMemory(page, page->Pages * PAGE_SIZE);
+        return bytes;
+    }
 
-            int bytes =
-                ReplaceEntries(header->BitmapStart, index, 0) * gran;
+    PzPoolSizeClass *size_class = &pool->Classes[page->SizeClass];
+    PzPoolPage *unused = nullptr;
 
-            header->Used -= bytes;
-            header->LastIndex = index;
+    PzAcquireSpinlock(&size_class->Lock);
 
-            if (!header->Used) {
-                PzReleaseSpinlock(&pool->Lock);
-                PlUnlinkBlock(pool, header);
-                PzAcquireSpinlock(&pool->Lock);
-            }
+    /* Full pages are not on any list, so put them back once they have room */
+    if (!page->FreeObjects)
+        PageListPush(&size_class->PartialPages, page);
+
+    *(void **)ptr = page->FreeObjects;
+    page->FreeObjects = ptr;
+    size_class->ObjectsInUse--;
 
-            PzReleaseSpinlock(&pool->Lock);
-            return bytes;
+    if (!--page->InUse) {
+        PageListRemove(&size_class->PartialPages, page);
+
+        if (size_class->EmptyPage) {
+            size_class->PageCount--;
+            unused = page;
         }
+        else
+            size_class->EmptyPage = page;
+    }
+
+    PzReleaseSpinlock(&size_class->Lock);
+
+    if (unused)
+        MmVirtualFreeMemory(unused, PAGE_SIZE);
+
+    return bytes;
+}
+
+void PlQueryPool(PzKernelPool *pool, PzKernelPoolInformation *info)
+{
+    for (int i = 0; i < PL_SIZE_CLASSES; i++) {
+        PzPoolSizeClass *size_class = &pool->Classes[i];
+
+        PzAcquireSpinlock(&size_class->Lock);
+        info->Classes[i].Size = size_class->Size;
+        info->Classes[i].Pages = size_class->PageCount;
+        info->Classes[i].ObjectsInUse = size_class->ObjectsInUse;
+        info->Classes[i].ObjectsFree =
+            size_class->PageCount * size_class->ObjectsPerPage - size_class->ObjectsInUse;
+        PzReleaseSpinlock(&size_class->Lock);
     }
 
-fail:
-    PzReleaseSpinlock(&pool->Lock);
-    return -1;
+    PzAcquireSpinlock(&pool->LargeLock);
+    info->LargeAllocations = pool->LargeAllocations;
+    info->LargePages = pool->LargePages;
+    PzReleaseSpinlock(&pool->LargeLock);
 }
\ No newline at end of file
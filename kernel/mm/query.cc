@@ -0,0 +1,56 @@
+#include <mm/query.hh>
+#include <mm/usercopy.hh>
+#include <lib/malloc.hh>
+#include <lib/util.hh>
+#include <obj/manager.hh>
+#include <obj/process.hh>
+
+/* Copies information to the caller's buffer, which has to be large enough for all of it */
+static PzStatus CopyInformation(bool as_user, void *buffer, u32 size, const void *info, u32 info_size)
+{
+    if (size < info_size)
+        return STATUS_INVALID_ARGUMENT;
+
+    if (as_user)
+        return MmCopyToUser(buffer, info, info_size) ? STATUS_SUCCESS : STATUS_INVALID_ARGUMENT;
+
+    MemCopy(buffer, info, info_size);
+    return STATUS_SUCCESS;
+}
+
+PzStatus PzQuerySystemInformation(bool as_user, u32 type, void *buffer, u32 size)
+{
+    switch (type) {
+    case SYSTEM_INFORMATION_PHYSICAL_MEMORY: {
+        PzPhysicalMemoryInformation info;
+        MmPhysicalQueryUsage(&info);
+        return CopyInformation(as_user, buffer, size, &info, sizeof info);
+    }
+
+    case SYSTEM_INFORMATION_KERNEL_POOL: {
+        PzKernelPoolInformation info;
+        PzHeapQuery(&info);
+        return CopyInformation(as_user, buffer, size, &info, sizeof info);
+    }
+
+    default:
+        return STATUS_UNSUPPORTED_FUNCTION;
+    }
+}
+
+PzStatus PzQueryProcessInformation(bool as_user, PzHandle process, u32 type, void *buffer, u32 size)
+{
+    if (type != PROCESS_INFORMATION_MEMORY)
+        return STATUS_UNSUPPORTED_FUNCTION;
+
+    PzProcessObject *proc_obj;
+
+    if (!ObReferenceObjectByHandle(PZ_OBJECT_PROCESS, nullptr, process, (ObPointer *)&proc_obj))
+        return STATUS_INVALID_HANDLE;
+
+    PzProcessMemoryInformation info;
+    MmiQueryProcessMemory(proc_obj, &info);
+    ObDereferenceObject(proc_obj);
+
+    return CopyInformation(as_user, buffer, size, &info, sizeof info);
+}
\ No newline at end of file
@@ -0,0 +1,103 @@
+#include <mm/region.hh>
+#include <mm/slab.hh>
+
+static PzObjectCache RegionCache = OBJECT_CACHE_INITIALIZER(
+    "VirtualRegion", sizeof(PzVirtualRegionNode), nullptr);
+
+/* Finds the region with the greatest start address not above `address` */
+static PzVirtualRegionNode *FindFloor(PzVirtualRegionTree *tree, uptr address)
+{
+    PzVirtualRegionNode *floor = nullptr;
+
+    for (PzVirtualRegionNode *node = tree->Tree.Root; node;) {
+        if (node->Value.Region.Start <= address) {
+            floor = node;
+            node = node->Right;
+        }
+        else
+            node = node->Left;
+    }
+
+    return floor;
+}
+
+/* Returns whether a subtree holds a gap of `bytes` bytes,
+   counting the one between `previous_end` and its first region */
+static inline bool SubtreeFits(PzVirtualRegionNode *node, uptr previous_end, uptr bytes)
+{
+    return node && (node->Value.LargestGap >= bytes ||
+        node->Value.SubtreeStart - previous_end >= bytes);
+}
+
+uptr MmRegionFindGap(PzVirtualRegionTree *tree, uptr lowest, uptr highest, uptr bytes)
+{
+    PzVirtualRegionNode *node = tree->Tree.Root;
+    uptr previous_end = lowest;
+
+    if (!bytes || lowest >= highest)
+        return 0;
+
+    if (!SubtreeFits(node, previous_end, bytes)) {
+        /* Nothing fits between the regions, so try the space after the last one */
+        if (node)
+            previous_end = node->Value.SubtreeEnd;
+
+        return highest - previous_end >= bytes ? previous_end : 0;
+    }
+
+    /* Descend towards the lowest gap that fits, which is known to exist below the node */
+    for (;;) {
+        if (SubtreeFits(node->Left, previous_end, bytes))
+            node = node->Left;
+        else {
+            if (node->Left)
+                previous_end = node->Left->Value.SubtreeEnd;
+
+            if (node->Value.Region.Start - previous_end >= bytes)
+                return previous_end;
+
+            previous_end = node->Value.Region.End;
+            node = node->Right;
+        }
+    }
+}
+
+PzVirtualRegionNode *MmRegionInsert(PzVirtualRegionTree *tree, uptr start, uptr end, uptr flags)
+{
+    if (start >= end)
+        return nullptr;
+
+    PzVirtualRegionNode *lower = FindFloor(tree, start);
+    PzVirtualRegionNode *upper = lower ? tree->Tree.Next(lower) : tree->Tree.First();
+
+    if (lower && lower->Value.Region.End > start ||
+        upper && upper->Value.Region.Start < end)
+        return nullptr;
+
+    auto *node = (PzVirtualRegionNode *)MmCacheAllocate(&RegionCache);
+
+    if (!node)
+        return nullptr;
+
+    node->Value.Region = PzUserVirtualRegion { start, end, flags, nullptr, 0, 0 };
+    tree->Tree.Insert(node);
+    return node;
+}
+
+PzVirtualRegionNode *MmRegionFind(PzVirtualRegionTree *tree, uptr start)
+{
+    PzVirtualRegionNode *node = FindFloor(tree, start);
+    return node && node->Value.Region.Start == start ? node : nullptr;
+}
+
+PzVirtualRegionNode *MmRegionFindContaining(PzVirtualRegionTree *tree, uptr address)
+{
+    PzVirtualRegionNode *node = FindFloor(tree, address);
+    return node && address < node->Value.Region.End ? node : nullptr;
+}
+
+void MmRegionRemove(PzVirtualRegionTree *tree, PzVirtualRegionNode *node)
+{
+    tree->Tree.Remove(node);
+    MmCacheFree(&RegionCache, node);
+}
\ No newline at end of file
@@ -0,0 +1,408 @@
+#include <mm/section.hh>
+#include <mm/virtual.hh>
+#include <mm/physical.hh>
+#include <mm/region.hh>
+#include <lib/malloc.hh>
+#include <lib/list.hh>
+#include <lib/util.hh>
+#include <obj/manager.hh>
+#include <obj/process.hh>
+#include <sched/scheduler.hh>
+#include <sched/rwlock.hh>
+
+/* Sections of every file that is mapped somewhere. Lookups and new references
+   only share SectionsLock and count atomically, while dropping a reference takes
+   it exclusively, so that a lookup never finds a section that is being torn down. */
+static LinkedList<PzSection *> Sections;
+static PzRwSpinlock SectionsLock;
+
+/* Views in the kernel half, which has no region tree of its own */
+static PzVirtualRegionTree KernelViews;
+
+static inline PzVirtualRegionTree *ViewsOf(PzProcessObject *process)
+{
+    return process == PZ_KPROC ? &KernelViews : &process->VirtualAllocations;
+}
+
+static bool IsSameFile(PzIoControlBlock *a, PzIoControlBlock *b)
+{
+    return a->Device == b->Device &&
+        a->Filename->Size == b->Filename->Size &&
+        !Utf8CompareRawStrings(
+            a->Filename->Buffer, a->Filename->Size,
+            b->Filename->Buffer, b->Filename->Size);
+}
+
+static void MmiFreeSection(PzSection *section)
+{
+    if (section->Pages) {
+        /* The last view is gone, and unmapping it already flushed its translations */
+        PzPageBatch freed;
+        MmPageBatchInitialize(&freed, nullptr);
+
+        for (u32 i = 0; i < section->PageCount; i++)
+            if (section->Pages[i])
+                MmPageBatchAdd(&freed, section->Pages[i]);
+
+        MmPageBatchFlush(&freed);
+
+        PzHeapFree(section->Pages);
+    }
+
+    if (section->ReadLock)
+        PzCloseHandle(section->ReadLock);
+
+    if (section->File)
+        ObDereferenceObject(section->File);
+
+    delete section->ListNode;
+    PzHeapFree(section);
+}
+
+/* Returns an existing section of the file with a new reference, or nullptr */
+static PzSection *MmiFindSection(PzIoControlBlock *file)
+{
+    ENUM_LIST(node, Sections) {
+        if (IsSameFile(node->Value->File, file)) {
+            __atomic_fetch_add(&node->Value->References, 1, __ATOMIC_RELAXED);
+            return node->Value;
+        }
+    }
+
+    return nullptr;
+}
+
+/* Looks up the section of a file, creating it if the file isn't mapped anywhere yet */
+static PzStatus MmiReferenceSection(PzIoControlBlock *file, PzSection **out)
+{
+    PzIoStatusBlock iosb;
+    PzFileInformationBasic basic;
+    PzStatus status;
+    PzSection *existing;
+
+    int irql = PzAcquireRwSpinlockShared(&SectionsLock);
+    existing = MmiFindSection(file);
+    PzReleaseRwSpinlockShared(&SectionsLock, irql);
+
+    if ((*out = existing))
+        return STATUS_SUCCESS;
+
+    auto *section = (PzSection *)PzHeapAllocate(sizeof(PzSection), 0);
+
+    if (!section)
+        return STATUS_ALLOCATION_FAILED;
+
+    MemSet(section, 0, sizeof(PzSection));
+    section->References = 1;
+
+    /* Reading through a control block of our own leaves the offsets of the mapper's handles alone */
+    if ((status = IoReopenFile(file, ACCESS_READ, &section->File)) ||
+        (status = PzQueryInformationFileRaw(section->File, &iosb,
+            FILE_INFORMATION_BASIC, &basic, sizeof(PzFileInformationBasic))) ||
+        (status = PsCreateMutex(&section->ReadLock, PZ_KPROC, nullptr)))
+        goto fail;
+
+    /* Sections are indexed by 32-bit page numbers, and empty ones are of no use */
+    if (!basic.Size || basic.Size > u64(-PAGE_SIZE)) {
+        status = STATUS_INVALID_ARGUMENT;
+        goto fail;
+    }
+
+    section->Size = basic.Size;
+    section->PageCount = PAGES_IN(u32(basic.Size));
+    section->Pages = (uptr *)PzHeapAllocate(section->PageCount * sizeof(uptr), 0);
+    section->ListNode = new LLNode<PzSection *>();
+
+    if (!section->Pages || !section->ListNode) {
+        status = STATUS_ALLOCATION_FAILED;
+        goto fail;
+    }
+
+    MemSet(section->Pages, 0, section->PageCount * sizeof(uptr));
+    section->ListNode->Value = section;
+
+    /* Someone else may have mapped the same file in the meantime */
+    irql = PzAcquireRwSpinlockExclusive(&SectionsLock);
+
+    if (!(existing = MmiFindSection(file)))
+        Sections.AddNode(section->ListNode);
+
+    PzReleaseRwSpinlockExclusive(&SectionsLock, irql);
+
+    if (existing) {
+        MmiFreeSection(section);
+        section = existing;
+    }
+
+    *out = section;
+    return STATUS_SUCCESS;
+
+fail:
+    MmiFreeSection(section);
+    return status;
+}
+
+void MmiDereferenceSection(PzSection *section)
+{
+    int irql = PzAcquireRwSpinlockExclusive(&SectionsLock);
+    bool last = !--section->References;
+
+    if (last)
+        Sections.Unlink(section->ListNode);
+
+    PzReleaseRwSpinlockExclusive(&SectionsLock, irql);
+
+    if (last)
+        MmiFreeSection(section);
+}
+
+/* Reads a page of the file into a new physical page, returning its address or 0 */
+static uptr MmiReadSectionPage(PzSection *section, u32 index)
+{
+    uptr physical = MmPhysicalAllocatePage(0);
+
+    if (!physical)
+        return 0;
+
+    /* The window is not marked as allocated, so unmapping it keeps the page */
+    u8 *window = (u8 *)MmVirtualMapPhysical(nullptr, physical, PAGE_SIZE, PAGE_READWRITE);
+
+    if (!window) {
+        MmPhysicalFreePages(physical, 0, 1);
+        return 0;
+    }
+
+    PzIoStatusBlock iosb;
+    u64 offset = u64(index) * PAGE_SIZE;
+    u32 bytes = Min<u64>(section->Size - offset, PAGE_SIZE);
+
+    /* The tail of the last page lies past the end of the file */
+    MemSet(window + bytes, 0, PAGE_SIZE - bytes);
+
+    PsWaitForObject(section->ReadLock);
+    PzStatus status = PzReadFileRaw(section->File, window, &iosb, bytes, &offset);
+    PsReleaseMutex(section->ReadLock);
+
+    MmVirtualFreeMemory(window, PAGE_SIZE);
+
+    if (status != STATUS_SUCCESS) {
+        MmPhysicalFreePages(physical, 0, 1);
+        return 0;
+    }
+
+    return physical;
+}
+
+/* Returns the physical address of a page of the section, reading it in if it isn't cached yet */
+static uptr MmiGetSectionPage(PzSection *section, u32 index)
+{
+    PzAcquireSpinlock(&section->Lock);
+    uptr physical = section->Pages[index];
+    PzReleaseSpinlock(&section->Lock);
+
+    if (physical)
+        return physical;
+
+    /* The read waits for the disk, so it happens without the lock. If another
+       fault on the same page wins the race, its copy is kept and ours dropped. */
+    if (!(physical = MmiReadSectionPage(section, index)))
+        return 0;
+
+    PzAcquireSpinlock(&section->Lock);
+    uptr existing = section->Pages[index];
+
+    if (!existing)
+        section->Pages[index] = physical;
+
+    PzReleaseSpinlock(&section->Lock);
+
+    if (existing) {
+        MmPhysicalFreePages(physical, 0, 1);
+        return existing;
+    }
+
+    return physical;
+}
+
+/* Maps the page of a view that `address` lies in, reading it in first if needed */
+static bool MmiResolveViewPage(PzProcessObject *process, uptr address)
+{
+    PzVirtualRegionTree *views = ViewsOf(process);
+
+    PzAcquireSpinlock(&views->Spinlock);
+    auto *node = MmRegionFindContaining(views, address);
+
+    if (!node || !(node->Value.Region.Flags & REGION_FILE_VIEW)) {
+        PzReleaseSpinlock(&views->Spinlock);
+        return false;
+    }
+
+    PzUserVirtualRegion view = node->Value.Region;
+
+    /* Keep the section alive while its page is read, even if the view goes away */
+    int irql = PzAcquireRwSpinlockShared(&SectionsLock);
+    __atomic_fetch_add(&view.Section->References, 1, __ATOMIC_RELAXED);
+    PzReleaseRwSpinlockShared(&SectionsLock, irql);
+
+    PzReleaseSpinlock(&views->Spinlock);
+
+    u32 index = view.SectionPage + (address - view.Start) / PAGE_SIZE;
+    uptr physical = MmiGetSectionPage(view.Section, index);
+    bool mapped = false;
+
+    if (physical) {
+        PzAcquireSpinlock(&views->Spinlock);
+        node = MmRegionFindContaining(views, address);
+
+        /* Only map the page if the view wasn't unmapped while it was being read */
+        if (node &&
+            node->Value.Region.Start == view.Start &&
+            node->Value.Region.Section == view.Section &&
+            node->Value.Region.SectionPage == view.SectionPage)
+            mapped = MmiMapForeignPage(process, (void *)(address & -PAGE_SIZE), physical, PAGE_READ);
+
+        PzReleaseSpinlock(&views->Spinlock);
+    }
+
+    MmiDereferenceSection(view.Section);
+    return mapped;
+}
+
+bool MmiResolveViewFault(uptr address, bool write)
+{
+    /* Views are read-only, so writes to them are access violations */
+    if (write)
+        return false;
+
+    PzProcessObject *process = address >= KERNEL_SPACE_START ? PZ_KPROC : PsGetCurrentProcess();
+    return process && MmiResolveViewPage(process, address);
+}
+
+PzStatus MmiPopulateView(PzProcessObject *process, void *base, u32 bytes)
+{
+    for (uptr page = uptr(base) & -PAGE_SIZE; page < uptr(base) + bytes; page += PAGE_SIZE)
+        if (!MmiResolveViewPage(process, page))
+            return STATUS_TRANSFER_FAILED;
+
+    return STATUS_SUCCESS;
+}
+
+PzStatus MmiMapViewOfFile(
+    PzProcessObject *process, PzIoControlBlock *file,
+    u64 offset, u32 bytes, void **base)
+{
+    PzVirtualRegionTree *views = ViewsOf(process);
+    PzVirtualRegionNode *node = nullptr;
+    PzSection *section;
+    bool kernel = process == PZ_KPROC;
+    u32 pages = PAGES_IN(bytes);
+    uptr start = 0;
+
+    if (!pages || offset % PAGE_SIZE)
+        return STATUS_INVALID_ARGUMENT;
+
+    if (PzStatus status = MmiReferenceSection(file, &section))
+        return status;
+
+    u64 first_page = offset / PAGE_SIZE;
+
+    if (first_page >= section->PageCount || pages > section->PageCount - first_page) {
+        MmiDereferenceSection(section);
+        return STATUS_ABOVE_LIMIT;
+    }
+
+    /* Nothing gets mapped here; the pages are filled in as the view is accessed */
+    if (kernel && !(start = uptr(MmiReserveKernelRange(pages)))) {
+        MmiDereferenceSection(section);
+        return STATUS_ALLOCATION_FAILED;
+    }
+
+    PzAcquireSpinlock(&views->Spinlock);
+
+    if (!kernel)
+        start = MmRegionFindGap(views, 0x1000, KERNEL_SPACE_START, pages * PAGE_SIZE);
+
+    if (start && (node = MmRegionInsert(views, start, start + pages * PAGE_SIZE, REGION_FILE_VIEW))) {
+        node->Value.Region.Section = section;
+        node->Value.Region.SectionPage = first_page;
+    }
+
+    PzReleaseSpinlock(&views->Spinlock);
+
+    if (!node) {
+        if (kernel)
+            MmiReleaseKernelRange((void *)start, pages);
+
+        MmiDereferenceSection(section);
+        return STATUS_ALLOCATION_FAILED;
+    }
+
+    *base = (void *)start;
+    return STATUS_SUCCESS;
+}
+
+bool MmiUnmapViewOfFile(PzProcessObject *process, void *base)
+{
+    PzVirtualRegionTree *views = ViewsOf(process);
+
+    PzAcquireSpinlock(&views->Spinlock);
+    auto *node = MmRegionFind(views, uptr(base));
+
+    if (!node || !(node->Value.Region.Flags & REGION_FILE_VIEW)) {
+        PzReleaseSpinlock(&views->Spinlock);
+        return false;
+    }
+
+    PzUserVirtualRegion view = node->Value.Region;
+
+    if (process != PZ_KPROC) {
+        PzReleaseSpinlock(&views->Spinlock);
+        return MmiVirtualFreeUserMemory(process, base, 0);
+    }
+
+    MmRegionRemove(views, node);
+    PzReleaseSpinlock(&views->Spinlock);
+
+    MmiReleaseKernelRange(base, PAGES_IN(view.End - view.Start));
+    MmiDereferenceSection(view.Section);
+    return true;
+}
+
+PzStatus PzMapViewOfFile(
+    bool as_user, PzHandle process, PzHandle file,
+    u64 offset, u32 bytes, void **base)
+{
+    u32 flags;
+    PzProcessObject *proc_obj;
+    PzIoControlBlock *control_block;
+
+    if (!ObReferenceObjectByHandle(PZ_OBJECT_PROCESS, nullptr, process, (ObPointer *)&proc_obj))
+        return STATUS_INVALID_HANDLE;
+
+    if (!ObReferenceObjectByHandle(PZ_OBJECT_IOCB, &flags, file, (ObPointer *)&control_block)) {
+        ObDereferenceObject(proc_obj);
+        return STATUS_INVALID_HANDLE;
+    }
+
+    PzStatus status = !(flags & HANDLE_READ) || as_user && proc_obj == PZ_KPROC ?
+        STATUS_ACCESS_DENIED :
+        MmiMapViewOfFile(proc_obj, control_block, offset, bytes, base);
+
+    ObDereferenceObject(control_block);
+    ObDereferenceObject(proc_obj);
+    return status;
+}
+
+PzStatus PzUnmapViewOfFile(bool as_user, PzHandle process, void *base)
+{
+    PzProcessObject *proc_obj;
+
+    if (!ObReferenceObjectByHandle(PZ_OBJECT_PROCESS, nullptr, process, (ObPointer *)&proc_obj))
+        return STATUS_INVALID_HANDLE;
+
+    PzStatus status = as_user && proc_obj == PZ_KPROC ? STATUS_ACCESS_DENIED :
+        MmiUnmapViewOfFile(proc_obj, base) ? STATUS_SUCCESS : STATUS_INVALID_ARGUMENT;
+
+    ObDereferenceObject(proc_obj);
+    return status;
+}
\ No newline at end of file
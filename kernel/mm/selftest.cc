@@ -0,0 +1,355 @@
+#include <mm/selftest.hh>
+#include <mm/virtual.hh>
+#include <mm/pool.hh>
+#include <mm/query.hh>
+#include <mm/region.hh>
+#include <obj/process.hh>
+#include <lib/util.hh>
+#include <x86/cpu.hh>
+#include <debug.hh>
+
+#define KVA_TEST_MAX_HOLES 4096
+#define KVA_TEST_ROUNDS    1024
+
+#define POOL_TEST_SLOTS      512
+#define POOL_TEST_OPERATIONS 16384
+
+#define REGION_TEST_MAX        256
+#define REGION_TEST_OPERATIONS 8192
+/* Fixed-address regions are placed within this many pages so that they collide often */
+#define REGION_TEST_WINDOW     4096
+
+#define TEARDOWN_TEST_TABLES 16
+#define TEARDOWN_TEST_PAGES  64
+
+/* Times allocations from the kernel address space allocator while it holds more and
+   more free single pages below the first range that fits, which a linear scan of the
+   address space would have to step over one by one */
+static bool MmiTestKvaScaling()
+{
+    static const u32 hole_counts[] = { 0, 64, 256, 1024, KVA_TEST_MAX_HOLES };
+    static void *ranges[2 * KVA_TEST_MAX_HOLES];
+    u64 best = -1ull, worst = 0;
+
+    for (u32 holes : hole_counts) {
+        u32 reserved = 0;
+
+        while (reserved < 2 * holes && (ranges[reserved] = MmiReserveKernelRange(1)))
+            reserved++;
+
+        /* Every other page goes back, leaving holes too small for the ranges timed below */
+        for (u32 i = 0; i < reserved; i += 2)
+            MmiReleaseKernelRange(ranges[i], 1);
+
+        u64 start = HalReadTsc();
+
+        for (int i = 0; i < KVA_TEST_ROUNDS; i++)
+            if (void *range = MmiReserveKernelRange(2))
+                MmiReleaseKernelRange(range, 2);
+
+        u64 cycles = (HalReadTsc() - start) / KVA_TEST_ROUNDS;
+
+        for (u32 i = 1; i < reserved; i += 2)
+            MmiReleaseKernelRange(ranges[i], 1);
+
+        DbgPrintStr("[MmSelfTest] KVA with %4i holes: %u cycles per allocation and free\r\n",
+            reserved / 2, u32(cycles));
+
+        best = Min(best, cycles);
+        worst = Max(worst, cycles);
+    }
+
+    /* A logarithmic search barely moves here, while a linear one grows with the holes */
+    bool flat = worst <= best * 4;
+    DbgPrintStr("[MmSelfTest] KVA allocation time %s (best %u, worst %u cycles)\r\n",
+        flat ? "stays flat" : "GROWS with fragmentation", u32(best), u32(worst));
+
+    return flat;
+}
+
+static u32 MmiTestRandom(u32 *seed)
+{
+    *seed = *seed * 1664525 + 1013904223;
+    return *seed >> 8;
+}
+
+/* Allocates and frees a random mix of sizes from a private pool, checking that no
+   allocation gets overwritten by another one and that nothing is left in use */
+static bool MmiTestPool()
+{
+    static PzKernelPool pool;
+    static u8 *slots[POOL_TEST_SLOTS];
+    static u32 sizes[POOL_TEST_SLOTS];
+    u64 alloc_cycles = 0, free_cycles = 0;
+    u32 allocs = 0, frees = 0, seed = 1;
+    bool passed = true;
+
+    PlInitializeKernelPool(&pool);
+
+    for (int i = 0; i < POOL_TEST_OPERATIONS + POOL_TEST_SLOTS; i++) {
+        /* The last rounds free whatever is left */
+        u32 slot = i < POOL_TEST_OPERATIONS ?
+            MmiTestRandom(&seed) % POOL_TEST_SLOTS : i - POOL_TEST_OPERATIONS;
+
+        if (u8 *object = slots[slot]) {
+            if (object[0] != u8(slot) || object[sizes[slot] - 1] != u8(slot))
+                passed = false;
+
+            u64 start = HalReadTsc();
+            if (PlFreeMemory(&pool, object) < int(sizes[slot]))
+                passed = false;
+            free_cycles += HalReadTsc() - start;
+
+            slots[slot] = nullptr;
+            frees++;
+        }
+        else if (i < POOL_TEST_OPERATIONS) {
+            u32 random = MmiTestRandom(&seed);
+            /* One allocation in sixteen is too large for the size classes */
+            u32 size = random % 16 ? 1 + random / 16 % PL_MAX_SMALL_SIZE :
+                PL_MAX_SMALL_SIZE + 1 + random / 16 % (3 * PAGE_SIZE);
+
+            u64 start = HalReadTsc();
+            object = (u8 *)PlAllocateMemory(&pool, size, 0);
+            alloc_cycles += HalReadTsc() - start;
+
+            if (!object) {
+                passed = false;
+                continue;
+            }
+
+            MemSet(object, u8(slot), size);
+            slots[slot] = object;
+            sizes[slot] = size;
+            allocs++;
+        }
+    }
+
+    /* Pointers the pool never handed out must be refused, even unmapped ones */
+    u8 local;
+    void *unmapped = MmiReserveKernelRange(1);
+
+    if (PlFreeMemory(&pool, &local) != -1 ||
+        unmapped && PlFreeMemory(&pool, unmapped) != -1)
+        passed = false;
+
+    if (unmapped)
+        MmiReleaseKernelRange(unmapped, 1);
+
+    PzKernelPoolInformation info;
+    PlQueryPool(&pool, &info);
+
+    for (auto &size_class : info.Classes)
+        if (size_class.ObjectsInUse)
+            passed = false;
+
+    if (info.LargeAllocations || info.LargePages)
+        passed = false;
+
+    DbgPrintStr("[MmSelfTest] Pool: %u cycles per allocation, %u per free, %s\r\n",
+        u32(alloc_cycles / Max(allocs, 1u)), u32(free_cycles / Max(frees, 1u)),
+        passed ? "passed" : "FAILED");
+
+    return passed;
+}
+
+struct MmiTestRange
+{
+    uptr Start, End;
+};
+
+/* First fit the way the sorted list of regions used to do it, starting at 0x1000 */
+static uptr MmiListFindGap(MmiTestRange *list, int count, uptr bytes)
+{
+    uptr last_cave = 0x1000;
+
+    for (int i = 0; i < count; i++) {
+        if (last_cave + bytes <= list[i].Start)
+            return last_cave;
+
+        last_cave = list[i].End;
+    }
+
+    return KERNEL_SPACE_START - last_cave >= bytes ? last_cave : 0;
+}
+
+static int MmiListFindContaining(MmiTestRange *list, int count, uptr address)
+{
+    for (int i = 0; i < count; i++)
+        if (list[i].Start <= address && address < list[i].End)
+            return i;
+
+    return -1;
+}
+
+/* Adds a range to the sorted list, unless it overlaps one that is already there */
+static bool MmiListInsert(MmiTestRange *list, int *count, uptr start, uptr end)
+{
+    int at = 0;
+
+    for (int i = 0; i < *count; i++) {
+        if (start < list[i].End && list[i].Start < end)
+            return false;
+
+        if (list[i].Start < start)
+            at = i + 1;
+    }
+
+    for (int i = *count; i > at; i--)
+        list[i] = list[i - 1];
+
+    list[at] = MmiTestRange { start, end };
+    ++*count;
+    return true;
+}
+
+/* Runs random allocations, fixed-address insertions, lookups and removals against
+   both the region tree and a sorted list with the semantics the tree replaced */
+static bool MmiTestRegionTree()
+{
+    static PzVirtualRegionTree tree;
+    static MmiTestRange list[REGION_TEST_MAX];
+    int count = 0, mismatches = 0;
+    u32 seed = 1;
+
+    for (int i = 0; i < REGION_TEST_OPERATIONS; i++) {
+        u32 random = MmiTestRandom(&seed);
+        uptr bytes = (1 + random / 8 % 16) * PAGE_SIZE;
+        uptr address = 0x1000 + MmiTestRandom(&seed) % (REGION_TEST_WINDOW * PAGE_SIZE);
+
+        switch (random % 8) {
+        case 0: case 1: {
+            if (count == REGION_TEST_MAX)
+                break;
+
+            uptr expected = MmiListFindGap(list, count, bytes);
+            uptr found = MmRegionFindGap(&tree, 0x1000, KERNEL_SPACE_START, bytes);
+
+            if (found != expected)
+                mismatches++;
+            else if (found) {
+                MmiListInsert(list, &count, found, found + bytes);
+                mismatches += !MmRegionInsert(&tree, found, found + bytes, 0);
+            }
+            break;
+        }
+        case 2: case 3: {
+            if (count == REGION_TEST_MAX)
+                break;
+
+            address &= -PAGE_SIZE;
+            bool inserted = MmiListInsert(list, &count, address, address + bytes);
+            mismatches += inserted != !!MmRegionInsert(&tree, address, address + bytes, 0);
+            break;
+        }
+        case 4: case 5: {
+            /* Half of the lookups go right to the edges of an existing region */
+            if (count && random & 8) {
+                MmiTestRange &edge = list[MmiTestRandom(&seed) % count];
+                address = random & 16 ? edge.Start : edge.End;
+            }
+
+            int expected = MmiListFindContaining(list, count, address);
+            PzVirtualRegionNode *node = MmRegionFindContaining(&tree, address);
+
+            if (expected == -1 ? !!node : !node || node->Value.Region.Start != list[expected].Start)
+                mismatches++;
+
+            /* Only an exact start address finds a region */
+            node = MmRegionFind(&tree, address);
+            if (!!node != (expected != -1 && list[expected].Start == address))
+                mismatches++;
+            break;
+        }
+        default: {
+            if (!count)
+                break;
+
+            int victim = random / 8 % count;
+            PzVirtualRegionNode *node = MmRegionFind(&tree, list[victim].Start);
+
+            if (!node || node->Value.Region.End != list[victim].End) {
+                mismatches++;
+                break;
+            }
+
+            MmRegionRemove(&tree, node);
+
+            for (int j = victim; j < count - 1; j++)
+                list[j] = list[j + 1];
+
+            count--;
+            break;
+        }
+        }
+    }
+
+    /* The tree must end up holding exactly the ranges of the list, in the same order */
+    int index = 0;
+
+    for (auto *node = tree.Tree.First(); node; node = tree.Tree.Next(node), index++)
+        if (index >= count || node->Value.Region.Start != list[index].Start ||
+            node->Value.Region.End != list[index].End)
+            mismatches++;
+
+    mismatches += index != count;
+
+    while (PzVirtualRegionNode *node = tree.Tree.Root)
+        MmRegionRemove(&tree, node);
+
+    DbgPrintStr("[MmSelfTest] Region tree: %i mismatches against the sorted list\r\n",
+        mismatches);
+
+    return !mismatches;
+}
+
+/* Fills an address space no thread runs in with committed memory and tears it down */
+static u32 MmiBuildAndFreeAddressSpace(PzProcessObject *process)
+{
+    u32 committed = 0;
+
+    if (!MmiAllocateProcessPageDirectory(process))
+        return 0;
+
+    /* Every allocation gets a page table of its own, so the teardown frees several */
+    for (uptr i = 1; i <= TEARDOWN_TEST_TABLES; i++)
+        if (MmiVirtualAllocateUserMemory(process, (void *)(i << 22),
+            TEARDOWN_TEST_PAGES * PAGE_SIZE, PAGE_READWRITE))
+            committed++;
+
+    MmiFreeProcessPageDirectory(process);
+    return committed;
+}
+
+/* Checks that tearing an address space down returns every physical page it took */
+static bool MmiTestAddressSpaceTeardown()
+{
+    static PzProcessObject process;
+    PzPhysicalMemoryInformation before, after;
+
+    /* The first round may grow the heap for the registration node, which it then keeps */
+    MmiBuildAndFreeAddressSpace(&process);
+    MmPhysicalQueryUsage(&before);
+    u32 committed = MmiBuildAndFreeAddressSpace(&process);
+    MmPhysicalQueryUsage(&after);
+
+    bool passed = committed == TEARDOWN_TEST_TABLES && after.FreePages == before.FreePages &&
+        !process.VirtualPageDirectory && !process.VirtualAllocations.Tree.First();
+
+    DbgPrintStr("[MmSelfTest] Address space teardown: %i of %i allocations, %i pages leaked\r\n",
+        committed, TEARDOWN_TEST_TABLES, int(before.FreePages - after.FreePages));
+
+    return passed;
+}
+
+void MmRunSelfTests()
+{
+    int failed = 0;
+
+    failed += !MmiTestKvaScaling();
+    failed += !MmiTestPool();
+    failed += !MmiTestRegionTree();
+    failed += !MmiTestAddressSpaceTeardown();
+
+    DbgPrintStr("[MmSelfTest] %s\r\n", failed ? "FAILED" : "All tests passed");
+}
\ No newline at end of file
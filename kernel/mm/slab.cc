@@ -0,0 +1,298 @@
+#include <mm/slab.hh>
+#include <mm/virtual.hh>
+#include <lib/malloc.hh>
+#include <lib/util.hh>
+#include <debug.hh>
+
+/* Caches that have created at least one slab, for statistics */
+static PzSpinlock CacheListLock;
+static PzObjectCache *FirstCache;
+
+/* Size classes of the caches backing linked list nodes */
+static PzObjectCache ListNodeCaches[] = {
+    OBJECT_CACHE_INITIALIZER("LLNode", 12, nullptr),
+    OBJECT_CACHE_INITIALIZER("LLNode", 16, nullptr),
+    OBJECT_CACHE_INITIALIZER("LLNode", 20, nullptr),
+    OBJECT_CACHE_INITIALIZER("LLNode", 24, nullptr),
+    OBJECT_CACHE_INITIALIZER("LLNode", 32, nullptr),
+    OBJECT_CACHE_INITIALIZER("LLNode", 40, nullptr),
+    OBJECT_CACHE_INITIALIZER("LLNode", 48, nullptr),
+    OBJECT_CACHE_INITIALIZER("LLNode", 64, nullptr),
+    OBJECT_CACHE_INITIALIZER("LLNode", 96, nullptr),
+    OBJECT_CACHE_INITIALIZER("LLNode", 128, nullptr),
+    OBJECT_CACHE_INITIALIZER("LLNode", 192, nullptr),
+    OBJECT_CACHE_INITIALIZER("LLNode", 256, nullptr),
+};
+
+/* Free objects are chained through a word placed after each of them,
+   so that the constructed state of the objects themselves is preserved. */
+static inline void *&NextFree(PzObjectCache *cache, void *object)
+{
+    return *(void **)((u8 *)object + ALIGN(cache->ObjectSize, sizeof(void *)));
+}
+
+static inline PzSlab *SlabOf(void *object)
+{
+    return (PzSlab *)(uptr(object) & -PAGE_SIZE);
+}
+
+static void SlabListRemove(PzSlab **list, PzSlab *slab)
+{
+    if (slab->Previous)
+        slab->Previous->Next = slab->Next;
+    else
+        *list = slab->Next;
+
+    if (slab->Next)
+        slab->Next->Previous = slab->Previous;
+}
+
+static void SlabListPush(PzSlab **list, PzSlab *slab)
+{
+    slab->Previous = nullptr;
+    slab->Next = *list;
+
+    if (*list)
+        (*list)->Previous = slab;
+
+    *list = slab;
+}
+
+bool MmInitializeObjectCache(
+    PzObjectCache *cache, const char *name, u32 size, void (*constructor)(void *object))
+{
+    if (!size || size > SLAB_MAX_OBJECT_SIZE)
+        return false;
+
+    *cache = OBJECT_CACHE_INITIALIZER(name, size, constructor);
+    return true;
+}
+
+/* Maps a new slab and constructs all of its objects. Called without the cache lock. */
+static PzSlab *MmiCreateSlab(PzObjectCache *cache)
+{
+    auto *slab = (PzSlab *)MmVirtualAllocateMemory(nullptr, PAGE_SIZE, PAGE_READWRITE, nullptr);
+
+    if (!slab)
+        return nullptr;
+
+    slab->Cache = cache;
+    slab->InUse = 0;
+    slab->FreeObjects = nullptr;
+
+    /* Chain the objects so that the lowest one is handed out first */
+    u8 *objects = (u8 *)slab + SLAB_OBJECTS_OFFSET;
+
+    for (int i = cache->ObjectsPerSlab - 1; i >= 0; i--) {
+        void *object = objects + i * cache->Stride;
+
+        if (cache->Constructor)
+            cache->Constructor(object);
+
+        NextFree(cache, object) = slab->FreeObjects;
+        slab->FreeObjects = object;
+    }
+
+    if (!cache->Registered) {
+        PzAcquireSpinlock(&CacheListLock);
+
+        if (!cache->Registered) {
+            cache->NextCache = FirstCache;
+            FirstCache = cache;
+            cache->Registered = true;
+        }
+
+        PzReleaseSpinlock(&CacheListLock);
+    }
+
+    return slab;
+}
+
+/* Takes up to `count` objects from the slabs, creating new ones as needed */
+static u32 MmiAllocateFromSlabs(PzObjectCache *cache, void **objects, u32 count)
+{
+    u32 taken = 0;
+
+    PzAcquireSpinlock(&cache->Lock);
+
+    while (taken < count) {
+        PzSlab *slab = cache->PartialSlabs;
+
+        if (!slab && (slab = cache->EmptySlabs)) {
+            SlabListRemove(&cache->EmptySlabs, slab);
+            SlabListPush(&cache->PartialSlabs, slab);
+        }
+
+        if (!slab) {
+            /* Mapping memory may take other locks, so do it without holding ours */
+            PzReleaseSpinlock(&cache->Lock);
+            slab = MmiCreateSlab(cache);
+            PzAcquireSpinlock(&cache->Lock);
+
+            if (!slab)
+                break;
+
+            cache->SlabCount++;
+            SlabListPush(&cache->PartialSlabs, slab);
+        }
+
+        while (taken < count && slab->FreeObjects) {
+            void *object = slab->FreeObjects;
+            slab->FreeObjects = NextFree(cache, object);
+            slab->InUse++;
+            objects[taken++] = object;
+        }
+
+        if (slab->InUse == cache->ObjectsPerSlab) {
+            SlabListRemove(&cache->PartialSlabs, slab);
+            SlabListPush(&cache->FullSlabs, slab);
+        }
+    }
+
+    cache->ObjectsInUse += taken;
+    PzReleaseSpinlock(&cache->Lock);
+    return taken;
+}
+
+/* Returns objects to their slabs, unmapping all empty slabs but one */
+static void MmiFreeToSlabs(PzObjectCache *cache, void **objects, u32 count)
+{
+    PzSlab *unused = nullptr;
+
+    PzAcquireSpinlock(&cache->Lock);
+
+    for (u32 i = 0; i < count; i++) {
+        PzSlab *slab = SlabOf(objects[i]);
+
+        NextFree(cache, objects[i]) = slab->FreeObjects;
+        slab->FreeObjects = objects[i];
+
+        if (slab->InUse-- == cache->ObjectsPerSlab) {
+            SlabListRemove(&cache->FullSlabs, slab);
+            SlabListPush(&cache->PartialSlabs, slab);
+        }
+
+        if (!slab->InUse) {
+            SlabListRemove(&cache->PartialSlabs, slab);
+
+            if (cache->EmptySlabs) {
+                cache->SlabCount--;
+                SlabListPush(&unused, slab);
+            }
+            else
+                SlabListPush(&cache->EmptySlabs, slab);
+        }
+    }
+
+    cache->ObjectsInUse -= count;
+    PzReleaseSpinlock(&cache->Lock);
+
+    while (unused) {
+        PzSlab *next = unused->Next;
+        MmVirtualFreeMemory(unused, PAGE_SIZE);
+        unused = next;
+    }
+}
+
+void *MmCacheAllocate(PzObjectCache *cache)
+{
+    /* Staying at DISPATCH_LEVEL pins the thread to this processor's magazine */
+    int old_irql = PzRaiseIrql(DISPATCH_LEVEL);
+    PzObjectMagazine *magazine = &cache->Magazines[PzGetCurrentProcessorNumber()];
+    void *object = nullptr;
+
+    if (!magazine->Rounds) {
+        /* Refill half of the magazine, so that alternating
+           allocations and frees do not keep missing it */
+        magazine->Misses++;
+        magazine->Rounds = MmiAllocateFromSlabs(cache, magazine->Objects, SLAB_MAGAZINE_SIZE / 2);
+    }
+
+    if (magazine->Rounds) {
+        object = magazine->Objects[--magazine->Rounds];
+        magazine->Allocations++;
+    }
+
+    PzLowerIrql(old_irql);
+    return object;
+}
+
+void MmCacheFree(PzObjectCache *cache, void *object)
+{
+    if (!object)
+        return;
+
+    int old_irql = PzRaiseIrql(DISPATCH_LEVEL);
+    PzObjectMagazine *magazine = &cache->Magazines[PzGetCurrentProcessorNumber()];
+
+    if (magazine->Rounds == SLAB_MAGAZINE_SIZE) {
+        magazine->Misses++;
+        magazine->Rounds -= SLAB_MAGAZINE_SIZE / 2;
+        MmiFreeToSlabs(cache, magazine->Objects + magazine->Rounds, SLAB_MAGAZINE_SIZE / 2);
+    }
+
+    magazine->Objects[magazine->Rounds++] = object;
+    magazine->Frees++;
+
+    PzLowerIrql(old_irql);
+}
+
+void MmQueryObjectCache(PzObjectCache *cache, PzObjectCacheStatistics *stats)
+{
+    *stats = PzObjectCacheStatistics {};
+
+    PzAcquireSpinlock(&cache->Lock);
+    stats->SlabCount = cache->SlabCount;
+    stats->ObjectsInUse = cache->ObjectsInUse;
+    PzReleaseSpinlock(&cache->Lock);
+
+    /* Objects sitting in magazines are free as far as users of the cache are concerned */
+    for (int i = 0; i < MAX_PROCESSORS; i++) {
+        PzObjectMagazine *magazine = &cache->Magazines[i];
+        stats->Allocations += magazine->Allocations;
+        stats->Frees += magazine->Frees;
+        stats->MagazineMisses += magazine->Misses;
+        stats->ObjectsInUse -= magazine->Rounds;
+    }
+}
+
+void MmPrintObjectCaches()
+{
+    PzAcquireSpinlock(&CacheListLock);
+
+    for (PzObjectCache *cache = FirstCache; cache; cache = cache->NextCache) {
+        PzObjectCacheStatistics stats;
+        MmQueryObjectCache(cache, &stats);
+
+        DbgPrintStr("[MmObjectCache] %s(%i): slabs=%i in_use=%i allocs=%i frees=%i misses=%i\r\n",
+            cache->Name, cache->ObjectSize, stats.SlabCount, stats.ObjectsInUse,
+            stats.Allocations, stats.Frees, stats.MagazineMisses);
+    }
+
+    PzReleaseSpinlock(&CacheListLock);
+}
+
+static PzObjectCache *ListNodeCacheFor(u32 bytes)
+{
+    for (auto &cache : ListNodeCaches)
+        if (bytes <= cache.ObjectSize)
+            return &cache;
+
+    return nullptr;
+}
+
+void *MmAllocateListNode(u32 bytes)
+{
+    if (PzObjectCache *cache = ListNodeCacheFor(bytes))
+        return MmCacheAllocate(cache);
+
+    return PzHeapAllocate(bytes, 0);
+}
+
+void MmFreeListNode(void *node, u32 bytes)
+{
+    if (PzObjectCache *cache = ListNodeCacheFor(bytes))
+        MmCacheFree(cache, node);
+    else
+        PzHeapFree(node);
+}
\ No newline at end of file
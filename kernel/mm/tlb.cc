@@ -0,0 +1,75 @@
+#include <mm/tlb.hh>
+#include <mm/virtual.hh>
+#include <lib/util.hh>
+#include <x86/cpu.hh>
+
+void MmTlbBatchInitialize(PzTlbBatch *batch)
+{
+    batch->Count = 0;
+    batch->FlushAll = false;
+    batch->FlushGlobal = false;
+}
+
+void MmTlbBatchAdd(PzTlbBatch *batch, void *page)
+{
+    if (uptr(page) >= KERNEL_SPACE_START)
+        batch->FlushGlobal = true;
+
+    if (batch->FlushAll)
+        return;
+
+    if (batch->Count == TLB_BATCH_MAX_PAGES) {
+        batch->FlushAll = true;
+        return;
+    }
+
+    batch->Pages[batch->Count++] = page;
+}
+
+void MmTlbBatchAddRange(PzTlbBatch *batch, void *start, u32 pages)
+{
+    if (uptr(start) + pages * PAGE_SIZE > KERNEL_SPACE_START)
+        batch->FlushGlobal = true;
+
+    if (batch->FlushAll)
+        return;
+
+    if (pages > TLB_BATCH_MAX_PAGES - batch->Count) {
+        batch->FlushAll = true;
+        return;
+    }
+
+    for (u32 i = 0; i < pages; i++)
+        batch->Pages[batch->Count++] = (u8 *)start + i * PAGE_SIZE;
+}
+
+/* Invalidates the batch on the current processor */
+static void MmiTlbFlushLocal(PzTlbBatch *batch)
+{
+    if (batch->FlushAll) {
+        uptr cr4 = HalReadCr4();
+
+        /* Toggling CR4.PGE is the only way to drop global translations wholesale */
+        if (batch->FlushGlobal && cr4 & CR4_PGE) {
+            HalWriteCr4(cr4 & ~CR4_PGE);
+            HalWriteCr4(cr4);
+        }
+        else
+            HalSwitchPageTable(HalReadCr3());
+
+        return;
+    }
+
+    for (u32 i = 0; i < batch->Count; i++)
+        HalFlushCacheForPage(batch->Pages[i]);
+}
+
+void MmTlbBatchFlush(PzTlbBatch *batch)
+{
+    /* With more than one processor, this is where the batch would be sent
+       to the others by IPI, waiting for them to run MmiTlbFlushLocal too. */
+    if (batch->Count || batch->FlushAll)
+        MmiTlbFlushLocal(batch);
+
+    MmTlbBatchInitialize(batch);
+}
\ No newline at end of file
@@ -0,0 +1,59 @@
+#include <mm/usercopy.hh>
+#include <mm/virtual.hh>
+#include <lib/util.hh>
+#include <core.hh>
+
+struct UserAccessFixup
+{
+    uptr FaultingEip, ResumeEip;
+};
+
+extern "C" int HalCopyUser(void *dest, const void *src, usize bytes);
+extern "C" int HalTouchUser(const void *address, int write);
+extern "C" const UserAccessFixup HalUserAccessFixups[];
+extern "C" const u32 HalUserAccessFixupCount;
+
+/* Returns whether [start, start + bytes) lies entirely in the user half */
+static inline bool IsUserRange(uptr start, usize bytes)
+{
+    return start + bytes >= start && start + bytes <= KERNEL_SPACE_START;
+}
+
+bool MmCopyFromUser(void *dest, const void *src, usize bytes)
+{
+    if (!IsUserRange(uptr(src), bytes))
+        return false;
+
+    return !HalCopyUser(dest, src, bytes);
+}
+
+bool MmCopyToUser(void *dest, const void *src, usize bytes)
+{
+    if (!IsUserRange(uptr(dest), bytes))
+        return false;
+
+    return !HalCopyUser(dest, src, bytes);
+}
+
+bool MmiFaultInUserPages(uptr start, u32 pages, bool write)
+{
+    if (!IsUserRange(start, pages * PAGE_SIZE))
+        return false;
+
+    for (u32 i = 0; i < pages; i++)
+        if (HalTouchUser((void *)(start + i * PAGE_SIZE), write))
+            return false;
+
+    return true;
+}
+
+bool MmiFixupUserAccess(CpuInterruptState *state)
+{
+    for (u32 i = 0; i < HalUserAccessFixupCount; i++)
+        if (HalUserAccessFixups[i].FaultingEip == state->Eip) {
+            state->Eip = HalUserAccessFixups[i].ResumeEip;
+            return true;
+        }
+
+    return false;
+}
\ No newline at end of file
@@ -1,6 +1,17 @@
 #include <mm/virtual.hh>
 #include <mm/physical.hh>
+#include <mm/kva.hh>
+#include <mm/tlb.hh>
+#include <mm/region.hh>
+#include <mm/section.hh>
+#include <mm/query.hh>
+#include <mm/usercopy.hh>
 #include <lib/util.hh>
+#include <lib/list.hh>
+#include <x86/cpu.hh>
+#include <x86/port.hh>
+#include <core.hh>
+#include <processor.hh>
 #include <debug.hh>
 #include <obj/process.hh>
 
@@ -11,10 +22,16 @@
 #define PDE_X86_NONCACHED 16
 #define PDE_X86_ACCESSED  32
 #define PDE_X86_LARGEPAGE 128
+#define PDE_X86_GLOBAL    256
 #define PDE_X86_FREE_BIT  9
 
 #define PAGE_X86_ALLOCATED 1
 
+#define PF_ERROR_PRESENT 1
+#define PF_ERROR_WRITE   2
+
+#define EFLAGS_IF (1 << 9)
+
 #define KM_PAGE_INDEX_TO_ADDR(index) (void*)(KERNEL_SPACE_START + (index) * PAGE_SIZE)
 
 /* This is the global pointer to the page table of the upper half of
@@ -34,9 +51,64 @@ static uptr *BootPageDir;
 
 static PzSpinlock MmVirtualLock, MmVirtualDmaLock;
 
+/* PDE_X86_GLOBAL if the processor supports global pages. Kernel mappings
+   carry it, so that switching address spaces keeps them in the TLB. */
+static u32 KernelGlobalBit;
+static bool LargePagesSupported;
+
+/* Page directory entries of the kernel half, of which every address space holds a copy.
+   Page tables stay filled in below large pages so that PT_VIRT_BASE lookups still work. */
+static uptr KernelHalfPdes[512];
+
+/* Physical page directories of all processes, protected by MmVirtualLock */
+static LinkedList<uptr **> AddressSpaces;
+
+/* Returns a large page directory entry mapping the same memory as a whole page table,
+   or 0 if the table does not map 4 MiB of contiguous, aligned memory with uniform flags. */
+static uptr MmiLargePdeFromTable(uptr *ptes)
+{
+    uptr first = ptes[0];
+
+    if (!LargePagesSupported || !(first & PDE_X86_PRESENT) ||
+        (first & -PAGE_SIZE) % LARGE_PAGE_SIZE)
+        return 0;
+
+    for (int i = 1; i < 1024; i++)
+        if (ptes[i] != first + i * PAGE_SIZE)
+            return 0;
+
+    return first | PDE_X86_LARGEPAGE;
+}
+
 void MmVirtualInitBootPageTable(KernelBootInfo *info)
 {
+    PzTrackSpinlock(&MmVirtualLock, "MmVirtualLock");
+    PzTrackSpinlock(&MmVirtualDmaLock, "MmVirtualDmaLock");
+
     constexpr u32 lower_imap_pages = PAGES_IN(0x200000);
+    u32 eax, ebx, ecx, edx;
+
+    HalCpuid(CPUID_LEAF_FEATURES, &eax, &ebx, &ecx, &edx);
+
+    if (edx & CPUID_EDX_PGE) {
+        KernelGlobalBit = PDE_X86_GLOBAL;
+        HalWriteCr4(HalReadCr4() | CR4_PGE);
+    }
+
+    if (edx & CPUID_EDX_PSE) {
+        LargePagesSupported = true;
+        HalWriteCr4(HalReadCr4() | CR4_PSE);
+    }
+
+    /* Turn the UC- entries of the default PAT into WC, so that every PAGE_CACHE_* type can
+       be selected with PCD and PWT alone. Without a PAT, WC mappings end up UC- instead. */
+    if (edx & CPUID_EDX_PAT) {
+        u32 pat = PAT_TYPE_WB | PAT_TYPE_WT << 8 | PAT_TYPE_WC << 16 | PAT_TYPE_UC << 24;
+        HalMsrWrite(MSR_PAT, pat, pat);
+    }
+
+    /* Make the kernel honor read-only user pages too, so that copies into them fault */
+    HalWriteCr0(HalReadCr0() | CR0_WP);
 
     KernelHalfPtBase = (uptr *)MmPhysicalAllocateContiguousPages(0, PAGES_IN(KERNEL_SPACE_SIZE) / 1024);
     BootImapPtBase = (uptr *)MmPhysicalAllocateContiguousPages(0, ALIGN(lower_imap_pages, 1024) / 1024);
@@ -47,7 +119,7 @@ void MmVirtualInitBootPageTable(KernelBootInfo *info)
     /* Map the kernel into the higher half. */
     for (int i = 0; i < kernel_pages; i++)
         KernelHalfPtBase[i] = info->KernelPhysicalStart + i * PAGE_SIZE
-        | PDE_X86_READWRITE | PDE_X86_PRESENT;
+        | KernelGlobalBit | PDE_X86_READWRITE | PDE_X86_PRESENT;
 
     /* Zero out remaining page entries. */
     for (int i = kernel_pages; i < PAGES_IN(KERNEL_SPACE_SIZE); i++)
@@ -58,14 +130,10 @@ void MmVirtualInitBootPageTable(KernelBootInfo *info)
 
     for (int i = 0; i < recursive_pages - 1; i++)
         recursive_map[i] = (uptr)KernelHalfPtBase + i * 4096
-        | PDE_X86_READWRITE | PDE_X86_PRESENT;
+        | KernelGlobalBit | PDE_X86_READWRITE | PDE_X86_PRESENT;
 
     recursive_map[recursive_pages - 1] =
-        (uptr)BootPageDir | PDE_X86_READWRITE | PDE_X86_PRESENT;
-
-    for (int i = 0; i < kernel_pages; i++)
-        KernelHalfPtBase[i] = info->KernelPhysicalStart + i * PAGE_SIZE
-        | PDE_X86_READWRITE | PDE_X86_PRESENT;
+        (uptr)BootPageDir | KernelGlobalBit | PDE_X86_READWRITE | PDE_X86_PRESENT;
 
     BootImapPtBase[0] = 0u;
     for (int i = 1; i < lower_imap_pages; i++)
@@ -75,32 +143,125 @@ void MmVirtualInitBootPageTable(KernelBootInfo *info)
     for (int i = 0; i < ALIGN(lower_imap_pages, 1024) / 1024; i++)
         BootPageDir[i] = uptr(BootImapPtBase + i * 1024) | PDE_X86_READWRITE | PDE_X86_PRESENT;
 
-    /* Map kernel half page table into the page directory */
-    for (int i = 0; i < 512; i++)
-        BootPageDir[i + 512] = uptr(KernelHalfPtBase + i * 1024) | PDE_X86_READWRITE | PDE_X86_PRESENT;
+    /* Map kernel half page table into the page directory,
+       using large pages wherever the kernel image allows it */
+    for (int i = 0; i < 512; i++) {
+        KernelHalfPdes[i] = MmiLargePdeFromTable(KernelHalfPtBase + i * 1024);
+
+        if (!KernelHalfPdes[i])
+            KernelHalfPdes[i] = uptr(KernelHalfPtBase + i * 1024) | PDE_X86_READWRITE | PDE_X86_PRESENT;
+
+        BootPageDir[i + 512] = KernelHalfPdes[i];
+    }
 
     HalSwitchPageTable((uptr)BootPageDir);
+
+    /* Hand the free parts of the kernel half to the address space allocator */
+    MmKvaInitialize(PAGES_IN(KERNEL_SPACE_SIZE));
+    MmKvaReserve(0, kernel_pages);
+    MmKvaReserve(PAGES_IN(KERNEL_SPACE_SIZE) - recursive_pages, recursive_pages);
+
     MmiPhysicalPostVirtualInit();
 }
 
-int MmFindVirtualCave(u32 pages)
+/* Changes a kernel half page directory entry in every address space.
+   Must be called with MmVirtualLock held. */
+static void MmiSetKernelPde(int table, uptr pde)
 {
-    if (pages == 0)
-        return -1;
+    KernelHalfPdes[table] = pde;
 
-    for (int i = 0; i < PAGES_IN(KERNEL_SPACE_SIZE); i++) {
-        int streak = 0, index = i;
+    /* The boot page directory stays mapped at PD_VIRT_BASE in every address space */
+    PD_VIRT_BASE[table + 512] = pde;
 
-        while (!(PT_VIRT_BASE[i] & PDE_X86_PRESENT)) {
-            if (streak++ == pages)
-                return index;
+    ENUM_LIST(node, AddressSpaces)
+        node->Value[table + 512] = (uptr *)pde;
+}
 
-            if (++i >= PAGES_IN(KERNEL_SPACE_SIZE))
-                return -1;
+/* Maps every 4 MiB chunk of a kernel range that the range covers
+   entirely with a large page, if its page table entries allow it.
+   Must be called with MmVirtualLock held. */
+static void MmiPromoteLargePages(PzTlbBatch *batch, int index, int pages)
+{
+    for (int table = ALIGN(index, 1024) / 1024; (table + 1) * 1024 <= index + pages; table++) {
+        if (uptr pde = MmiLargePdeFromTable(PT_VIRT_BASE + table * 1024)) {
+            MmiSetKernelPde(table, pde);
+            MmTlbBatchAdd(batch, KM_PAGE_INDEX_TO_ADDR(table * 1024));
         }
     }
+}
 
-    return -1;
+/* Points every large page directory entry overlapping a kernel range back
+   at its page table, whose entries mirror the large page's mapping.
+   Must be called with MmVirtualLock held. */
+static void MmiDemoteLargePages(PzTlbBatch *batch, int index, int pages)
+{
+    for (int table = index / 1024; table * 1024 < index + pages; table++) {
+        if (KernelHalfPdes[table] & PDE_X86_LARGEPAGE) {
+            MmiSetKernelPde(table,
+                uptr(KernelHalfPtBase + table * 1024) | PDE_X86_READWRITE | PDE_X86_PRESENT);
+            MmTlbBatchAdd(batch, KM_PAGE_INDEX_TO_ADDR(table * 1024));
+        }
+    }
+}
+
+/* Returns a range to the address space allocator. It only fails if the range is already
+   partly free or no extent descriptor is left, so the range is leaked and reported.
+   Must be called with MmVirtualLock held. */
+static void MmiFreeKernelRange(int index, u32 pages)
+{
+    if (!MmKvaFree(index, pages))
+        DbgPrintStr("[MmVirtual] Failed to free kernel range %p (%i pages), leaking it\r\n",
+            KM_PAGE_INDEX_TO_ADDR(index), pages);
+}
+
+/* Maps a page of fresh extent descriptors for the address space allocator
+   whenever its spare count runs low. Must be called with MmVirtualLock held. */
+static void MmiRefillKvaDescriptors()
+{
+    if (!MmKvaNeedsDescriptors())
+        return;
+
+    int index = MmKvaAllocate(1);
+
+    if (index == -1)
+        return;
+
+    uptr physical_page = MmPhysicalAllocatePage(0);
+
+    if (!physical_page) {
+        MmiFreeKernelRange(index, 1);
+        return;
+    }
+
+    PT_VIRT_BASE[index] = physical_page |
+        PAGE_X86_ALLOCATED << PDE_X86_FREE_BIT |
+        KernelGlobalBit | PDE_X86_READWRITE | PDE_X86_PRESENT;
+
+    MmKvaAddDescriptors(KM_PAGE_INDEX_TO_ADDR(index), PAGE_SIZE);
+}
+
+/* Claims a range of kernel pages, either at a fixed address or wherever one fits.
+   Must be called with MmVirtualLock held. */
+static int MmiClaimKernelRange(void *start, u32 pages)
+{
+    MmiRefillKvaDescriptors();
+
+    if (start == nullptr)
+        return MmKvaAllocate(pages);
+
+    if (uptr(start) < KERNEL_SPACE_START)
+        return -1;
+
+    int index = (uptr(start) - KERNEL_SPACE_START) / PAGE_SIZE;
+    return MmKvaReserve(index, pages) ? index : -1;
+}
+
+/* Claims a range whose 4 MiB chunks line up with those of the physical memory it is going
+   to map, so that MmiPromoteLargePages can cover them. Must be called with MmVirtualLock held. */
+static int MmiClaimCongruentKernelRange(uptr physical_addr, u32 pages)
+{
+    MmiRefillKvaDescriptors();
+    return MmKvaAllocateAligned(pages, 1024, (physical_addr / PAGE_SIZE) % 1024);
 }
 
 u32 KernelFlagsToPtFlags(u32 flags)
@@ -108,6 +269,14 @@ u32 KernelFlagsToPtFlags(u32 flags)
     return PDE_X86_PRESENT | (flags & PAGE_WRITE ? PDE_X86_READWRITE : 0);
 }
 
+/* Page table flags for mappings in the kernel half, which are the same in every address space.
+   The PAGE_CACHE_* types are numbered after the PAT entry that PWT and PCD select. */
+static u32 KernelHalfPtFlags(u32 flags)
+{
+    static_assert(PAGE_CACHE_WT >> 1 == PDE_X86_WRITETHRU && PAGE_CACHE_WC >> 1 == PDE_X86_NONCACHED);
+    return KernelFlagsToPtFlags(flags) | (flags & PAGE_CACHE_MASK) >> 1 | KernelGlobalBit;
+}
+
 bool MmVirtualProtectMemory(void *start, u32 bytes, u32 flags)
 {
     int pages = PAGES_IN(bytes + (uptr)start % PAGE_SIZE);
@@ -115,6 +284,7 @@ bool MmVirtualProtectMemory(void *start, u32 bytes, u32 flags)
     if (!pages)
         return false;
 
+    PzTlbBatch batch;
     PzAcquireSpinlock(&MmVirtualLock);
 
     int index = (uptr(start) - KERNEL_SPACE_START) / PAGE_SIZE;
@@ -123,12 +293,17 @@ bool MmVirtualProtectMemory(void *start, u32 bytes, u32 flags)
         if (!(PT_VIRT_BASE[index + i] & PDE_X86_PRESENT))
             goto fail;
 
+    MmTlbBatchInitialize(&batch);
+    MmiDemoteLargePages(&batch, index, pages);
+
     for (int i = 0; i < pages; i++) {
         PT_VIRT_BASE[index + i] &= -PAGE_SIZE;
-        PT_VIRT_BASE[index + i] |= KernelFlagsToPtFlags(flags);
-        HalFlushCacheForPage(KM_PAGE_INDEX_TO_ADDR(index + i));
+        PT_VIRT_BASE[index + i] |= KernelHalfPtFlags(flags);
     }
 
+    MmTlbBatchAddRange(&batch, KM_PAGE_INDEX_TO_ADDR(index), pages);
+    MmTlbBatchFlush(&batch);
+
     PzReleaseSpinlock(&MmVirtualLock);
     return true;
 
@@ -148,26 +323,27 @@ void *MmVirtualMapPhysical(void *start, uptr physical_addr, u32 bytes, u32 flags
         return nullptr;
 
     int index = 0;
+    PzTlbBatch batch;
 
     PzAcquireSpinlock(&MmVirtualLock);
 
-    if (start != nullptr) {
-        if (uptr(start) < KERNEL_SPACE_START)
-            goto fail;
-
-        index = (uptr(start) - KERNEL_SPACE_START) / PAGE_SIZE;
+    /* Mappings of at least 4 MiB, such as framebuffers, are worth placing where they can use large
+       pages. Tight on address space, fall back to any range, which small pages will have to map. */
+    if (start || pages < 1024 || !LargePagesSupported ||
+        (index = MmiClaimCongruentKernelRange(physical_addr, pages)) == -1)
+        index = MmiClaimKernelRange(start, pages);
 
-        for (int i = 0; i < pages; i++)
-            if (PT_VIRT_BASE[index + i] & PDE_X86_PRESENT)
-                goto fail;
-    }
-    else if ((index = MmFindVirtualCave(pages)) == -1)
+    if (index == -1)
         goto fail;
 
-    for (int i = 0; i < pages; i++) {
-        PT_VIRT_BASE[index + i] = physical_addr + i * PAGE_SIZE | KernelFlagsToPtFlags(flags);
-        HalFlushCacheForPage(KM_PAGE_INDEX_TO_ADDR(index + i));
-    }
+    /* The claimed range was unmapped, and the TLB never caches
+       non-present entries, so there is nothing to invalidate. */
+    for (int i = 0; i < pages; i++)
+        PT_VIRT_BASE[index + i] = physical_addr + i * PAGE_SIZE | KernelHalfPtFlags(flags);
+
+    MmTlbBatchInitialize(&batch);
+    MmiPromoteLargePages(&batch, index, pages);
+    MmTlbBatchFlush(&batch);
 
     PzReleaseSpinlock(&MmVirtualLock);
     return KM_PAGE_INDEX_TO_ADDR(index);
@@ -191,44 +367,24 @@ void *MmVirtualAllocateMemory(
 
     PzAcquireSpinlock(&MmVirtualLock);
 
-    if (start != nullptr) {
-        if (uptr(start) < KERNEL_SPACE_START)
-            goto fail;
-
-        index = (uptr(start) - KERNEL_SPACE_START) / PAGE_SIZE;
-
-        for (int i = 0; i < pages; i++) {
-            if (PT_VIRT_BASE[index + i] & PDE_X86_PRESENT)
-                goto fail;
-        }
-    }
-    else if ((index = MmFindVirtualCave(pages)) == -1)
+    if ((index = MmiClaimKernelRange(start, pages)) == -1)
         goto fail;
 
-    for (int i = 0; i < pages; i++) {
-        uptr physical_page = (uptr)MmPhysicalAllocatePage(0);
-
-        if (!physical_page) {
-            /* Revert every physical allocation if one allocation fails */
-            for (int j = 0; j < i; j++) {
-                MmPhysicalFreePages(PT_VIRT_BASE[index + j] & -PAGE_SIZE, 0, 1);
-                PT_VIRT_BASE[index + j] = 0;
-                HalFlushCacheForPage(KM_PAGE_INDEX_TO_ADDR(index + j));
-            }
-
-            goto fail;
-        }
+    /* The page table entries receive the physical addresses directly. They
+       stay not present until the flags are added, so a failure maps nothing. */
+    if (!MmPhysicalAllocatePages(0, pages, &PT_VIRT_BASE[index])) {
+        MemSet(&PT_VIRT_BASE[index], 0, pages * sizeof(uptr));
+        MmiFreeKernelRange(index, pages);
+        goto fail;
+    }
 
-        if (last_page_physical)
-            *last_page_physical = physical_page;
+    if (last_page_physical)
+        *last_page_physical = PT_VIRT_BASE[index + pages - 1];
 
-        PT_VIRT_BASE[index + i] =
-            physical_page |
+    for (int i = 0; i < pages; i++)
+        PT_VIRT_BASE[index + i] |=
             PAGE_X86_ALLOCATED << PDE_X86_FREE_BIT |
-            KernelFlagsToPtFlags(flags);
-
-        HalFlushCacheForPage(KM_PAGE_INDEX_TO_ADDR(index + i));
-    }
+            KernelHalfPtFlags(flags);
 
     PzReleaseSpinlock(&MmVirtualLock);
     return KM_PAGE_INDEX_TO_ADDR(index);
@@ -242,10 +398,11 @@ bool MmVirtualFreeMemory(void *start, u32 bytes)
 {
     int pages = PAGES_IN(bytes);
 
-    if (!pages)
+    if (!pages || uptr(start) < KERNEL_SPACE_START)
         return false;
 
     PzAcquireSpinlock(&MmVirtualLock);
+    MmiRefillKvaDescriptors();
     int index = (uptr(start) - KERNEL_SPACE_START) / PAGE_SIZE;
 
     for (int i = 0; i < pages; i++) {
@@ -255,19 +412,206 @@ bool MmVirtualFreeMemory(void *start, u32 bytes)
         }
     }
 
+    /* Stale translations must be gone before the lock lets anyone reuse the range,
+       and before its frames go back to the allocator, which the page batch sees to */
+    PzTlbBatch batch;
+    PzPageBatch freed;
+    MmTlbBatchInitialize(&batch);
+    MmPageBatchInitialize(&freed, &batch);
+    MmiDemoteLargePages(&batch, index, pages);
+
     for (int i = 0; i < pages; i++) {
         uptr &old = PT_VIRT_BASE[index + i];
-        if (((old >> PDE_X86_FREE_BIT) & 7) == PAGE_X86_ALLOCATED)
-            MmPhysicalFreePages(old & -PAGE_SIZE, 0, 1);
+        uptr frame = old;
+
+        old = 0;
+        MmTlbBatchAdd(&batch, KM_PAGE_INDEX_TO_ADDR(index + i));
+
+        if (((frame >> PDE_X86_FREE_BIT) & 7) == PAGE_X86_ALLOCATED)
+            MmPageBatchAdd(&freed, frame & -PAGE_SIZE);
+    }
+
+    MmPageBatchFlush(&freed);
+    MmTlbBatchFlush(&batch);
+
+    MmiFreeKernelRange(index, pages);
+    PzReleaseSpinlock(&MmVirtualLock);
+    return true;
+}
+
+/* Unmaps and frees `count` single kernel pages scattered over the kernel half,
+   with one hold of the lock and one TLB flush for all of them */
+static void MmiFreeKernelPageArray(void **pages, u32 count)
+{
+    PzTlbBatch batch;
+    PzPageBatch freed;
+
+    PzAcquireSpinlock(&MmVirtualLock);
+    MmiRefillKvaDescriptors();
+    MmTlbBatchInitialize(&batch);
+    MmPageBatchInitialize(&freed, &batch);
+
+    for (u32 i = 0; i < count; i++) {
+        int index = (uptr(pages[i]) - KERNEL_SPACE_START) / PAGE_SIZE;
+        uptr &old = PT_VIRT_BASE[index];
+        uptr frame = old;
+
+        MmiDemoteLargePages(&batch, index, 1);
+        old = 0;
+        MmTlbBatchAdd(&batch, pages[i]);
+
+        if (((frame >> PDE_X86_FREE_BIT) & 7) == PAGE_X86_ALLOCATED)
+            MmPageBatchAdd(&freed, frame & -PAGE_SIZE);
+    }
+
+    MmPageBatchFlush(&freed);
+    MmTlbBatchFlush(&batch);
+
+    for (u32 i = 0; i < count; i++)
+        MmiFreeKernelRange((uptr(pages[i]) - KERNEL_SPACE_START) / PAGE_SIZE, 1);
+
+    PzReleaseSpinlock(&MmVirtualLock);
+}
+
+void *MmiReserveKernelRange(u32 pages)
+{
+    PzAcquireSpinlock(&MmVirtualLock);
+    int index = MmiClaimKernelRange(nullptr, pages);
+    PzReleaseSpinlock(&MmVirtualLock);
+
+    return index == -1 ? nullptr : KM_PAGE_INDEX_TO_ADDR(index);
+}
+
+void MmiReleaseKernelRange(void *start, u32 pages)
+{
+    int index = (uptr(start) - KERNEL_SPACE_START) / PAGE_SIZE;
+    PzTlbBatch batch;
+    PzPageBatch freed;
+
+    PzAcquireSpinlock(&MmVirtualLock);
+    MmiRefillKvaDescriptors();
+    MmTlbBatchInitialize(&batch);
+    MmPageBatchInitialize(&freed, &batch);
+    MmiDemoteLargePages(&batch, index, pages);
+
+    /* Unlike MmVirtualFreeMemory, this tolerates holes in the range */
+    for (u32 i = 0; i < pages; i++) {
+        uptr &old = PT_VIRT_BASE[index + i];
+        uptr frame = old;
+
+        if (!(frame & PDE_X86_PRESENT))
+            continue;
 
         old = 0;
-        HalFlushCacheForPage(KM_PAGE_INDEX_TO_ADDR(index + i));
+        MmTlbBatchAdd(&batch, KM_PAGE_INDEX_TO_ADDR(index + i));
+
+        if (((frame >> PDE_X86_FREE_BIT) & 7) == PAGE_X86_ALLOCATED)
+            MmPageBatchAdd(&freed, frame & -PAGE_SIZE);
     }
 
+    MmPageBatchFlush(&freed);
+    MmTlbBatchFlush(&batch);
+    MmiFreeKernelRange(index, pages);
     PzReleaseSpinlock(&MmVirtualLock);
+}
+
+void *MmiAllocateKernelStack(u32 bytes)
+{
+    int pages = PAGES_IN(bytes);
+
+    PzAcquireSpinlock(&MmVirtualLock);
+    int index = MmiClaimKernelRange(nullptr, pages + 1);
+
+    if (index == -1) {
+        PzReleaseSpinlock(&MmVirtualLock);
+        return nullptr;
+    }
+
+    /* The lowest page stays unmapped, so that overflowing the stack
+       faults instead of overwriting whatever lies below it */
+    if (!MmPhysicalAllocatePages(0, pages, &PT_VIRT_BASE[index + 1])) {
+        MemSet(&PT_VIRT_BASE[index + 1], 0, pages * sizeof(uptr));
+        MmiFreeKernelRange(index, pages + 1);
+        PzReleaseSpinlock(&MmVirtualLock);
+        return nullptr;
+    }
+
+    for (int i = 1; i <= pages; i++)
+        PT_VIRT_BASE[index + i] |=
+            PAGE_X86_ALLOCATED << PDE_X86_FREE_BIT |
+            KernelHalfPtFlags(PAGE_READWRITE);
+
+    PzReleaseSpinlock(&MmVirtualLock);
+    return KM_PAGE_INDEX_TO_ADDR(index + 1);
+}
+
+void MmiFreeKernelStack(void *stack, u32 bytes)
+{
+    MmiReleaseKernelRange((u8 *)stack - PAGE_SIZE, PAGES_IN(bytes) + 1);
+}
+
+bool MmiMapForeignPage(PzProcessObject *process, void *address, uptr physical, u32 flags)
+{
+    uptr addr = uptr(address);
+
+    if (addr >= KERNEL_SPACE_START) {
+        PzAcquireSpinlock(&MmVirtualLock);
+        uptr &entry = PT_VIRT_BASE[(addr - KERNEL_SPACE_START) / PAGE_SIZE];
+
+        if (!(entry & PDE_X86_PRESENT))
+            entry = physical | KernelHalfPtFlags(flags);
+
+        PzReleaseSpinlock(&MmVirtualLock);
+        return true;
+    }
+
+    int index = addr / PAGE_SIZE;
+    uptr *&table = process->VirtualPageDirectory[index >> 10];
+
+    if (!table) {
+        table = (uptr *)MmVirtualAllocateMemory(nullptr,
+            PAGE_SIZE, PAGE_READWRITE, (uptr *)&process->PhysicalPageDirectory[index >> 10]);
+
+        if (!table)
+            return false;
+
+        MemSet(table, 0, PAGE_SIZE);
+        *(uptr *)&process->PhysicalPageDirectory[index >> 10] |= PDE_X86_READWRITE | PDE_X86_USER | PDE_X86_PRESENT;
+    }
+
+    /* Another thread may have resolved a fault on the same page meanwhile */
+    if (!(table[index & 0x3FF] & PDE_X86_PRESENT))
+        table[index & 0x3FF] = physical | PDE_X86_USER | KernelFlagsToPtFlags(flags);
+
     return true;
 }
 
+extern "C" u32 HalReadCr2();
+
+bool MmHandlePageFault(CpuInterruptState *state)
+{
+    uptr address = HalReadCr2();
+
+    /* Only faults on pages that are not there yet can be resolved */
+    if (state->ErrorCode & PF_ERROR_PRESENT)
+        return false;
+
+    /* Resolving a fault takes the region tree lock and allocates memory, which code running
+       with interrupts off or at DISPATCH_LEVEL may already hold the locks of. Filling in
+       views may also wait for the disk, which needs a thread that can block. */
+    if (!(state->Eflags & EFLAGS_IF) || PzGetCurrentIrql() >= DISPATCH_LEVEL)
+        return false;
+
+    if (MmiResolveStackFault(address))
+        return true;
+
+    PzEnableInterrupts();
+    bool resolved = MmiResolveViewFault(address, state->ErrorCode & PF_ERROR_WRITE);
+    PzDisableInterrupts();
+
+    return resolved;
+}
+
 uptr MmiVirtualToPhysical(void *page, PzProcessObject *process)
 {
     uptr p = (uptr)page;
@@ -296,6 +640,100 @@ uptr MmiVirtualToPhysical(void *page, PzProcessObject *process)
     return 0;
 }
 
+/* Adds `delta` to the lock count of every region overlapping [start, end) */
+static void MmiAdjustRegionLocks(PzVirtualRegionTree *tree, uptr start, uptr end, int delta)
+{
+    for (auto *node = MmRegionFindContaining(tree, start);
+        node && node->Value.Region.Start < end; node = tree->Tree.Next(node))
+        node->Value.Region.LockCount += delta;
+}
+
+/* Looks up the physical addresses of present pages starting at the page-aligned `start`.
+   Without a process, the pages lie in the kernel half. Otherwise they have to be covered
+   by regions of the process, which are locked so that they can't be freed, and then
+   the pages of the current process that are not there yet are faulted in. */
+bool MmiLockPages(PzProcessObject *process, uptr start, u32 pages, bool write, uptr *physical)
+{
+    uptr end = start + pages * PAGE_SIZE;
+    u32 required = PDE_X86_PRESENT | (write ? PDE_X86_READWRITE : 0);
+
+    if (!process) {
+        if (start < KERNEL_SPACE_START || end - 1 < start)
+            return false;
+
+        PzAcquireSpinlock(&MmVirtualLock);
+
+        for (u32 i = 0; i < pages; i++) {
+            uptr entry = PT_VIRT_BASE[(start - KERNEL_SPACE_START) / PAGE_SIZE + i];
+
+            if ((entry & required) != required) {
+                PzReleaseSpinlock(&MmVirtualLock);
+                return false;
+            }
+
+            physical[i] = entry & -PAGE_SIZE;
+        }
+
+        PzReleaseSpinlock(&MmVirtualLock);
+        return true;
+    }
+
+    if (end > KERNEL_SPACE_START || end <= start)
+        return false;
+
+    PzVirtualRegionTree *tree = &process->VirtualAllocations;
+    PzAcquireSpinlock(&tree->Spinlock);
+
+    PzVirtualRegionNode *node = MmRegionFindContaining(tree, start);
+
+    for (uptr covered = start; covered < end; node = tree->Tree.Next(node)) {
+        if (!node || node->Value.Region.Start > covered) {
+            PzReleaseSpinlock(&tree->Spinlock);
+            return false;
+        }
+
+        covered = node->Value.Region.End;
+    }
+
+    MmiAdjustRegionLocks(tree, start, end, 1);
+    PzReleaseSpinlock(&tree->Spinlock);
+
+    /* Views of files and stacks are filled in on access. Their regions can't go away
+       anymore, so the faults are taken without holding any lock. */
+    if (process == PsGetCurrentProcess() && !MmiFaultInUserPages(start, pages, write)) {
+        MmiUnlockPages(process, start, pages);
+        return false;
+    }
+
+    PzAcquireSpinlock(&tree->Spinlock);
+
+    for (u32 i = 0; i < pages; i++) {
+        uptr address = start + i * PAGE_SIZE;
+        uptr *table = process->VirtualPageDirectory[address >> 22];
+
+        if (!table || (table[address >> 12 & 0x3FF] & required) != required) {
+            MmiAdjustRegionLocks(tree, start, end, -1);
+            PzReleaseSpinlock(&tree->Spinlock);
+            return false;
+        }
+
+        physical[i] = table[address >> 12 & 0x3FF] & -PAGE_SIZE;
+    }
+
+    PzReleaseSpinlock(&tree->Spinlock);
+    return true;
+}
+
+void MmiUnlockPages(PzProcessObject *process, uptr start, u32 pages)
+{
+    uptr end = start + pages * PAGE_SIZE;
+    PzVirtualRegionTree *tree = &process->VirtualAllocations;
+
+    PzAcquireSpinlock(&tree->Spinlock);
+    MmiAdjustRegionLocks(tree, start, end, -1);
+    PzReleaseSpinlock(&tree->Spinlock);
+}
+
 uptr MmVirtualToPhysical(void *page, PzHandle process)
 {
     PzProcessObject *proc_obj = nullptr;
@@ -375,16 +813,30 @@ uptr **MmiAllocateProcessPageDirectory(PzProcessObject *process)
         return nullptr;
     }
 
+    /* The node is allocated here, as the heap cannot be used with MmVirtualLock held */
+    auto *registration = new LLNode<uptr **>();
+
+    if (!registration) {
+        MmVirtualFreeMemory(process->PhysicalPageDirectory, 1024 * sizeof(uptr));
+        MmVirtualFreeMemory(page_dir, 1024 * sizeof(uptr));
+        return nullptr;
+    }
+
+    registration->Value = process->PhysicalPageDirectory;
+
     for (int i = 0; i < 512; i++) {
         page_dir[i] = 0;
         process->PhysicalPageDirectory[i] = 0;
     }
 
-    for (int i = 0; i < 512; i++) {
+    PzAcquireSpinlock(&MmVirtualLock);
+
+    for (int i = 0; i < 512; i++)
         process->PhysicalPageDirectory[i + 512] =
-            page_dir[i + 512] = (uptr *)((uptr)KernelHalfPtBase + i * PAGE_SIZE
-                | PDE_X86_READWRITE | PDE_X86_PRESENT);
-    }
+            page_dir[i + 512] = (uptr *)KernelHalfPdes[i];
+
+    AddressSpaces.AddNode(registration);
+    PzReleaseSpinlock(&MmVirtualLock);
 
     return page_dir;
 }
@@ -394,139 +846,260 @@ void MmiFreeProcessPageDirectory(PzProcessObject *process)
     if (!process->PhysicalPageDirectory || !process->VirtualPageDirectory)
         return;
 
-    for (int i = 0; i < 512; i++)
-        if (process->VirtualPageDirectory[i])
-            MmVirtualFreeMemory(process->VirtualPageDirectory[i], PAGE_SIZE);
-
-    MmVirtualFreeMemory(process->VirtualPageDirectory, PAGE_SIZE);
-    MmVirtualFreeMemory(process->PhysicalPageDirectory, PAGE_SIZE);
-}
+    LLNode<uptr **> *registration = nullptr;
+    PzAcquireSpinlock(&MmVirtualLock);
 
-#include <core.hh>
+    ENUM_LIST(node, AddressSpaces) {
+        if (node->Value == process->PhysicalPageDirectory) {
+            registration = node;
+            AddressSpaces.Unlink(node);
+            break;
+        }
+    }
 
-void *MmiVirtualAllocateUserMemory(PzProcessObject *process, void *start, u32 bytes, u32 flags)
-{
-    PzSpinlock *lock = &process->VirtualAllocations.Spinlock;
-    PzAcquireSpinlock(lock);
+    PzReleaseSpinlock(&MmVirtualLock);
 
-    u32 **phys_page_dir = (u32 **)process->PhysicalPageDirectory;
-    u32 **virt_page_dir = (u32 **)process->VirtualPageDirectory;
-    uptr last_cave = 0x1000;
-    int index = -1;
+    if (registration)
+        delete registration;
 
-    LLNode<PzUserVirtualRegion> *insert_at = nullptr;
+    /* Nothing runs in the address space anymore, so once this processor stops using it,
+       none of its user translations can be reached again and no page needs invalidating */
+    if ((HalReadCr3() & -PAGE_SIZE) == process->Cr3)
+        HalSwitchPageTable((uptr)BootPageDir);
 
-    if (start == nullptr) {
-        auto *node = process->VirtualAllocations.First;
+    PzVirtualRegionTree *tree = &process->VirtualAllocations;
+    PzAcquireSpinlock(&tree->Spinlock);
 
-        for (; node; node = node->Next) {
-            if (last_cave + bytes <= node->Value.Start) {
-                index = last_cave / PAGE_SIZE;
-                break;
-            }
+    /* Regions are dropped without looking at their pages, which the walk below frees */
+    while (PzVirtualRegionNode *node = tree->Tree.First()) {
+        PzSection *section = node->Value.Region.Section;
+        MmRegionRemove(tree, node);
 
-            insert_at = node;
-            last_cave = node->Value.End;
+        if (section) {
+            PzReleaseSpinlock(&tree->Spinlock);
+            MmiDereferenceSection(section);
+            PzAcquireSpinlock(&tree->Spinlock);
         }
+    }
 
-        if (index == -1) {
-            if ((index = last_cave / PAGE_SIZE) >= 512 * 1024) {
-                PzReleaseSpinlock(lock);
-                return nullptr;
-            }
+    /* Queries only read page tables under the tree lock, so once the directories are detached
+       nothing can reach them. They are freed without the lock, as returning kernel pages takes
+       MmVirtualLock. */
+    uptr **page_dir = process->VirtualPageDirectory;
+    uptr **phys_page_dir = process->PhysicalPageDirectory;
+    process->VirtualPageDirectory = nullptr;
+    process->PhysicalPageDirectory = nullptr;
+    PzReleaseSpinlock(&tree->Spinlock);
+
+    /* Walk the user half once, returning the frames and then the page tables in batches */
+    void *tables[PAGE_BATCH_MAX_PAGES];
+    u32 table_count = 0;
+    /* Switching this processor off the address space above dropped all of its user translations */
+    PzPageBatch freed;
+    MmPageBatchInitialize(&freed, nullptr);
+
+    for (int i = 0; i < 512; i++) {
+        uptr *table = page_dir[i];
+
+        if (!table)
+            continue;
+
+        for (int j = 0; j < 1024; j++)
+            if (((table[j] >> PDE_X86_FREE_BIT) & 7) == PAGE_X86_ALLOCATED)
+                MmPageBatchAdd(&freed, table[j] & -PAGE_SIZE);
+
+        tables[table_count++] = table;
+
+        if (table_count == PAGE_BATCH_MAX_PAGES) {
+            MmPageBatchFlush(&freed);
+            MmiFreeKernelPageArray(tables, table_count);
+            table_count = 0;
         }
     }
-    else {
-        /* Allocating on non-page-aligned addresses or
-           above userspace is not allowed */
-        if (uptr(start) % PAGE_SIZE ||
-            uptr(start) > KERNEL_SPACE_START ||
-            uptr(start) + bytes > KERNEL_SPACE_START) {
-            PzReleaseSpinlock(lock);
-            return nullptr;
-        }
 
-        iptr min_dist = INT32_MAX;
-        bool first = true;
-
-        for (auto *node = process->VirtualAllocations.First;
-            node; node = node->Next, first = false) {
-            /* If any of the allocated ranges overlap with the range we want to
-               allocate, bail out */
-            if (OVERLAPPING(
-                (uptr)start, (uptr)start + bytes,
-                node->Value.Start, node->Value.End)) {
-                PzReleaseSpinlock(lock);
-                return nullptr;
-            }
+    MmPageBatchFlush(&freed);
+
+    tables[table_count++] = page_dir;
+    MmiFreeKernelPageArray(tables, table_count);
+    MmVirtualFreeMemory(phys_page_dir, PAGE_SIZE);
+}
 
-            /* Find an allocation with the minimum distance
-               to this one and insert after its node to keep list sorted */
+void MmiQueryProcessMemory(PzProcessObject *process, PzProcessMemoryInformation *info)
+{
+    *info = PzProcessMemoryInformation {};
+    PzVirtualRegionTree *tree = &process->VirtualAllocations;
+    PzAcquireSpinlock(&tree->Spinlock);
 
-            iptr dist = (iptr)start - node->Value.End;
+    if (!process->VirtualPageDirectory) {
+        PzReleaseSpinlock(&tree->Spinlock);
+        return;
+    }
 
-            /* If first node is higher than the end of this allocation,
-               then the entry will be prepended to the list */
-            if (first && (uptr)start + bytes < node->Value.Start) {
-                insert_at = nullptr;
+    for (auto *node = tree->Tree.First(); node; node = tree->Tree.Next(node))
+        info->ReservedPages += (node->Value.Region.End - node->Value.Region.Start) / PAGE_SIZE;
+
+    PzReleaseSpinlock(&tree->Spinlock);
+
+    /* Both the directory the processor walks and the one holding the tables' virtual addresses */
+    info->PageTablePages = 2;
+
+    /* Teardown detaches the directory under the tree lock before it frees any table, so every
+       table is counted with the lock held. Taking it a table at a time keeps faults and
+       allocations in the process from waiting behind the whole walk. */
+    for (int i = 0; i < 512; i++) {
+        PzAcquireSpinlock(&tree->Spinlock);
+
+        uptr **pd = process->VirtualPageDirectory;
+        uptr *table = pd ? pd[i] : nullptr;
+
+        if (!table) {
+            PzReleaseSpinlock(&tree->Spinlock);
+
+            if (!pd)
                 break;
-            }
-            else if (dist < min_dist) {
-                min_dist = dist;
-                insert_at = node;
-            }
+
+            continue;
         }
 
-        index = (uptr)start / PAGE_SIZE;
-    }
+        info->PageTablePages++;
 
-    void *base = (void*)(index * PAGE_SIZE);
+        for (int j = 0; j < 1024; j++) {
+            uptr entry = table[j];
 
-    auto *alloc_node = process->VirtualAllocations.Insert(insert_at,
-        PzUserVirtualRegion { (uptr)base, (uptr)base + ALIGN(bytes, PAGE_SIZE), 0 });
+            if (!(entry & PDE_X86_PRESENT))
+                continue;
 
-    if (!alloc_node) {
-        PzReleaseSpinlock(lock);
-        return nullptr;
+            info->ResidentPages++;
+
+            if (((entry >> PDE_X86_FREE_BIT) & 7) == PAGE_X86_ALLOCATED)
+                info->CommittedPages++;
+        }
+
+        PzReleaseSpinlock(&tree->Spinlock);
     }
+}
+
+#include <core.hh>
+
+/* Maps freshly allocated pages at [address, address + pages * PAGE_SIZE) in a process, where
+   nothing is mapped yet. Must be called with the process' region tree locked. On failure,
+   the pages mapped so far stay, to be freed along with the region. */
+static bool MmiCommitUserPages(PzProcessObject *process, uptr address, u32 pages, u32 flags)
+{
+    u32 **phys_page_dir = (u32 **)process->PhysicalPageDirectory;
+    u32 **virt_page_dir = (u32 **)process->VirtualPageDirectory;
 
-    for (int i = 0; i < PAGES_IN(bytes); i++, index++) {
+    /* Physical pages are allocated a page table at a time, straight into its entries */
+    while (pages) {
+        int index = address / PAGE_SIZE;
+        u32 count = Min(pages, 1024u - (index & 0x3FF));
         u32 *&dir_ent = virt_page_dir[index >> 10];
 
         if (!dir_ent) {
             dir_ent = (u32 *)MmVirtualAllocateMemory(nullptr,
                 1024 * sizeof(u32), PAGE_READWRITE, (u32 *)&phys_page_dir[index >> 10]);
 
-            if (!dir_ent) {
-                process->VirtualAllocations.Remove(alloc_node);
-                PzReleaseSpinlock(lock);
-                return nullptr;
-            }
+            if (!dir_ent)
+                return false;
 
             MemSet(dir_ent, 0, 1024 * sizeof(u32));
             *(u32 *)&phys_page_dir[index >> 10] |= PDE_X86_READWRITE | PDE_X86_USER | PDE_X86_PRESENT;
         }
 
-        uptr physical_page = (uptr)MmPhysicalAllocatePage(0);
+        u32 *entries = &dir_ent[index & 0x3FF];
+
+        if (!MmPhysicalAllocatePages(0, count, (uptr *)entries)) {
+            MemSet(entries, 0, count * sizeof(u32));
+            return false;
+        }
+
+        for (u32 i = 0; i < count; i++)
+            entries[i] |= PDE_X86_USER |
+                PAGE_X86_ALLOCATED << PDE_X86_FREE_BIT | KernelFlagsToPtFlags(flags);
+
+        address += count * PAGE_SIZE;
+        pages -= count;
+    }
 
-        if (!physical_page) {
-            /* TODO: make a proper revert routine */
-            process->VirtualAllocations.Remove(alloc_node);
+    return true;
+}
+
+void *MmiVirtualAllocateUserMemory(PzProcessObject *process, void *start, u32 bytes, u32 flags)
+{
+    PzSpinlock *lock = &process->VirtualAllocations.Spinlock;
+    PzAcquireSpinlock(lock);
+
+    uptr size = ALIGN(bytes, PAGE_SIZE);
+
+    if (!bytes || size < bytes) {
+        PzReleaseSpinlock(lock);
+        return nullptr;
+    }
+
+    if (start == nullptr) {
+        if (!(start = (void *)MmRegionFindGap(&process->VirtualAllocations, 0x1000, KERNEL_SPACE_START, size))) {
             PzReleaseSpinlock(lock);
             return nullptr;
         }
+    }
+    /* Allocating on non-page-aligned addresses or
+       above userspace is not allowed */
+    else if (uptr(start) % PAGE_SIZE ||
+        uptr(start) > KERNEL_SPACE_START ||
+        KERNEL_SPACE_START - uptr(start) < size) {
+        PzReleaseSpinlock(lock);
+        return nullptr;
+    }
 
-        dir_ent[index & 0x3FF] =
-            physical_page | PDE_X86_USER |
-            PAGE_X86_ALLOCATED << PDE_X86_FREE_BIT | KernelFlagsToPtFlags(flags);
+    void *base = start;
 
-        HalFlushCacheForPage((void *)(index << PAGE_SHIFT));
+    /* Fails if the range overlaps with any of the allocated ones */
+    auto *alloc_node = MmRegionInsert(&process->VirtualAllocations, uptr(base), uptr(base) + size, 0);
+
+    if (!alloc_node) {
+        PzReleaseSpinlock(lock);
+        return nullptr;
+    }
+
+    if (!MmiCommitUserPages(process, uptr(base), PAGES_IN(bytes), flags)) {
+        PzReleaseSpinlock(lock);
+        MmiVirtualFreeUserMemory(process, base, 0);
+        return nullptr;
     }
 
     PzReleaseSpinlock(lock);
     return base;
 }
 
+void *MmiReserveUserStack(PzProcessObject *process, u32 bytes, u32 committed)
+{
+    uptr size = ALIGN(bytes, PAGE_SIZE);
+    committed = ALIGN(committed, PAGE_SIZE);
+
+    /* There has to be room for the guard page below the committed part */
+    if (size < bytes || size < committed + PAGE_SIZE)
+        return nullptr;
+
+    PzSpinlock *lock = &process->VirtualAllocations.Spinlock;
+    PzAcquireSpinlock(lock);
+
+    uptr base = MmRegionFindGap(&process->VirtualAllocations, 0x1000, KERNEL_SPACE_START, size);
+
+    if (!base || !MmRegionInsert(&process->VirtualAllocations, base, base + size, REGION_STACK)) {
+        PzReleaseSpinlock(lock);
+        return nullptr;
+    }
+
+    if (!MmiCommitUserPages(process, base + size - committed, committed / PAGE_SIZE, PAGE_READWRITE)) {
+        PzReleaseSpinlock(lock);
+        MmiVirtualFreeUserMemory(process, (void *)base, 0);
+        return nullptr;
+    }
+
+    PzReleaseSpinlock(lock);
+    return (void *)base;
+}
+
 bool MmiVirtualFreeUserMemory(PzProcessObject *process, void *start, u32 flags)
 {
     if (!start)
@@ -535,32 +1108,51 @@ bool MmiVirtualFreeUserMemory(PzProcessObject *process, void *start, u32 flags)
     PzSpinlock *lock = &process->VirtualAllocations.Spinlock;
     PzAcquireSpinlock(lock);
 
-    for (auto *node = process->VirtualAllocations.First;
-        node; node = node->Next) {
-        uptr **phys_page_dir = (uptr **)process->PhysicalPageDirectory;
-        uptr **virt_page_dir = (uptr **)process->VirtualPageDirectory;
+    auto *node = MmRegionFind(&process->VirtualAllocations, uptr(start));
 
-        uptr istart = uptr(start);
+    /* Regions that devices are transferring to or from stay until the transfer is done */
+    if (!node || node->Value.Region.LockCount) {
+        PzReleaseSpinlock(lock);
+        return false;
+    }
 
-        if (node->Value.Start == istart) {
-            for (; istart < node->Value.End; istart += PAGE_SIZE) {
-                uptr &entry = virt_page_dir[istart >> 22][istart >> 12 & 0x3FF];
+    uptr **virt_page_dir = (uptr **)process->VirtualPageDirectory;
+    uptr end = node->Value.Region.End;
+    PzSection *section = node->Value.Region.Section;
+    PzTlbBatch batch;
+    PzPageBatch freed;
+    MmTlbBatchInitialize(&batch);
+    MmPageBatchInitialize(&freed, &batch);
 
-                if (((entry >> PDE_X86_FREE_BIT) & 7) == PAGE_X86_ALLOCATED)
-                    MmPhysicalFreePages(entry & -PAGE_SIZE, 0, 1);
+    for (uptr istart = uptr(start); istart < end; istart += PAGE_SIZE) {
+        /* Views only get page tables for the pages that were touched */
+        if (!virt_page_dir[istart >> 22])
+            continue;
 
-                HalFlushCacheForPage((void *)entry);
-                entry = 0;
-            }
+        uptr &entry = virt_page_dir[istart >> 22][istart >> 12 & 0x3FF];
+        uptr frame = entry;
 
-            process->VirtualAllocations.Remove(node);
-            PzReleaseSpinlock(lock);
-            return true;
-        }
+        if (!(frame & PDE_X86_PRESENT))
+            continue;
+
+        entry = 0;
+        MmTlbBatchAdd(&batch, (void *)istart);
+
+        if (((frame >> PDE_X86_FREE_BIT) & 7) == PAGE_X86_ALLOCATED)
+            MmPageBatchAdd(&freed, frame & -PAGE_SIZE);
     }
 
+    MmPageBatchFlush(&freed);
+    MmTlbBatchFlush(&batch);
+
+    MmRegionRemove(&process->VirtualAllocations, node);
     PzReleaseSpinlock(lock);
-    return false;
+
+    /* Freeing the section may free its pages, so the lock is not held for that */
+    if (section)
+        MmiDereferenceSection(section);
+
+    return true;
 }
 
 bool MmiVirtualProtectUserMemory(PzProcessObject *process, void *start, u32 bytes, u32 flags)
@@ -574,10 +1166,18 @@ bool MmiVirtualProtectUserMemory(PzProcessObject *process, void *start, u32 byte
     uptr **virt_page_dir = (uptr **)process->VirtualPageDirectory;
     uptr end_ptr = ALIGN((uptr)start + bytes, PAGE_SIZE);
 
+    /* Pages of views are shared with other mappers of the file, so they stay read-only */
+    auto *node = MmRegionFindContaining(&process->VirtualAllocations, uptr(start));
+
+    if (node && node->Value.Region.Flags & REGION_FILE_VIEW) {
+        PzReleaseSpinlock(lock);
+        return false;
+    }
+
     #define ENTRY virt_page_dir[start_ptr >> 22][start_ptr >> 12 & 0x3FF]
 
     for (uptr start_ptr = (uptr)start; start_ptr < end_ptr; start_ptr += PAGE_SIZE) {
-        if (!(ENTRY & PDE_X86_PRESENT)) {
+        if (!virt_page_dir[start_ptr >> 22] || !(ENTRY & PDE_X86_PRESENT)) {
             PzReleaseSpinlock(lock);
             return false;
         }
@@ -591,6 +1191,11 @@ bool MmiVirtualProtectUserMemory(PzProcessObject *process, void *start, u32 byte
 
     #undef ENTRY
 
+    PzTlbBatch batch;
+    MmTlbBatchInitialize(&batch);
+    MmTlbBatchAddRange(&batch, start, PAGES_IN(end_ptr - (uptr)start));
+    MmTlbBatchFlush(&batch);
+
     PzReleaseSpinlock(lock);
     return true;
 }
@@ -659,6 +1264,14 @@ bool MmVirtualProbeKernelMemory(uptr start, usize size, bool write)
     return true;
 }
 
+bool MmiIsKernelPageMapped(uptr address)
+{
+    /* The kernel half's page tables are never freed, so its entries can always be read */
+    return address >= KERNEL_SPACE_START &&
+        __atomic_load_n(&PT_VIRT_BASE[(address - KERNEL_SPACE_START) >> PAGE_SHIFT],
+            __ATOMIC_RELAXED) & PDE_X86_PRESENT;
+}
+
 bool MmVirtualProbeMemory(bool as_user, uptr start, usize size, bool write)
 {
     if (start >= KERNEL_SPACE_START)
@@ -676,7 +1289,17 @@ bool MmVirtualProbeMemory(bool as_user, uptr start, usize size, bool write)
     PzAcquireSpinlock(lock);
 
     for (; start < end; start += PAGE_SIZE) {
-        uptr flags = pd[start >> 22][start >> 12 & 0x3FF];
+        uptr flags = pd[start >> 22] ? pd[start >> 22][start >> 12 & 0x3FF] : 0;
+
+        /* Views are readable before their pages have been filled in, and stacks grow on access */
+        if (!(flags & PDE_X86_PRESENT)) {
+            auto *node = MmRegionFindContaining(&process->VirtualAllocations, start);
+            PzUserVirtualRegion *region = node ? &node->Value.Region : nullptr;
+
+            if (region && !write && region->Flags & REGION_FILE_VIEW ||
+                region && region->Flags & REGION_STACK && start >= region->Start + PAGE_SIZE)
+                continue;
+        }
 
         if (!(flags & PDE_X86_PRESENT)         ||
             as_user && !(flags & PDE_X86_USER) ||
@@ -688,4 +1311,38 @@ bool MmVirtualProbeMemory(bool as_user, uptr start, usize size, bool write)
 
     PzReleaseSpinlock(lock);
     return true;
+}
+
+bool MmiResolveStackFault(uptr address)
+{
+    PzProcessObject *process = PsGetCurrentProcess();
+
+    if (address >= KERNEL_SPACE_START || !process)
+        return false;
+
+    PzSpinlock *lock = &process->VirtualAllocations.Spinlock;
+    PzAcquireSpinlock(lock);
+
+    auto *node = MmRegionFindContaining(&process->VirtualAllocations, address);
+
+    /* Faults on the lowest page of a stack are overflows, which are left to the exception handler */
+    if (!node || !(node->Value.Region.Flags & REGION_STACK) ||
+        address < node->Value.Region.Start + PAGE_SIZE) {
+        PzReleaseSpinlock(lock);
+        return false;
+    }
+
+    /* Commit everything up to the pages already in use, so that
+       frames larger than a page don't leave holes in the stack */
+    uptr **pd = process->VirtualPageDirectory;
+    uptr start = address & -PAGE_SIZE, end = start;
+
+    while (end < node->Value.Region.End &&
+        !(pd[end >> 22] && pd[end >> 22][end >> 12 & 0x3FF] & PDE_X86_PRESENT))
+        end += PAGE_SIZE;
+
+    bool resolved = MmiCommitUserPages(process, start, (end - start) / PAGE_SIZE, PAGE_READWRITE);
+
+    PzReleaseSpinlock(lock);
+    return resolved;
 }
\ No newline at end of file
@@ -11,6 +11,9 @@
 void PzPanic(CpuInterruptState *state, u32 reason, const char *error, ...)
 {
     PzDisableInterrupts();
+
+    /* Get out whatever was logged before the panic */
+    DbgFlushLog();
     DbgWrite32(EVENT_KERNEL_PANIC);
     DbgWrite32(reason);
     DbgWrite32(!!state);
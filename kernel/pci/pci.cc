@@ -1,8 +1,11 @@
 #include <pci/pci.hh>
 #include <debug.hh>
 #include <core.hh>
+#include <sched/rwlock.hh>
 
 LinkedList<PciDevice> PciConnectedDevices;
+/* Drivers look devices up far more often than the buses are scanned */
+static PzRwSpinlock PciDevicesLock;
 PzSpinlock PciLock;
 constexpr u16 PciAddr = 0xCF8;
 constexpr u16 PciData = 0xCFC;
@@ -107,8 +110,16 @@ void ScanFunction(u8 bus, u8 slot, u8 func)
         "(bus%i, dev%i, slot%i) PCI device detected: vendor 0x%04x device 0x%04x class %02x subclass %02x\r\n",
         bus, slot, func, vendor_id, device_id, base, subclass);
 
-    PciConnectedDevices.Add(
-        PciDevice(bus, slot, func, vendor_id, device_id, base, subclass));
+    auto *node = new LLNode<PciDevice>();
+
+    if (!node)
+        return;
+
+    node->Value = PciDevice(bus, slot, func, vendor_id, device_id, base, subclass);
+
+    int irql = PzAcquireRwSpinlockExclusive(&PciDevicesLock);
+    PciConnectedDevices.AddNode(node);
+    PzReleaseRwSpinlockExclusive(&PciDevicesLock, irql);
 }
 
 void ScanDevice(u8 bus, u8 slot)
@@ -135,28 +146,36 @@ void ScanBus(u8 bus)
 
 bool PciLocateDevice(u16 vendor, u16 device, PciDevice *dev)
 {
-    LLNode<PciDevice> *node = PciConnectedDevices.First;
+    int irql = PzAcquireRwSpinlockShared(&PciDevicesLock);
+    bool found = false;
 
-    do {
+    ENUM_LIST(node, PciConnectedDevices) {
         if (node->Value.VendorID == vendor && node->Value.DeviceID == device) {
             *dev = node->Value;
-            return true;
+            found = true;
+            break;
         }
-    } while (node = node->Next);
+    }
 
-    return false;
+    PzReleaseRwSpinlockShared(&PciDevicesLock, irql);
+    return found;
 }
 
 bool PciLocateDeviceByClass(u8 base, u8 subclass, PciDevice *dev)
 {
+    int irql = PzAcquireRwSpinlockShared(&PciDevicesLock);
+    bool found = false;
+
     ENUM_LIST(node, PciConnectedDevices) {
         if (node->Value.BaseClass == base && node->Value.Subclass == subclass) {
             *dev = node->Value;
-            return true;
+            found = true;
+            break;
         }
     }
 
-    return false;
+    PzReleaseRwSpinlockShared(&PciDevicesLock, irql);
+    return found;
 }
 
 void PciScanAll()
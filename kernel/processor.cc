@@ -11,6 +11,16 @@ PzProcessor *PzGetCurrentProcessor()
     return &Placeholder;
 }
 
+int PzGetCurrentProcessorNumber()
+{
+    return 0;
+}
+
+PzProcessor *PzGetProcessor(int number)
+{
+    return number == 0 ? &Placeholder : nullptr;
+}
+
 int PzGetCurrentIrql()
 {
     return PzGetCurrentProcessor()->IntLevel;
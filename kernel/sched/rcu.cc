@@ -0,0 +1,183 @@
+#include <sched/rcu.hh>
+#include <sched/scheduler.hh>
+#include <processor.hh>
+#include <obj/manager.hh>
+#include <obj/event.hh>
+
+/* Callbacks waiting for the worker, most recently queued first */
+static PzRcuHead *volatile RcuCallbacks;
+
+/* Signaled by PzCallRcu to wake the worker, and by the tick ending a grace period.
+   Both are set through their objects, as callbacks are queued at any IRQL. */
+static PzHandle RcuQueueEvent, RcuGraceEvent;
+static PzEventObject *RcuQueueEventObj, *RcuGraceEventObj;
+
+/* Quiescent state counts of every processor when the current grace period began */
+static u32 RcuGraceSnapshot[MAX_PROCESSORS];
+static bool RcuGracePending;
+
+/* Sets an event from any context, which is all PsSetEvent does once it has the object */
+static inline void SignalEvent(PzEventObject *event)
+{
+    __atomic_store_n(&event->Signaled, true, __ATOMIC_RELEASE);
+}
+
+int PzRcuReadLock()
+{
+    int irql = PzGetCurrentIrql();
+
+    if (irql < DISPATCH_LEVEL)
+        PzRaiseIrql(DISPATCH_LEVEL);
+
+    return irql;
+}
+
+void PzRcuReadUnlock(int irql)
+{
+    PzLowerIrql(irql);
+}
+
+void SchRcuQuiescentState()
+{
+    __atomic_fetch_add(&PzGetCurrentProcessor()->Queue.QuiescentStates, 1, __ATOMIC_RELEASE);
+
+    if (!__atomic_load_n(&RcuGracePending, __ATOMIC_ACQUIRE))
+        return;
+
+    for (int i = 0; i < MAX_PROCESSORS; i++)
+        if (__atomic_load_n(&PzGetProcessor(i)->Queue.QuiescentStates, __ATOMIC_ACQUIRE) ==
+            RcuGraceSnapshot[i])
+            return;
+
+    /* Only the first processor to see the grace period end wakes the worker */
+    bool pending = true;
+
+    if (__atomic_compare_exchange_n(&RcuGracePending, &pending, false,
+        false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        SignalEvent(RcuGraceEventObj);
+}
+
+/* Blocks the worker until every processor has passed a quiescent state */
+static void RcuWaitForGracePeriod()
+{
+    PsResetEvent(RcuGraceEvent);
+
+    for (int i = 0; i < MAX_PROCESSORS; i++)
+        RcuGraceSnapshot[i] = __atomic_load_n(&PzGetProcessor(i)->Queue.QuiescentStates, __ATOMIC_ACQUIRE);
+
+    __atomic_store_n(&RcuGracePending, true, __ATOMIC_RELEASE);
+    PsWaitForObject(RcuGraceEvent);
+}
+
+/* Queued by PzSynchronizeRcu, which waits until the worker gets to it */
+struct RcuWaiter
+{
+    PzRcuHead Head;
+    PzEventObject *Done;
+};
+
+static void RcuWakeWaiter(PzRcuHead *head)
+{
+    SignalEvent(((RcuWaiter *)head)->Done);
+}
+
+PzStatus PzSynchronizeRcu()
+{
+    if (!__atomic_load_n(&RcuQueueEventObj, __ATOMIC_ACQUIRE))
+        return STATUS_FAILED;
+
+    PzHandle event;
+    RcuWaiter waiter;
+
+    if (PzStatus status = PsCreateEvent(&event, PZ_KPROC, nullptr))
+        return status;
+
+    if (PsResetEvent(event) != STATUS_SUCCESS ||
+        !ObReferenceObjectByHandle(PZ_OBJECT_EVENT, nullptr, event, (ObPointer *)&waiter.Done)) {
+        ObCloseHandle(event);
+        return STATUS_FAILED;
+    }
+
+    PzCallRcu(&waiter.Head, RcuWakeWaiter);
+    PsWaitForObject(event);
+
+    ObDereferenceObject(waiter.Done);
+    ObCloseHandle(event);
+    return STATUS_SUCCESS;
+}
+
+void PzCallRcu(PzRcuHead *head, void (*callback)(PzRcuHead *head))
+{
+    PzRcuHead *first = __atomic_load_n(&RcuCallbacks, __ATOMIC_RELAXED);
+    head->Callback = callback;
+
+    do
+        head->Next = first;
+    while (!__atomic_compare_exchange_n(&RcuCallbacks, &first, head,
+        true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    if (PzEventObject *event = __atomic_load_n(&RcuQueueEventObj, __ATOMIC_ACQUIRE))
+        SignalEvent(event);
+}
+
+static int SchRcuWorker(void *param)
+{
+    for (;;) {
+        /* Resetting before taking the list lets callbacks queued meanwhile wake it again */
+        PsWaitForObject(RcuQueueEvent);
+        PsResetEvent(RcuQueueEvent);
+
+        /* Everything taken here was unpublished before the grace period starts */
+        PzRcuHead *head = __atomic_exchange_n(&RcuCallbacks, nullptr, __ATOMIC_ACQUIRE);
+
+        if (!head)
+            continue;
+
+        RcuWaitForGracePeriod();
+
+        while (head) {
+            PzRcuHead *next = head->Next;
+            head->Callback(head);
+            head = next;
+        }
+    }
+
+    return 0;
+}
+
+/* Creates a reset event along with a pointer to its object, for setting it from any context */
+static bool CreateSignalableEvent(PzHandle *handle, PzEventObject **object)
+{
+    if (PsCreateEvent(handle, PZ_KPROC, nullptr) != STATUS_SUCCESS)
+        return false;
+
+    if (PsResetEvent(*handle) != STATUS_SUCCESS ||
+        !ObReferenceObjectByHandle(PZ_OBJECT_EVENT, nullptr, *handle, (ObPointer *)object)) {
+        ObCloseHandle(*handle);
+        return false;
+    }
+
+    return true;
+}
+
+PzStatus SchStartRcuWorker()
+{
+    PzHandle handle;
+    PzEventObject *queue_event;
+
+    /* Without a worker callbacks just stay queued, and PzSynchronizeRcu fails */
+    if (!CreateSignalableEvent(&RcuGraceEvent, &RcuGraceEventObj) ||
+        !CreateSignalableEvent(&RcuQueueEvent, &queue_event))
+        return STATUS_ALLOCATION_FAILED;
+
+    if (PzStatus status = PsCreateThread(&handle, false, 0, SchRcuWorker, nullptr, 0, THREAD_PRIORITY_LOW)) {
+        ObDereferenceObject(queue_event);
+        ObCloseHandle(RcuQueueEvent);
+        return status;
+    }
+
+    /* Callbacks queued before now are picked up by the worker's first wait */
+    __atomic_store_n(&RcuQueueEventObj, queue_event, __ATOMIC_RELEASE);
+    SignalEvent(queue_event);
+    return STATUS_SUCCESS;
+}
\ No newline at end of file
@@ -0,0 +1,145 @@
+#include <sched/rwlock.hh>
+#include <spinlock.hh>
+#include <processor.hh>
+#include <sched/scheduler.hh>
+#include <obj/manager.hh>
+#include <x86/cpu.hh>
+#include <lib/util.hh>
+
+static bool TryAcquireShared(u32 *state)
+{
+    u32 old = __atomic_load_n(state, __ATOMIC_RELAXED);
+
+    return !(old & (RWLOCK_EXCLUSIVE | RWLOCK_WRITER_WAITING)) &&
+        __atomic_compare_exchange_n(state, &old, old + 1,
+            false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+/* Takes the lock once all readers are gone, announcing the writer otherwise */
+static bool TryAcquireExclusive(u32 *state)
+{
+    u32 old = __atomic_load_n(state, __ATOMIC_RELAXED);
+
+    if (old & (RWLOCK_EXCLUSIVE | RWLOCK_READERS)) {
+        if (!(old & RWLOCK_WRITER_WAITING))
+            __atomic_fetch_or(state, RWLOCK_WRITER_WAITING, __ATOMIC_RELAXED);
+
+        return false;
+    }
+
+    /* Clearing the waiting bit is fine, since other waiting writers set it again */
+    return __atomic_compare_exchange_n(state, &old, RWLOCK_EXCLUSIVE,
+        false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static void Backoff(u32 *pauses)
+{
+    for (u32 i = 0; i < *pauses; i++)
+        HalPause();
+
+    *pauses = Min<u32>(*pauses * 2, SPINLOCK_BACKOFF_MAX);
+}
+
+static int RaiseToDispatch()
+{
+    int irql = PzGetCurrentIrql();
+
+    if (irql < DISPATCH_LEVEL)
+        PzRaiseIrql(DISPATCH_LEVEL);
+
+    return irql;
+}
+
+int PzAcquireRwSpinlockShared(PzRwSpinlock *lock)
+{
+    int irql = RaiseToDispatch();
+
+    for (u32 pauses = 1; !TryAcquireShared(&lock->State);)
+        Backoff(&pauses);
+
+    return irql;
+}
+
+void PzReleaseRwSpinlockShared(PzRwSpinlock *lock, int irql)
+{
+    __atomic_fetch_sub(&lock->State, 1, __ATOMIC_RELEASE);
+    PzLowerIrql(irql);
+}
+
+int PzAcquireRwSpinlockExclusive(PzRwSpinlock *lock)
+{
+    int irql = RaiseToDispatch();
+
+    for (u32 pauses = 1; !TryAcquireExclusive(&lock->State);)
+        Backoff(&pauses);
+
+    return irql;
+}
+
+void PzReleaseRwSpinlockExclusive(PzRwSpinlock *lock, int irql)
+{
+    /* Keep the waiting bit a writer may have set in the meantime */
+    __atomic_fetch_and(&lock->State, ~RWLOCK_EXCLUSIVE, __ATOMIC_RELEASE);
+    PzLowerIrql(irql);
+}
+
+PzStatus PzInitializePushlock(PzPushlock *lock)
+{
+    lock->State = 0;
+    lock->Waiters = 0;
+
+    /* A semaphore counts wakeups, so none is lost to a waiter that hasn't blocked yet */
+    return PsCreateSemaphore(&lock->Semaphore, PZ_KPROC, nullptr);
+}
+
+void PzDeletePushlock(PzPushlock *lock)
+{
+    ObCloseHandle(lock->Semaphore);
+}
+
+/* Takes a pushlock with `try_acquire`, blocking for as long as that fails. A waiter is
+   counted before it tries, so either the release it waits for sees it and raises the
+   semaphore for it, or the release came first and the try sees the lock let go. */
+static void AcquirePushlock(PzPushlock *lock, bool (*try_acquire)(u32 *state))
+{
+    if (try_acquire(&lock->State))
+        return;
+
+    __atomic_fetch_add(&lock->Waiters, 1, __ATOMIC_SEQ_CST);
+
+    while (!try_acquire(&lock->State))
+        PsWaitForObject(lock->Semaphore);
+
+    __atomic_fetch_sub(&lock->Waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+/* Wakes every waiter to try again, once the lock's state no longer holds them off.
+   Wakeups left over by waiters that got in without blocking only cause a retry. */
+static void WakePushlockWaiters(PzPushlock *lock)
+{
+    if (u32 waiters = __atomic_load_n(&lock->Waiters, __ATOMIC_SEQ_CST))
+        PsReleaseSemaphore(lock->Semaphore, waiters);
+}
+
+void PzAcquirePushlockShared(PzPushlock *lock)
+{
+    AcquirePushlock(lock, TryAcquireShared);
+}
+
+void PzReleasePushlockShared(PzPushlock *lock)
+{
+    /* Readers only hold off a writer, which only the last one out can let in */
+    if (!(__atomic_sub_fetch(&lock->State, 1, __ATOMIC_SEQ_CST) & RWLOCK_READERS))
+        WakePushlockWaiters(lock);
+}
+
+void PzAcquirePushlockExclusive(PzPushlock *lock)
+{
+    AcquirePushlock(lock, TryAcquireExclusive);
+}
+
+void PzReleasePushlockExclusive(PzPushlock *lock)
+{
+    __atomic_fetch_and(&lock->State, ~RWLOCK_EXCLUSIVE, __ATOMIC_SEQ_CST);
+    WakePushlockWaiters(lock);
+}
\ No newline at end of file
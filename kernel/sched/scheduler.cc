@@ -1,4 +1,5 @@
 #include <sched/scheduler.hh>
+#include <sched/rcu.hh>
 #include <obj/process.hh>
 #include <lib/list.hh>
 #include <lib/util.hh>
@@ -458,9 +459,10 @@ PzStatus CreateNamedObjectAndHandle(
 {
     ObPointer obj;
 
+    /* The object keeps its name, so give it a copy that outlives the caller's */
     if (name ?
         !ObCreateNamedObject(ObGetObjectDirectory(obj_type),
-        (ObPointer *)&obj, obj_type, name, 0, false) :
+        (ObPointer *)&obj, obj_type, PzDuplicateString(name), 0, false) :
         !ObCreateUnnamedObject(ObGetObjectDirectory(obj_type),
             (ObPointer *)&obj, obj_type, 0, false))
         return STATUS_FAILED;
@@ -604,8 +606,15 @@ PzStatus PsCreateThread(
 {
     PzProcessObject *process_obj;
 
+    if (stack_size < 0)
+        return STATUS_INVALID_ARGUMENT;
+
     if (stack_size == 0)
-        stack_size = DEFAULT_THREAD_STACK_SIZE;
+        stack_size = usermode ? DEFAULT_USER_STACK_SIZE : DEFAULT_THREAD_STACK_SIZE;
+
+    /* Leave room for the committed top of a user stack and the guard page below it */
+    if (usermode)
+        stack_size = Max(ALIGN(stack_size, PAGE_SIZE), USER_STACK_COMMIT_SIZE + PAGE_SIZE);
 
     if (usermode) {
         if (!parent_process)
@@ -624,10 +633,7 @@ PzStatus PsCreateThread(
         return STATUS_ALLOCATION_FAILED;
     }
 
-    void *kstack = usermode ?
-        MmVirtualAllocateMemory(
-            nullptr, KERNEL_CALL_STACK_SIZE, PAGE_READWRITE, nullptr) :
-        nullptr;
+    void *kstack = usermode ? MmiAllocateKernelStack(KERNEL_CALL_STACK_SIZE) : nullptr;
 
     if (usermode && !kstack) {
         MmVirtualFreeMemory(fx_region, 512);
@@ -635,14 +641,15 @@ PzStatus PsCreateThread(
         return STATUS_ALLOCATION_FAILED;
     }
 
+    /* Kernel stacks can't grow, since the fault would have nowhere to push its frame */
     void *ustack =
         usermode ?
-        MmVirtualAllocateUserMemory(parent_process, nullptr, stack_size, PAGE_READWRITE) :
-        MmVirtualAllocateMemory(nullptr, stack_size, PAGE_READWRITE, nullptr);
+        MmiReserveUserStack(process_obj, stack_size, USER_STACK_COMMIT_SIZE) :
+        MmiAllocateKernelStack(stack_size);
 
     if (!ustack) {
         if (usermode)
-            MmVirtualFreeMemory(kstack, KERNEL_CALL_STACK_SIZE);
+            MmiFreeKernelStack(kstack, KERNEL_CALL_STACK_SIZE);
 
         MmVirtualFreeMemory(fx_region, 512);
         ObDereferenceObject(process_obj);
@@ -654,14 +661,14 @@ PzStatus PsCreateThread(
         (ObPointer *)&thread, PZ_OBJECT_THREAD, 0, false)) {
 
         if (usermode)
-            MmVirtualFreeUserMemory(parent_process, ustack, 0);
+            MmiVirtualFreeUserMemory(process_obj, ustack, 0);
         else
-            MmVirtualFreeMemory(ustack, stack_size);
+            MmiFreeKernelStack(ustack, stack_size);
 
         MmVirtualFreeMemory(fx_region, 512);
 
         if (usermode)
-            MmVirtualFreeMemory(kstack, KERNEL_CALL_STACK_SIZE);
+            MmiFreeKernelStack(kstack, KERNEL_CALL_STACK_SIZE);
 
         ObDereferenceObject(process_obj);
         return STATUS_FAILED;
@@ -828,6 +835,9 @@ void PsSetLogScheduler(bool log)
 
 void SchSwitchTask(CpuInterruptState *state)
 {
+    /* Ticks are only delivered at PASSIVE_LEVEL, so the interrupted thread can't be an RCU reader */
+    SchRcuQuiescentState();
+
     if (!CURRENT_QUEUE.SoftwareInducedTick) {
         ENUM_LIST(tn, CURRENT_QUEUE.ActiveTimers) {
             if ((tn->Value->TimeLeft -= 10) <= 0) {
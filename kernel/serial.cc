@@ -3,9 +3,11 @@
 #include <stdarg.h>
 #include <lib/strformat.hh>
 #include <debug.hh>
-
-const int Ports[] = { 0x3F8, 0x2F8, 0x3E8, 0x2E8 }; // COM1-4
-volatile static int ComPort;
+#include <core.hh>
+#include <processor.hh>
+#include <io/manager.hh>
+#include <x86/cpu.hh>
+#include <lib/util.hh>
 
 #define SERIAL_BASE_BAUD 115200
 
@@ -31,54 +33,316 @@ volatile static int ComPort;
 
 #define LINE_CTRL_DLAB    (1 << 7)
 
-void SerialSetRate(int baud)
+#define INT_ENABLE_RECEIVED    (1 << 0)
+#define INT_ENABLE_TRANSMIT    (1 << 1)
+#define INT_ENABLE_LINE_STATUS (1 << 2)
+
+#define INT_IDENT_NONE         (1 << 0)
+#define INT_IDENT_MASK         0x0E
+#define INT_IDENT_MODEM        0x00
+#define INT_IDENT_TRANSMIT     0x02
+#define INT_IDENT_RECEIVED     0x04
+#define INT_IDENT_LINE_STATUS  0x06
+#define INT_IDENT_TIMEOUT      0x0C
+
+/* Bytes the transmitter FIFO of a 16550 holds */
+#define SERIAL_FIFO_SIZE 16
+/* Size of the transmit and receive rings of every port, a power of two */
+#define SERIAL_RING_SIZE 4096
+/* Bytes moved between a ring and the caller's buffer per hold of the lock. The caller's
+   buffer may be pageable memory, so it is only touched with interrupts enabled. */
+#define SERIAL_CHUNK_SIZE 64
+
+struct SerialRing
+{
+    volatile u32 Head, Tail;
+    u8 Data[SERIAL_RING_SIZE];
+};
+
+/*
+    State of a COM port. Once its interrupt handler is installed, writers queue
+    bytes in the transmit ring and the handler refills the FIFO 16 bytes at a time
+    whenever it runs empty, while received bytes are queued in the receive ring.
+    Everything is serialized by Lock, always taken with interrupts disabled.
+    With interrupts disabled to begin with, the port is polled instead.
+*/
+struct SerialPort
+{
+    u16 Base;
+    u8 Irq;
+    bool Present, InterruptDriven;
+    /* Whether the FIFO is being emptied, so that an interrupt will ask for more */
+    volatile bool Transmitting;
+    u32 ReceiveOverruns;
+    PzSpinlock Lock;
+    SerialRing Transmit, Receive;
+};
+
+static SerialPort Ports[SERIAL_PORT_COUNT] = {
+    { 0x3F8, 4 }, { 0x2F8, 3 }, { 0x3E8, 4 }, { 0x2E8, 3 } // COM1-4
+};
+
+/* Port the debugger is attached to */
+static SerialPort *DebugPort = &Ports[0];
+
+static inline u32 RingCount(SerialRing *ring)
+{
+    return ring->Head - ring->Tail;
+}
+
+static inline void RingPush(SerialRing *ring, u8 value)
+{
+    ring->Data[ring->Head % SERIAL_RING_SIZE] = value;
+    ring->Head++;
+}
+
+static inline u8 RingPop(SerialRing *ring)
+{
+    return ring->Data[ring->Tail++ % SERIAL_RING_SIZE];
+}
+
+/* Disables interrupts and takes the port's lock, returning whether interrupts were enabled */
+static int SerialLock(SerialPort *port)
+{
+    int flag = PzReadIfFlag();
+    PzDisableInterrupts();
+    HalAcquireSpinlock(&port->Lock);
+    return flag;
+}
+
+static void SerialUnlock(SerialPort *port, int flag)
+{
+    HalReleaseSpinlock(&port->Lock);
+
+    if (flag)
+        PzEnableInterrupts();
+}
+
+/* Moves as many queued bytes as fit into an empty transmitter FIFO.
+   Must be called with the port locked. */
+static void SerialFillFifo(SerialPort *port)
+{
+    u32 count = Min(RingCount(&port->Transmit), (u32)SERIAL_FIFO_SIZE);
+
+    for (u32 i = 0; i < count; i++)
+        HalPortOut8(port->Base + REG_DATA, RingPop(&port->Transmit));
+
+    port->Transmitting = count != 0;
+}
+
+/* Gets the transmitter going if it is idle. Must be called with the port locked. */
+static void SerialStartTransmit(SerialPort *port)
+{
+    if (port->Transmitting)
+        return;
+
+    /* Bytes written by polling may still be on their way, in which case
+       the FIFO running empty raises the interrupt that refills it */
+    if (HalPortIn8(port->Base + REG_LINE_STATUS) & LS_TRANSBUF_EMPTY)
+        SerialFillFifo(port);
+    else
+        port->Transmitting = true;
+}
+
+/* Writes out every queued byte by polling. Must be called with the port locked. */
+static void SerialFlushPolled(SerialPort *port)
+{
+    while (RingCount(&port->Transmit)) {
+        while (!(HalPortIn8(port->Base + REG_LINE_STATUS) & LS_TRANSBUF_EMPTY));
+        HalPortOut8(port->Base + REG_DATA, RingPop(&port->Transmit));
+    }
+}
+
+static void SerialReceiveBytes(SerialPort *port)
+{
+    while (HalPortIn8(port->Base + REG_LINE_STATUS) & LS_DATA_READY) {
+        u8 value = HalPortIn8(port->Base + REG_DATA);
+
+        if (RingCount(&port->Receive) < SERIAL_RING_SIZE)
+            RingPush(&port->Receive, value);
+        else
+            port->ReceiveOverruns++;
+    }
+}
+
+static void SerialInterrupt(CpuInterruptState *state)
+{
+    for (int i = 0; i < SERIAL_PORT_COUNT; i++) {
+        SerialPort *port = &Ports[i];
+
+        if (!port->InterruptDriven || port->Irq != state->InterruptNumber)
+            continue;
+
+        HalAcquireSpinlock(&port->Lock);
+
+        for (u8 ident; !((ident = HalPortIn8(port->Base + REG_INT_IDENT)) & INT_IDENT_NONE);) {
+            switch (ident & INT_IDENT_MASK) {
+            case INT_IDENT_LINE_STATUS:
+                if (HalPortIn8(port->Base + REG_LINE_STATUS) & LS_OVERRUN_ERR)
+                    port->ReceiveOverruns++;
+                break;
+
+            case INT_IDENT_RECEIVED:
+            case INT_IDENT_TIMEOUT:
+                SerialReceiveBytes(port);
+                break;
+
+            case INT_IDENT_TRANSMIT:
+                SerialFillFifo(port);
+                break;
+
+            case INT_IDENT_MODEM:
+                HalPortIn8(port->Base + REG_MODEM_STATUS);
+                break;
+            }
+        }
+
+        HalReleaseSpinlock(&port->Lock);
+    }
+}
+
+static void SerialSetPortRate(SerialPort *port, int baud)
 {
     u16 div = SERIAL_BASE_BAUD / baud;
-    HalPortOut8(ComPort + REG_DIV_LO, div & 0xFF);
-    HalPortOut8(ComPort + REG_DIV_HI, div >> 8);
+    u8 line_ctrl = HalPortIn8(port->Base + REG_LINE_CTRL);
+
+    HalPortOut8(port->Base + REG_LINE_CTRL, line_ctrl | LINE_CTRL_DLAB);
+    HalPortOut8(port->Base + REG_DIV_LO, div & 0xFF);
+    HalPortOut8(port->Base + REG_DIV_HI, div >> 8);
+    HalPortOut8(port->Base + REG_LINE_CTRL, line_ctrl & ~LINE_CTRL_DLAB);
 }
 
-void SerialInitializePort(int n, int baud)
+static bool SerialSetUpPort(SerialPort *port, int baud)
 {
-    ComPort = Ports[n - 1];
+    /* Ports that don't exist read back all ones */
+    HalPortOut8(port->Base + REG_SCRATCH, 0x5A);
+
+    if (HalPortIn8(port->Base + REG_SCRATCH) != 0x5A)
+        return false;
 
     /* Disable interrupts */
-    HalPortOut8(ComPort + REG_INT_ENABLE, 0);
-    HalPortOut8(ComPort + REG_LINE_CTRL, LINE_CTRL_DLAB);
-    SerialSetRate(baud);
+    HalPortOut8(port->Base + REG_INT_ENABLE, 0);
 
     /* 0b00000011 - data length is 8 bits */
-    HalPortOut8(ComPort + REG_LINE_CTRL, 0b00000011);
+    HalPortOut8(port->Base + REG_LINE_CTRL, 0b00000011);
+    SerialSetPortRate(port, baud);
 
     /* 0b11000111 - enable FIFO, clear the transmission
        and receiver FIFO buffers, 14 bytes as queue size */
-    HalPortOut8(ComPort + REG_INT_IDENT, 0b11000111);
+    HalPortOut8(port->Base + REG_INT_IDENT, 0b11000111);
 
     /* 0b00001011 - enable interrupt output,
        ready to transmit, data terminal ready bits */
-    HalPortOut8(ComPort + REG_MODEM_CTRL, 0b00001011);
+    HalPortOut8(port->Base + REG_MODEM_CTRL, 0b00001011);
+
+    port->Present = true;
+    return true;
 }
 
-int SerialReceived()
+void SerialSetRate(int baud)
 {
-    return HalPortIn8(ComPort + REG_LINE_STATUS) & LS_DATA_READY;
+    SerialSetPortRate(DebugPort, baud);
 }
 
-int SerialIsTransmitEmpty()
+void SerialInitializePort(int n, int baud)
+{
+    DebugPort = &Ports[n - 1];
+    SerialSetUpPort(DebugPort, baud);
+}
+
+void SerialWrite(int n, const void *data, int size)
 {
-    return HalPortIn8(ComPort + REG_LINE_STATUS) & LS_TRANSBUF_EMPTY;
+    SerialPort *port = &Ports[n - 1];
+    auto *bytes = (const u8 *)data;
+    u8 chunk[SERIAL_CHUNK_SIZE];
+
+    while (size > 0) {
+        u32 pending = Min(size, SERIAL_CHUNK_SIZE);
+        MemCopy(chunk, bytes, pending);
+
+        for (u32 done = 0; done < pending;) {
+            int flag = SerialLock(port);
+
+            if (!flag || !port->InterruptDriven) {
+                /* Nothing would empty the ring, so keep the order and write it all out here */
+                SerialFlushPolled(port);
+
+                for (; done < pending; done++) {
+                    while (!(HalPortIn8(port->Base + REG_LINE_STATUS) & LS_TRANSBUF_EMPTY));
+                    HalPortOut8(port->Base + REG_DATA, chunk[done]);
+                }
+            }
+            else {
+                u32 count = Min(pending - done, SERIAL_RING_SIZE - RingCount(&port->Transmit));
+
+                for (u32 i = 0; i < count; i++)
+                    RingPush(&port->Transmit, chunk[done + i]);
+
+                done += count;
+                SerialStartTransmit(port);
+            }
+
+            SerialUnlock(port, flag);
+
+            /* The ring is full, so let the interrupt handler make room */
+            if (done < pending)
+                HalPause();
+        }
+
+        bytes += pending;
+        size -= pending;
+    }
+}
+
+int SerialRead(int n, void *buffer, int size)
+{
+    SerialPort *port = &Ports[n - 1];
+    auto *bytes = (u8 *)buffer;
+    u8 chunk[SERIAL_CHUNK_SIZE];
+    int read = 0;
+
+    if (size <= 0)
+        return 0;
+
+    for (;;) {
+        int flag = SerialLock(port);
+        int count = 0;
+
+        if (!flag || !port->InterruptDriven)
+            SerialReceiveBytes(port);
+
+        while (count < Min(size - read, SERIAL_CHUNK_SIZE) && RingCount(&port->Receive))
+            chunk[count++] = RingPop(&port->Receive);
+
+        SerialUnlock(port, flag);
+        MemCopy(bytes + read, chunk, count);
+        read += count;
+
+        /* Stop once the ring runs dry, or the buffer is full */
+        if (read == size || (read && !count))
+            return read;
+
+        if (count)
+            continue;
+
+        /* Let other threads run while the line is quiet, if this one can be switched away from */
+        if (flag && DbgSchedulerEnabled && PzGetCurrentIrql() < DISPATCH_LEVEL)
+            SchYield();
+        else
+            HalPause();
+    }
 }
 
 char SerialReadChar()
 {
-    while (!SerialReceived());
-    return HalPortIn8(ComPort);
+    char c;
+    SerialRead(DebugPort - Ports + 1, &c, 1);
+    return c;
 }
 
 void SerialPrintChar(char c)
 {
-    while (!SerialIsTransmitEmpty());
-    HalPortOut8(ComPort, c);
+    SerialWrite(DebugPort - Ports + 1, &c, 1);
 }
 
 void SerialPrintStr(const char *str, ...)
@@ -87,4 +351,70 @@ void SerialPrintStr(const char *str, ...)
     va_start(params, str);
     PrintfWithCallbackV(SerialPrintChar, str, params);
     va_end(params);
+}
+
+static PzStatus SerialDispatch(PzDeviceObject *device, PzIoRequestPacket *irp)
+{
+    int n = (SerialPort *)device->DeviceExtension - Ports + 1;
+    PzIoStackLocation *location = irp->CurrentLocation;
+
+    switch (location->MajorFunction) {
+    case IRP_MJ_CREATE:
+    case IRP_MJ_CLOSE:
+        return STATUS_SUCCESS;
+
+    /* Reads wait for at least one byte and return whatever has arrived by then */
+    case IRP_MJ_READ:
+        irp->UserStatus->Information = SerialRead(n, irp->SystemBuffer, location->Parameters.Read.Length);
+        return STATUS_SUCCESS;
+
+    case IRP_MJ_WRITE:
+        SerialWrite(n, irp->SystemBuffer, location->Parameters.Write.Length);
+        irp->UserStatus->Information = location->Parameters.Write.Length;
+        return STATUS_SUCCESS;
+    }
+
+    return STATUS_UNSUPPORTED_FUNCTION;
+}
+
+void SerialInitializeDevices()
+{
+    static PzString names[SERIAL_PORT_COUNT] = {
+        PZ_CONST_STRING("Serial1"), PZ_CONST_STRING("Serial2"),
+        PZ_CONST_STRING("Serial3"), PZ_CONST_STRING("Serial4")
+    };
+
+    bool irq_installed[16] = { };
+
+    for (int i = 0; i < SERIAL_PORT_COUNT; i++) {
+        SerialPort *port = &Ports[i];
+
+        /* The debugger's port is already set up, and the protocol owns it */
+        if (port != DebugPort) {
+            PzDeviceObject *device;
+
+            if (!SerialSetUpPort(port, SERIAL_BASE_BAUD) ||
+                IoCreateDevice(nullptr, DEVICE_SERIAL, 0, &names[i], &device) != STATUS_SUCCESS)
+                continue;
+
+            device->DeviceExtension = port;
+
+            for (int j = 0; j < MJ_FUNC_MAX; j++)
+                device->MajorFunctions[j] = SerialDispatch;
+        }
+
+        if (!port->Present)
+            continue;
+
+        if (!irq_installed[port->Irq]) {
+            PzInstallIrqHandler(port->Irq, SerialInterrupt);
+            irq_installed[port->Irq] = true;
+        }
+
+        int flag = SerialLock(port);
+        port->InterruptDriven = true;
+        HalPortOut8(port->Base + REG_INT_ENABLE,
+            INT_ENABLE_RECEIVED | INT_ENABLE_TRANSMIT | INT_ENABLE_LINE_STATUS);
+        SerialUnlock(port, flag);
+    }
 }
\ No newline at end of file
@@ -1,35 +1,105 @@
 #include <spinlock.hh>
 #include <processor.hh>
 #include <panic.hh>
+#include <debug.hh>
+#include <x86/cpu.hh>
+#include <lib/util.hh>
 
-extern "C" void HalAcquireSpinlock(PzSpinlock *spinlock);
-extern "C" void HalReleaseSpinlock(PzSpinlock *spinlock);
+#ifdef PRIZM_SPINLOCK_STATISTICS
+static PzSpinlockStatistics TrackedLocks[MAX_TRACKED_SPINLOCKS];
+static u32 TrackedLockCount;
 
-void PzAcquireSpinlock(PzSpinlock *spinlock)
+/* Statistics are only written with the lock held, so they need no synchronization of their own */
+static void AcquireTracked(PzSpinlock *spinlock, PzSpinlockStatistics *stats)
 {
-    bool acquired = spinlock->Acquired;
+    u64 start = HalReadTsc();
+    u32 polls = HalAcquireSpinlock(spinlock);
+    u64 now = HalReadTsc();
+
+    stats->Acquisitions++;
+
+    if (polls) {
+        stats->ContendedAcquisitions++;
+        stats->SpinCycles += now - start;
+    }
 
-    if (acquired)
-        HalAcquireSpinlock(spinlock);
+    stats->AcquiredAt = now;
+}
+#endif
 
+void PzAcquireSpinlock(PzSpinlock *spinlock)
+{
     int old_irql = PzGetCurrentIrql();
 
+    /* Raise first, so that the holder can't be preempted while others wait in line behind it */
     if (old_irql < DISPATCH_LEVEL)
         PzRaiseIrql(DISPATCH_LEVEL);
 
-    spinlock->ReturnIrql = old_irql;
+#ifdef PRIZM_SPINLOCK_STATISTICS
+    if (PzSpinlockStatistics *stats = spinlock->Statistics)
+        AcquireTracked(spinlock, stats);
+    else
+#endif
+    HalAcquireSpinlock(spinlock);
 
-    if (!acquired)
-        HalAcquireSpinlock(spinlock);
+    spinlock->ReturnIrql = old_irql;
 }
 
 void PzReleaseSpinlock(PzSpinlock *spinlock)
 {
+    /* The next holder overwrites it as soon as the lock is released */
+    int irql = spinlock->ReturnIrql;
+
+#ifdef PRIZM_SPINLOCK_STATISTICS
+    if (PzSpinlockStatistics *stats = spinlock->Statistics)
+        stats->MaxHoldCycles = Max(stats->MaxHoldCycles, HalReadTsc() - stats->AcquiredAt);
+#endif
+
     HalReleaseSpinlock(spinlock);
-    PzLowerIrql(spinlock->ReturnIrql);
+    PzLowerIrql(irql);
 }
 
 bool PzIsSpinlockAcquired(PzSpinlock spinlock)
 {
-    return spinlock.Acquired;
+    return spinlock.NowServing != spinlock.NextTicket;
+}
+
+void PzTrackSpinlock(PzSpinlock *spinlock, const char *name)
+{
+#ifdef PRIZM_SPINLOCK_STATISTICS
+    u32 index = __atomic_fetch_add(&TrackedLockCount, 1, __ATOMIC_RELAXED);
+
+    if (index >= MAX_TRACKED_SPINLOCKS)
+        return;
+
+    TrackedLocks[index].Name = name;
+    TrackedLocks[index].Lock = spinlock;
+    spinlock->Statistics = &TrackedLocks[index];
+#endif
+}
+
+void PzPrintSpinlockStatistics()
+{
+#ifdef PRIZM_SPINLOCK_STATISTICS
+    PzSpinlockStatistics *sorted[MAX_TRACKED_SPINLOCKS];
+    u32 count = Min<u32>(TrackedLockCount, MAX_TRACKED_SPINLOCKS);
+
+    for (u32 i = 0; i < count; i++) {
+        u32 j = i;
+
+        for (; j > 0 && sorted[j - 1]->SpinCycles < TrackedLocks[i].SpinCycles; j--)
+            sorted[j] = sorted[j - 1];
+
+        sorted[j] = &TrackedLocks[i];
+    }
+
+    /* Counters are read without the locks, so they may be slightly off for busy ones */
+    for (u32 i = 0; i < count; i++) {
+        PzSpinlockStatistics *stats = sorted[i];
+
+        DbgPrintStr("[PzSpinlock] %s(%p): acquired=%llu contended=%llu spin_cycles=%llu max_hold=%llu\r\n",
+            stats->Name, stats->Lock, stats->Acquisitions, stats->ContendedAcquisitions,
+            stats->SpinCycles, stats->MaxHoldCycles);
+    }
+#endif
 }
\ No newline at end of file
@@ -14,8 +14,11 @@ PzStatus UmExContinueExecution(CpuInterruptState *state, void *params)
 
 PzStatus UmExPushExceptionHandler(CpuInterruptState *state, void *params)
 {
-    auto *prms = (UmExPushExceptionHandlerParams *)params;
-    ExPushExceptionHandler(prms->Handler, prms->StackContext);
+    COPY_SYSCALL_PARAMS(prms, UmExPushExceptionHandlerParams);
+
+    if (!ExPushExceptionHandler(prms->Handler, prms->StackContext))
+        return STATUS_ALLOCATION_FAILED;
+
     return STATUS_SUCCESS;
 }
 
@@ -1,95 +1,150 @@
 #include <syscall/file.hh>
+#include <lib/malloc.hh>
+#include <lib/util.hh>
 #include <debug.hh>
 
+/* Hands the status block of a request over to the caller, failing the syscall if it can't */
+static PzStatus ReturnStatusBlock(PzStatus status, PzIoStatusBlock *dest, const PzIoStatusBlock *iosb)
+{
+    return MmCopyToUser(dest, iosb, sizeof *iosb) ? status : STATUS_INVALID_ARGUMENT;
+}
+
 PzStatus UmCreateFile(CpuInterruptState *state, void *params)
 {
-    auto *prm = (UmCreateFileParams*)params;
+    COPY_SYSCALL_PARAMS(prm, UmCreateFileParams);
+    PzString *filename = PzCaptureUserString(prm->Filename);
 
-    if (!MmVirtualProbeMemory(true, (uptr)prm, sizeof(UmCreateFileParams), false) ||
-        !MmVirtualProbeMemory(true, (uptr)prm->Handle, sizeof(PzHandle), true) ||
-        !PzValidateString(true, prm->Filename, false) ||
-        !MmVirtualProbeMemory(true, (uptr)prm->Iosb, sizeof(PzIoStatusBlock), false)) {
+    if (!filename)
         return STATUS_INVALID_ARGUMENT;
+
+    PzHandle handle = 0;
+    PzIoStatusBlock iosb = {};
+    PzStatus status = PzCreateFile(false, &handle, filename, &iosb, prm->Access, prm->Disposition);
+
+    PzFreeString(filename);
+
+    if ((status = ReturnStatusBlock(status, prm->Iosb, &iosb)) != STATUS_SUCCESS) {
+        if (handle)
+            PzCloseHandle(handle);
+
+        return status;
     }
 
-    return PzCreateFile(false, prm->Handle, prm->Filename, prm->Iosb, prm->Access, prm->Disposition);
+    return ScReturnHandles(prm->Handle, &handle, 1);
 }
 
 PzStatus UmReadFile(CpuInterruptState *state, void *params)
 {
-    auto *prm = (UmReadFileParams*)params;
+    COPY_SYSCALL_PARAMS(prm, UmReadFileParams);
+    u64 offset;
 
-    if (!MmVirtualProbeMemory(true, (uptr)prm, sizeof(UmReadFileParams), false) ||
-        !MmVirtualProbeMemory(true, (uptr)prm->Buffer, prm->Bytes, true) ||
-        !MmVirtualProbeMemory(true, (uptr)prm->Iosb, sizeof(PzIoStatusBlock), false) ||
-        prm->Offset && !MmVirtualProbeMemory(true, (uptr)prm->Offset, sizeof(u64), false))
+    if (prm->Offset && !MmCopyFromUser(&offset, prm->Offset, sizeof offset))
         return STATUS_INVALID_ARGUMENT;
 
-    return PzReadFile(prm->Handle, prm->Buffer, prm->Iosb, prm->Bytes, prm->Offset);
+    /* Drivers fill a kernel buffer, zeroed so that nothing stale reaches the caller */
+    void *buffer = PzHeapAllocate(Max(prm->Bytes, 1u), HEAP_ZERO);
+
+    if (!buffer)
+        return STATUS_ALLOCATION_FAILED;
+
+    PzIoStatusBlock iosb = {};
+    PzStatus status = PzReadFile(prm->Handle, buffer, &iosb, prm->Bytes, prm->Offset ? &offset : nullptr);
+
+    if (status == STATUS_SUCCESS && !MmCopyToUser(prm->Buffer, buffer, prm->Bytes))
+        status = STATUS_INVALID_ARGUMENT;
+
+    PzHeapFree(buffer);
+    return ReturnStatusBlock(status, prm->Iosb, &iosb);
 }
 
 PzStatus UmWriteFile(CpuInterruptState *state, void *params)
 {
-    auto *prm = (UmWriteFileParams *)params;
+    COPY_SYSCALL_PARAMS(prm, UmWriteFileParams);
+    u64 offset;
+
+    if (prm->Offset && !MmCopyFromUser(&offset, prm->Offset, sizeof offset))
+        return STATUS_INVALID_ARGUMENT;
+
+    void *buffer = ScCaptureBuffer(prm->Buffer, prm->Bytes);
 
-    if (!MmVirtualProbeMemory(true, (uptr)prm, sizeof(UmWriteFileParams), false) ||
-        !MmVirtualProbeMemory(true, (uptr)prm->Buffer, prm->Bytes, false) ||
-        !MmVirtualProbeMemory(true, (uptr)prm->Iosb, sizeof(PzIoStatusBlock), false) ||
-        prm->Offset && !MmVirtualProbeMemory(true, (uptr)prm->Offset, sizeof(u64), false))
+    if (!buffer)
         return STATUS_INVALID_ARGUMENT;
 
-    return PzWriteFile(prm->Handle, prm->Buffer, prm->Iosb, prm->Bytes, prm->Offset);
+    PzIoStatusBlock iosb = {};
+    PzStatus status = PzWriteFile(prm->Handle, buffer, &iosb, prm->Bytes, prm->Offset ? &offset : nullptr);
+
+    PzHeapFree(buffer);
+    return ReturnStatusBlock(status, prm->Iosb, &iosb);
 }
 
 PzStatus UmQueryInformationFile(CpuInterruptState *state, void *params)
 {
-    auto *prm = (UmQueryInformationFileParams*)params;
+    COPY_SYSCALL_PARAMS(prm, UmQueryInformationFileParams);
+    void *buffer = PzHeapAllocate(Max(prm->BufferSize, 1u), HEAP_ZERO);
 
-    if (!MmVirtualProbeMemory(true, (uptr)prm, sizeof(UmQueryInformationFileParams), false) ||
-        !MmVirtualProbeMemory(true, (uptr)prm->Iosb, sizeof(PzIoControlBlock), false) ||
-        !MmVirtualProbeMemory(true, (uptr)prm->OutBuffer, prm->BufferSize, true))
-        return STATUS_INVALID_ARGUMENT;
+    if (!buffer)
+        return STATUS_ALLOCATION_FAILED;
+
+    PzIoStatusBlock iosb = {};
+    PzStatus status = PzQueryInformationFile(prm->Handle, &iosb, prm->Type, buffer, prm->BufferSize);
+
+    if (status == STATUS_SUCCESS && !MmCopyToUser(prm->OutBuffer, buffer, prm->BufferSize))
+        status = STATUS_INVALID_ARGUMENT;
 
-    return PzQueryInformationFile(prm->Handle, prm->Iosb, prm->Type, prm->OutBuffer, prm->BufferSize);
+    PzHeapFree(buffer);
+    return ReturnStatusBlock(status, prm->Iosb, &iosb);
 }
 
 PzStatus UmSetInformationFile(CpuInterruptState *state, void *params)
 {
-    auto *prm = (UmSetInformationFileParams *)params;
+    COPY_SYSCALL_PARAMS(prm, UmSetInformationFileParams);
+    void *buffer = ScCaptureBuffer(prm->Buffer, prm->BufferSize);
 
-    if (!MmVirtualProbeMemory(true, (uptr)prm, sizeof(UmQueryInformationFileParams), false) ||
-        !MmVirtualProbeMemory(true, (uptr)prm->Iosb, sizeof(PzIoControlBlock), false) ||
-        !MmVirtualProbeMemory(true, (uptr)prm->Buffer, prm->BufferSize, true))
+    if (!buffer)
         return STATUS_INVALID_ARGUMENT;
 
-    return PzSetInformationFile(prm->Handle, prm->Iosb, prm->Type, prm->Buffer, prm->BufferSize);
+    PzIoStatusBlock iosb = {};
+    PzStatus status = PzSetInformationFile(prm->Handle, &iosb, prm->Type, buffer, prm->BufferSize);
+
+    PzHeapFree(buffer);
+    return ReturnStatusBlock(status, prm->Iosb, &iosb);
 }
 
 PzStatus UmDeviceIoControl(CpuInterruptState *state, void *params)
 {
-    auto *prm = (UmDeviceIoControlParams *)params;
+    COPY_SYSCALL_PARAMS(prm, UmDeviceIoControlParams);
+    void *in_buffer = nullptr, *out_buffer = nullptr;
 
-    if (!MmVirtualProbeMemory(true, (uptr)prm, sizeof(UmQueryInformationFileParams), false) ||
-        !MmVirtualProbeMemory(true, (uptr)prm->Iosb, sizeof(PzIoControlBlock), false) ||
-        prm->InBuffer  && !MmVirtualProbeMemory(true, (uptr)prm->InBuffer, prm->InBufSize, false) ||
-        prm->OutBuffer && !MmVirtualProbeMemory(true, (uptr)prm->OutBuffer, prm->OutBufSize, true))
+    if (prm->InBuffer && !(in_buffer = ScCaptureBuffer(prm->InBuffer, prm->InBufSize)))
         return STATUS_INVALID_ARGUMENT;
 
-    return PzDeviceIoControl(
+    if (prm->OutBuffer && !(out_buffer = PzHeapAllocate(Max(prm->OutBufSize, 1u), HEAP_ZERO))) {
+        PzHeapFree(in_buffer);
+        return STATUS_ALLOCATION_FAILED;
+    }
+
+    PzIoStatusBlock iosb = {};
+    PzStatus status = PzDeviceIoControl(
         prm->DeviceHandle,
-        prm->Iosb,
+        &iosb,
         prm->ControlCode,
-        prm->InBuffer,
+        in_buffer,
         prm->InBufSize,
-        prm->OutBuffer,
+        out_buffer,
         prm->OutBufSize);
+
+    if (status == STATUS_SUCCESS && out_buffer &&
+        !MmCopyToUser(prm->OutBuffer, out_buffer, prm->OutBufSize))
+        status = STATUS_INVALID_ARGUMENT;
+
+    PzHeapFree(in_buffer);
+    PzHeapFree(out_buffer);
+    return ReturnStatusBlock(status, prm->Iosb, &iosb);
 }
 
 PzStatus UmCloseHandle(CpuInterruptState *state, void *params)
 {
-    auto *prm = (UmCloseHandleParams *)params;
-    if (!MmVirtualProbeMemory(true, (uptr)prm, sizeof(UmCloseHandleParams), false))
-        return STATUS_INVALID_ARGUMENT;
+    COPY_SYSCALL_PARAMS(prm, UmCloseHandleParams);
 
     return PzCloseHandle(prm->Handle);
 }
\ No newline at end of file
@@ -1,79 +1,114 @@
 #include <syscall/gfx.hh>
+#include <lib/malloc.hh>
+
+static_assert(sizeof(GfxHandle) == sizeof(PzHandle));
 
 DECL_SYSCALL(UmGfxGenerateBuffers)
 {
-    auto *prm = (UmGfxGenerateBuffersParams*)params;
+    COPY_SYSCALL_PARAMS(prm, UmGfxGenerateBuffersParams);
 
-    if (!MmVirtualProbeMemory(true, (uptr)prm->Handles, prm->Count * sizeof(PzHandle), true))
+    if (prm->Count <= 0 || u32(prm->Count) > 0xFFFFFFFF / sizeof(GfxHandle))
         return STATUS_INVALID_ARGUMENT;
 
-    return GfxGenerateBuffers(prm->Type, prm->Count, prm->Handles);
+    auto *handles = (GfxHandle *)PzHeapAllocate(prm->Count * sizeof(GfxHandle), HEAP_ZERO);
+
+    if (!handles)
+        return STATUS_ALLOCATION_FAILED;
+
+    PzStatus status = GfxGenerateBuffers(prm->Type, prm->Count, handles);
+
+    if (status == STATUS_SUCCESS)
+        status = ScReturnHandles((PzHandle *)prm->Handles, (PzHandle *)handles, prm->Count);
+
+    PzHeapFree(handles);
+    return status;
 }
 
 DECL_SYSCALL(UmGfxTextureData)
 {
-    auto *prm = (UmGfxTextureDataParams *)params;
+    COPY_SYSCALL_PARAMS(prm, UmGfxTextureDataParams);
+
+    if (prm->Width <= 0 || prm->Height <= 0 ||
+        u32(prm->Width) > 0xFFFFFFFF / sizeof(u32) / u32(prm->Height))
+        return STATUS_INVALID_ARGUMENT;
+
+    void *data = ScCaptureBuffer(prm->Data, prm->Width * prm->Height * sizeof(u32));
 
-    if (!MmVirtualProbeMemory(true, (uptr)prm->Data, prm->Width * prm->Height * sizeof(u32), false))
+    if (!data)
         return STATUS_INVALID_ARGUMENT;
 
-    return GfxTextureData(prm->Handle, prm->Width, prm->Height, prm->PixelFormat, prm->Flags, prm->Data);
+    PzStatus status = GfxTextureData(prm->Handle, prm->Width, prm->Height, prm->PixelFormat, prm->Flags, data);
+
+    PzHeapFree(data);
+    return status;
 }
 
 DECL_SYSCALL(UmGfxTextureFlags)
 {
-    auto *prm = (UmGfxTextureFlagsParams *)params;
+    COPY_SYSCALL_PARAMS(prm, UmGfxTextureFlagsParams);
     return GfxTextureFlags(prm->Handle, prm->Flags);
 }
 
 DECL_SYSCALL(UmGfxVertexBufferData)
 {
-    auto *prm = (UmGfxVertexBufferDataParams *)params;
-    if (!MmVirtualProbeMemory(true, (uptr)prm->Data, prm->Size, false))
+    COPY_SYSCALL_PARAMS(prm, UmGfxVertexBufferDataParams);
+    void *data = ScCaptureBuffer(prm->Data, prm->Size);
+
+    if (!data)
         return STATUS_INVALID_ARGUMENT;
-    return GfxVertexBufferData(prm->Handle, prm->Data, prm->Size);
+
+    PzStatus status = GfxVertexBufferData(prm->Handle, data, prm->Size);
+
+    PzHeapFree(data);
+    return status;
 }
 
 DECL_SYSCALL(UmGfxDrawPrimitives)
 {
-    auto *prm = (UmGfxDrawPrimitivesParams *)params;
+    COPY_SYSCALL_PARAMS(prm, UmGfxDrawPrimitivesParams);
     return GfxDrawTriangles(prm->RenderHandle, prm->VboHandle,
         prm->TextureHandle, prm->DataFormat, prm->StartIndex, prm->VertexCount);
 }
 
 DECL_SYSCALL(UmGfxDrawRectangle)
 {
-    auto *prm = (UmGfxDrawRectangleParams *)params;
+    COPY_SYSCALL_PARAMS(prm, UmGfxDrawRectangleParams);
+    /* Texture coordinates of the four corners, as either integers or floats */
+    u32 uvs[8];
+
+    if (prm->UVs && !MmCopyFromUser(uvs, prm->UVs, sizeof uvs))
+        return STATUS_INVALID_ARGUMENT;
+
     return GfxDrawRectangle(prm->RenderHandle, prm->TextureHandle,
-        prm->X, prm->Y, prm->Width, prm->Height, prm->Color, prm->IntUVs, prm->UVs);
+        prm->X, prm->Y, prm->Width, prm->Height, prm->Color, prm->IntUVs, prm->UVs ? uvs : nullptr);
 }
 
 DECL_SYSCALL(UmGfxClearColor)
 {
-    auto *prm = (UmGfxClearColorParams *)params;
+    COPY_SYSCALL_PARAMS(prm, UmGfxClearColorParams);
     return GfxClearColor(prm->RenderHandle, prm->Color);
 }
 
 DECL_SYSCALL(UmGfxClear)
 {
-    auto *prm = (UmGfxClearParams *)params;
+    COPY_SYSCALL_PARAMS(prm, UmGfxClearParams);
     return GfxClear(prm->RenderHandle, prm->Flags);
 }
 
 DECL_SYSCALL(UmGfxBitBlit)
 {
-    auto *prm = (UmGfxBitBlitParams *)params;
+    COPY_SYSCALL_PARAMS(prm, UmGfxBitBlitParams);
     return GfxBitBlit(prm->DestBuffer, prm->Dx, prm->Dy, prm->Dw, prm->Dh, prm->SrcBuffer, prm->Sx, prm->Sy);
 }
 
 DECL_SYSCALL(UmGfxUploadToDisplay)
 {
-    auto *prm = (UmGfxUploadToDisplayParams *)params;
+    COPY_SYSCALL_PARAMS(prm, UmGfxUploadToDisplayParams);
     return GfxUploadToDisplay(prm->RenderBuffer);
 }
 
 DECL_SYSCALL(UmGfxRenderBufferData)
 {
-    auto *prm = (UmGfxRenderBufferDataParams *)params;
+    COPY_SYSCALL_PARAMS(prm, UmGfxRenderBufferDataParams);
     return GfxRenderBufferData(prm->Handle, prm->Width, prm->Height, prm->PixelFormat);
 }
\ No newline at end of file
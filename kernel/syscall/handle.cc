@@ -9,7 +9,7 @@
 #include <processor.hh>
 #include <serial.hh>
 
-#define SYSCALL_COUNT 64
+#define SYSCALL_COUNT 68
 
 PzStatus (*PrizmSyscallTable[SYSCALL_COUNT])(CpuInterruptState *state, void *params) = {
     UmExitThread,
@@ -75,7 +75,11 @@ PzStatus (*PrizmSyscallTable[SYSCALL_COUNT])(CpuInterruptState *state, void *par
     UmEnumerateChildWindows,
     UmAllocateConsole,
     UmRegisterConsoleHost,
-    UmUnregisterConsoleHost
+    UmUnregisterConsoleHost,
+    UmMapViewOfFile,
+    UmUnmapViewOfFile,
+    UmQuerySystemInformation,
+    UmQueryProcessInformation
 };
 
 #include <sched/scheduler.hh>
@@ -96,4 +100,31 @@ extern "C" void SyscallHandler(CpuInterruptState *state)
     PzEnableInterrupts();
     state->Eax = PrizmSyscallTable[number](state, params);
     PzDisableInterrupts();
+}
+
+#include <lib/malloc.hh>
+#include <io/manager.hh>
+
+void *ScCaptureBuffer(const void *src, u32 bytes)
+{
+    void *buffer = PzHeapAllocate(Max(bytes, 1u), 0);
+
+    if (buffer && !MmCopyFromUser(buffer, src, bytes)) {
+        PzHeapFree(buffer);
+        return nullptr;
+    }
+
+    return buffer;
+}
+
+PzStatus ScReturnHandles(PzHandle *dest, const PzHandle *handles, u32 count)
+{
+    if (MmCopyToUser(dest, handles, count * sizeof(PzHandle)))
+        return STATUS_SUCCESS;
+
+    for (u32 i = 0; i < count; i++)
+        if (handles[i])
+            PzCloseHandle(handles[i]);
+
+    return STATUS_INVALID_ARGUMENT;
 }
\ No newline at end of file
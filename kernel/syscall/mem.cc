@@ -1,21 +1,27 @@
 #include <syscall/mem.hh>
 #include <mm/virtual.hh>
+#include <mm/section.hh>
+#include <mm/query.hh>
 #include <lib/util.hh>
 #include <sched/scheduler.hh>
 #include <serial.hh>
 
 PzStatus UmAllocateVirtualMemory(CpuInterruptState *state, void *params)
 {
-    auto prm = (UmAllocateVirtualMemoryParams*)params;
+    COPY_SYSCALL_PARAMS(prm, UmAllocateVirtualMemoryParams);
+    void *base;
 
-    if (!MmVirtualProbeMemory(true, (uptr)prm, sizeof(UmAllocateVirtualMemoryParams), false) ||
-        !MmVirtualProbeMemory(true, (uptr)prm->BaseAddress, sizeof(void **), true))
+    if (!MmCopyFromUser(&base, prm->BaseAddress, sizeof base))
         return STATUS_INVALID_ARGUMENT;
 
     if (void *allocated =
-        MmVirtualAllocateUserMemory(prm->ProcessHandle, *prm->BaseAddress, prm->Size, prm->Protection)) {
-        *prm->BaseAddress = allocated;
-        return STATUS_SUCCESS;
+        MmVirtualAllocateUserMemory(prm->ProcessHandle, base, prm->Size, prm->Protection)) {
+        if (MmCopyToUser(prm->BaseAddress, &allocated, sizeof allocated))
+            return STATUS_SUCCESS;
+
+        /* The caller would have no way to find out where the memory went */
+        MmVirtualFreeUserMemory(prm->ProcessHandle, allocated, 0);
+        return STATUS_INVALID_ARGUMENT;
     }
 
     return STATUS_FAILED;
@@ -23,16 +29,19 @@ PzStatus UmAllocateVirtualMemory(CpuInterruptState *state, void *params)
 
 PzStatus UmProtectVirtualMemory(CpuInterruptState *state, void *params)
 {
-    auto prm = (UmAllocateVirtualMemoryParams *)params;
+    COPY_SYSCALL_PARAMS(prm, UmAllocateVirtualMemoryParams);
+    uptr base;
 
-    if (!MmVirtualProbeMemory(true, (uptr)prm, sizeof(UmAllocateVirtualMemoryParams), false) ||
-        !MmVirtualProbeMemory(true, (uptr)prm->BaseAddress, sizeof(void **), true))
+    if (!MmCopyFromUser(&base, prm->BaseAddress, sizeof base))
         return STATUS_INVALID_ARGUMENT;
 
-    if (bool allocated =
-        MmVirtualProtectUserMemory(prm->ProcessHandle, *prm->BaseAddress, prm->Size, prm->Protection)) {
-        *(uptr*)*prm->BaseAddress &= -PAGE_SIZE;
-        return STATUS_SUCCESS;
+    if (MmVirtualProtectUserMemory(prm->ProcessHandle, (void *)base, prm->Size, prm->Protection)) {
+        base &= -PAGE_SIZE;
+
+        if (MmCopyToUser(prm->BaseAddress, &base, sizeof base))
+            return STATUS_SUCCESS;
+
+        return STATUS_INVALID_ARGUMENT;
     }
 
     return STATUS_FAILED;
@@ -40,13 +49,46 @@ PzStatus UmProtectVirtualMemory(CpuInterruptState *state, void *params)
 
 PzStatus UmFreeVirtualMemory(CpuInterruptState *state, void *params)
 {
-    auto prm = (UmFreeVirtualMemoryParams*)params;
-
-    if (!MmVirtualProbeMemory(true, (uptr)prm, sizeof(UmFreeVirtualMemoryParams), false))
-        return STATUS_INVALID_ARGUMENT;
+    COPY_SYSCALL_PARAMS(prm, UmFreeVirtualMemoryParams);
 
     if (MmVirtualFreeUserMemory(prm->ProcessHandle, prm->BaseAddress, 0))
         return STATUS_SUCCESS;
 
     return STATUS_FAILED;
+}
+
+PzStatus UmMapViewOfFile(CpuInterruptState *state, void *params)
+{
+    COPY_SYSCALL_PARAMS(prm, UmMapViewOfFileParams);
+    void *base;
+
+    if (PzStatus status = PzMapViewOfFile(true, prm->ProcessHandle, prm->FileHandle,
+        prm->Offset, prm->Size, &base))
+        return status;
+
+    if (MmCopyToUser(prm->BaseAddress, &base, sizeof base))
+        return STATUS_SUCCESS;
+
+    /* The caller would have no way to find out where the view went */
+    PzUnmapViewOfFile(true, prm->ProcessHandle, base);
+    return STATUS_INVALID_ARGUMENT;
+}
+
+PzStatus UmUnmapViewOfFile(CpuInterruptState *state, void *params)
+{
+    COPY_SYSCALL_PARAMS(prm, UmUnmapViewOfFileParams);
+
+    return PzUnmapViewOfFile(true, prm->ProcessHandle, prm->BaseAddress);
+}
+
+PzStatus UmQuerySystemInformation(CpuInterruptState *state, void *params)
+{
+    COPY_SYSCALL_PARAMS(prm, UmQuerySystemInformationParams);
+    return PzQuerySystemInformation(true, prm->Type, prm->Buffer, prm->Size);
+}
+
+PzStatus UmQueryProcessInformation(CpuInterruptState *state, void *params)
+{
+    COPY_SYSCALL_PARAMS(prm, UmQueryProcessInformationParams);
+    return PzQueryProcessInformation(true, prm->ProcessHandle, prm->Type, prm->Buffer, prm->Size);
 }
\ No newline at end of file
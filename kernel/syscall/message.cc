@@ -1,28 +1,31 @@
 #include <syscall/message.hh>
-#include <mm/virtual.hh>
 
 DECL_SYSCALL(UmPostThreadMessage)
 {
-    auto *prm = (UmPostThreadMessageParams *)params;
+    COPY_SYSCALL_PARAMS(prm, UmPostThreadMessageParams);
     return MsgPostThreadMessage(prm->Thread, prm->Type, prm->Param1, prm->Param2, prm->Param3, prm->Param4);
 }
 
 DECL_SYSCALL(UmPeekThreadMessage)
 {
-    auto *prm = (UmPeekThreadMessageParams *)params;
+    COPY_SYSCALL_PARAMS(prm, UmPeekThreadMessageParams);
+    PzMessage message;
+    PzStatus status = MsgPeekThreadMessage(&message);
 
-    if (!MmVirtualProbeMemory(true, (uptr)prm->OutMessage, sizeof(PzMessage), true))
+    if (status == STATUS_SUCCESS && !MmCopyToUser(prm->OutMessage, &message, sizeof message))
         return STATUS_INVALID_ARGUMENT;
 
-    return MsgPeekThreadMessage(prm->OutMessage);
+    return status;
 }
 
 DECL_SYSCALL(UmReceiveThreadMessage)
 {
-    auto *prm = (UmPeekThreadMessageParams *)params;
+    COPY_SYSCALL_PARAMS(prm, UmPeekThreadMessageParams);
+    PzMessage message;
+    PzStatus status = MsgReceiveThreadMessage(&message);
 
-    if (!MmVirtualProbeMemory(true, (uptr)prm->OutMessage, sizeof(PzMessage), true))
+    if (status == STATUS_SUCCESS && !MmCopyToUser(prm->OutMessage, &message, sizeof message))
         return STATUS_INVALID_ARGUMENT;
 
-    return MsgReceiveThreadMessage(prm->OutMessage);
+    return status;
 }
\ No newline at end of file
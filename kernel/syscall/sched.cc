@@ -10,81 +10,95 @@ DECL_SYSCALL(UmExitThread)
 
 DECL_SYSCALL(UmCreateThread)
 {
-    auto prm = (UmCreateThreadParams *)params;
+    COPY_SYSCALL_PARAMS(prm, UmCreateThreadParams);
+    PzHandle handle;
 
-    if (!MmVirtualProbeMemory(true, (uptr)prm, sizeof(UmCreateThreadParams), false) ||
-        !MmVirtualProbeMemory(true, (uptr)prm->Handle, sizeof(PzHandle), true))
-        return STATUS_INVALID_ARGUMENT;
-
-    return PsCreateThread(
-        prm->Handle, true,
-        prm->ParentProcess, prm->StartAddress, 
+    if (PzStatus status = PsCreateThread(
+        &handle, true,
+        prm->ParentProcess, prm->StartAddress,
         prm->Parameter, prm->StackSize,
-        prm->Priority);
+        prm->Priority))
+        return status;
+
+    return ScReturnHandles(prm->Handle, &handle, 1);
 }
 
 DECL_SYSCALL(UmTerminateThread)
 {
-    auto prm = (UmTerminateParams *)params;
-
-    if (!MmVirtualProbeMemory(true, (uptr)prm, sizeof(UmTerminateParams), false))
-        return STATUS_INVALID_ARGUMENT;
+    COPY_SYSCALL_PARAMS(prm, UmTerminateParams);
 
     return PsTerminateThread(prm->Handle, prm->ExitCode);
 }
 
 DECL_SYSCALL(UmTerminateProcess)
 {
-    auto prm = (UmTerminateParams *)params;
-
-    if (!MmVirtualProbeMemory(true, (uptr)prm, sizeof(UmTerminateParams), false))
-        return STATUS_INVALID_ARGUMENT;
+    COPY_SYSCALL_PARAMS(prm, UmTerminateParams);
 
     return PsTerminateProcess(prm->Handle, prm->ExitCode);
 }
 
 DECL_SYSCALL(UmCreateProcess)
 {
-    auto prm = (UmCreateProcessParams *)params;
+    COPY_SYSCALL_PARAMS(prm, UmCreateProcessParams);
+    PzProcessCreationParams creation;
 
-    if (!MmVirtualProbeMemory(true, (uptr)prm, sizeof(UmCreateProcessParams), false) ||
-        !MmVirtualProbeMemory(true, (uptr)prm->ProcessHandle, sizeof(PzHandle), true) ||
-        !MmVirtualProbeMemory(true, (uptr)prm->Params, sizeof(PzProcessCreationParams), false) ||
-        !PzValidateString(true, prm->Params->ExecutablePath, false) ||
-        !PzValidateString(true, prm->Params->ProcessName, false))
+    /* Everything the creation parameters point to is copied as well, so that
+       other threads of the caller can't swap it out while the process is created */
+    if (!MmCopyFromUser(&creation, prm->Params, sizeof creation))
         return STATUS_INVALID_ARGUMENT;
 
-    return PsCreateProcess(false, prm->ProcessHandle, prm->Params);
+    PzString *path = PzCaptureUserString(creation.ExecutablePath);
+    PzString *name = path ? PzCaptureUserString(creation.ProcessName) : nullptr;
+    PzStatus status = STATUS_INVALID_ARGUMENT;
+    PzHandle handle;
+
+    if (name) {
+        creation.ExecutablePath = path;
+        creation.ProcessName = name;
+
+        if ((status = PsCreateProcess(false, &handle, &creation)) == STATUS_SUCCESS)
+            status = ScReturnHandles(prm->ProcessHandle, &handle, 1);
+
+        PzFreeString(name);
+    }
+
+    if (path)
+        PzFreeString(path);
+
+    return status;
 }
 
 #define HANDLE_ONLY(x, y) \
 DECL_SYSCALL(x) \
 { \
-    auto prm = (UmHandleOnlyParams *)params; \
-    if (!MmVirtualProbeMemory(true, (uptr)prm, sizeof(UmHandleOnlyParams), false)) \
-        return STATUS_INVALID_ARGUMENT; \
+    COPY_SYSCALL_PARAMS(prm, UmHandleOnlyParams); \
     return y(prm->Handle); \
 }
 
 #define HANDLE_NAME(x, y, allowNullName) \
 DECL_SYSCALL(x) \
 { \
-    auto prm = (UmHandleAndNameParams *)params; \
-    if (!MmVirtualProbeMemory(true, (uptr)prm, sizeof(UmHandleAndNameParams), false) || \
-        !MmVirtualProbeMemory(true, (uptr)prm->Handle, sizeof(PzHandle), true) || \
-        (!allowNullName || prm->Name) && !PzValidateString(true, prm->Name, false)) \
+    COPY_SYSCALL_PARAMS(prm, UmHandleAndNameParams); \
+    PzString *name = nullptr; \
+    PzHandle handle; \
+    if ((!allowNullName || prm->Name) && !(name = PzCaptureUserString(prm->Name))) \
         return STATUS_INVALID_ARGUMENT; \
-    return y(prm->Handle, PZ_CPROC, prm->Name); \
+    PzStatus status = y(&handle, PZ_CPROC, name); \
+    if (name) \
+        PzFreeString(name); \
+    return status ? status : ScReturnHandles(prm->Handle, &handle, 1); \
 }
 
 #define SUSPEND_RESUME(x) \
 DECL_SYSCALL(Um##x##Thread) \
 { \
-    auto prm = (UmSuspendThreadParams *)params; \
-    if (!MmVirtualProbeMemory(true, (uptr)prm, sizeof(UmSuspendThreadParams), false) || \
-        !MmVirtualProbeMemory(true, (uptr)prm->SuspendedCount, sizeof(int), true)) \
+    COPY_SYSCALL_PARAMS(prm, UmSuspendThreadParams); \
+    int suspended_count; \
+    if (PzStatus status = Ps##x##Thread(prm->Handle, &suspended_count)) \
+        return status; \
+    if (!MmCopyToUser(prm->SuspendedCount, &suspended_count, sizeof suspended_count)) \
         return STATUS_INVALID_ARGUMENT; \
-    return Ps##x##Thread(prm->Handle, prm->SuspendedCount); \
+    return STATUS_SUCCESS; \
 }
 
 SUSPEND_RESUME(Resume)
@@ -102,10 +116,7 @@ DECL_SYSCALL(UmSchYield)
 
 DECL_SYSCALL(UmReleaseSemaphore)
 {
-    auto prm = (UmReleaseSemaphoreParams *)params;
-
-    if (!MmVirtualProbeMemory(true, (uptr)prm, sizeof(UmReleaseSemaphoreParams), false))
-        return STATUS_INVALID_ARGUMENT;
+    COPY_SYSCALL_PARAMS(prm, UmReleaseSemaphoreParams);
 
     return PsReleaseSemaphore(prm->Handle, prm->Count);
 }
@@ -121,10 +132,7 @@ HANDLE_NAME(UmOpenEvent, PsOpenEvent, false)
 
 DECL_SYSCALL(UmResetTimer)
 {
-    auto prm = (UmResetTimerParams *)params;
-
-    if (!MmVirtualProbeMemory(true, (uptr)prm, sizeof(UmResetTimerParams), false))
-        return STATUS_INVALID_ARGUMENT;
+    COPY_SYSCALL_PARAMS(prm, UmResetTimerParams);
 
     return PsResetTimer(prm->Handle, prm->Milliseconds);
 }
\ No newline at end of file
@@ -1,74 +1,111 @@
 #include <syscall/window.hh>
+#include <lib/malloc.hh>
 
 DECL_SYSCALL(UmCreateWindow)
 {
-    auto *prm = (UmCreateWindowParams *)params;
+    COPY_SYSCALL_PARAMS(prm, UmCreateWindowParams);
+    PzString *title = PzCaptureUserString(prm->Title);
+    PzHandle handle;
 
-    if (!MmVirtualProbeMemory(true, (uptr)prm->Handle, sizeof(PzHandle), true) ||
-        !PzValidateString(true, prm->Title, false))
+    if (!title)
         return STATUS_INVALID_ARGUMENT;
 
-    return WndCreateWindow(
-        prm->Handle, prm->Parent, prm->Title, prm->X, prm->Y, prm->Z,
+    PzStatus status = WndCreateWindow(
+        &handle, prm->Parent, title, prm->X, prm->Y, prm->Z,
         prm->Width, prm->Height, prm->Style);
+
+    PzFreeString(title);
+    return status ? status : ScReturnHandles(prm->Handle, &handle, 1);
 }
 
 DECL_SYSCALL(UmGetWindowTitle)
 {
-    auto *prm = (UmGetWindowTitleParams *)params;
+    COPY_SYSCALL_PARAMS(prm, UmGetWindowTitleParams);
+    u32 max_size;
 
-    if (!MmVirtualProbeMemory(true, (uptr)prm->MaxSize, sizeof(uptr), !prm->OutTitle) ||
-        prm->OutTitle && !MmVirtualProbeMemory(true, (uptr)prm->OutTitle, *prm->MaxSize, true))
+    if (!MmCopyFromUser(&max_size, prm->MaxSize, sizeof max_size))
         return STATUS_INVALID_ARGUMENT;
 
-    return WndGetWindowTitle(prm->Window, prm->OutTitle, prm->MaxSize);
+    /* Without a buffer, only the size the title needs is returned */
+    if (!prm->OutTitle) {
+        if (PzStatus status = WndGetWindowTitle(prm->Window, nullptr, &max_size))
+            return status;
+
+        return MmCopyToUser(prm->MaxSize, &max_size, sizeof max_size) ?
+            STATUS_SUCCESS : STATUS_INVALID_ARGUMENT;
+    }
+
+    char *title = (char *)PzHeapAllocate(Max(max_size, 1u), HEAP_ZERO);
+
+    if (!title)
+        return STATUS_ALLOCATION_FAILED;
+
+    PzStatus status = WndGetWindowTitle(prm->Window, title, &max_size);
+
+    /* Only the title and its terminator go back, leaving the rest of the buffer as it was */
+    u32 length = 0;
+
+    while (length < max_size && title[length])
+        length++;
+
+    if (status == STATUS_SUCCESS && !MmCopyToUser(prm->OutTitle, title, Min(length + 1, max_size)))
+        status = STATUS_INVALID_ARGUMENT;
+
+    PzHeapFree(title);
+    return status;
 }
 
 DECL_SYSCALL(UmSetWindowTitle)
 {
-    auto *prm = (UmSetWindowTitleParams *)params;
+    COPY_SYSCALL_PARAMS(prm, UmSetWindowTitleParams);
+    PzString *title = PzCaptureUserString(prm->OutTitle);
 
-    if (!PzValidateString(true, prm->OutTitle, false))
+    if (!title)
         return STATUS_INVALID_ARGUMENT;
 
-    return WndSetWindowTitle(prm->Window, prm->OutTitle);
+    PzStatus status = WndSetWindowTitle(prm->Window, title);
+
+    PzFreeString(title);
+    return status;
 }
 
 DECL_SYSCALL(UmGetWindowBuffer)
 {
-    auto *prm = (UmGetWindowBufferParams *)params;
+    COPY_SYSCALL_PARAMS(prm, UmGetWindowBufferParams);
+    GfxHandle handle;
 
-    if (!MmVirtualProbeMemory(true, (uptr)prm->Handle, sizeof(uptr), false))
-        return STATUS_INVALID_ARGUMENT;
+    if (PzStatus status = WndGetWindowBuffer(prm->Window, prm->Index, &handle))
+        return status;
 
-    return WndGetWindowBuffer(prm->Window, prm->Index, prm->Handle);
+    return ScReturnHandles((PzHandle *)prm->Handle, (PzHandle *)&handle, 1);
 }
 
 DECL_SYSCALL(UmSetWindowBuffer)
 {
-    auto *prm = (UmSetWindowBufferParams *)params;
+    COPY_SYSCALL_PARAMS(prm, UmSetWindowBufferParams);
     return WndSetWindowBuffer(prm->Window, prm->Index, prm->Handle);
 }
 
 DECL_SYSCALL(UmSwapBuffers)
 {
-    auto *prm = (UmSwapBuffersParams *)params;
+    COPY_SYSCALL_PARAMS(prm, UmSwapBuffersParams);
     return WndSwapBuffers(prm->Window);
 }
 
 DECL_SYSCALL(UmGetWindowParameter)
 {
-    auto *prm = (UmGetWindowParameterParams *)params;
+    COPY_SYSCALL_PARAMS(prm, UmGetWindowParameterParams);
+    uptr value;
 
-    if (!MmVirtualProbeMemory(true, (uptr)prm->Value, sizeof(uptr), true))
-        return STATUS_INVALID_ARGUMENT;
+    if (PzStatus status = WndGetWindowParameter(prm->Window, prm->Index, &value))
+        return status;
 
-    return WndGetWindowParameter(prm->Window, prm->Index, prm->Value);
+    return MmCopyToUser(prm->Value, &value, sizeof value) ? STATUS_SUCCESS : STATUS_INVALID_ARGUMENT;
 }
 
 DECL_SYSCALL(UmSetWindowParameter)
 {
-    auto *prm = (UmSetWindowParameterParams *)params;
+    COPY_SYSCALL_PARAMS(prm, UmSetWindowParameterParams);
     return WndSetWindowParameter(prm->Window, prm->Index, prm->Value);
 }
 
@@ -84,13 +121,36 @@ DECL_SYSCALL(UmUnregisterWindowServer)
 
 DECL_SYSCALL(UmEnumerateChildWindows)
 {
-    auto *prm = (UmEnumerateChildWindowsParams *)params;
+    COPY_SYSCALL_PARAMS(prm, UmEnumerateChildWindowsParams);
+    u32 max_count;
+
+    if (!MmCopyFromUser(&max_count, prm->MaxCount, sizeof max_count))
+        return STATUS_INVALID_ARGUMENT;
+
+    /* Without a buffer, the windows are only counted */
+    if (!prm->Handles) {
+        if (PzStatus status = WndEnumerateChildWindows(prm->Window, &max_count, nullptr, prm->Recursive))
+            return status;
 
-    if (!MmVirtualProbeMemory(true, (uptr)prm->MaxCount, sizeof(uptr), !prm->Handles) ||
-        prm->Handles && !MmVirtualProbeMemory(true, (uptr)prm->Handles, *prm->MaxCount, true))
+        return MmCopyToUser(prm->MaxCount, &max_count, sizeof max_count) ?
+            STATUS_SUCCESS : STATUS_INVALID_ARGUMENT;
+    }
+
+    if (max_count > 0xFFFFFFFF / sizeof(PzHandle))
         return STATUS_INVALID_ARGUMENT;
 
-    return WndEnumerateChildWindows(prm->Window, prm->MaxCount, prm->Handles, prm->Recursive);
+    auto *handles = (PzHandle *)PzHeapAllocate(Max(max_count, 1u) * sizeof(PzHandle), HEAP_ZERO);
+
+    if (!handles)
+        return STATUS_ALLOCATION_FAILED;
+
+    PzStatus status = WndEnumerateChildWindows(prm->Window, &max_count, handles, prm->Recursive);
+
+    if (status == STATUS_SUCCESS)
+        status = ScReturnHandles(prm->Handles, handles, max_count);
+
+    PzHeapFree(handles);
+    return status;
 }
 
 DECL_SYSCALL(UmAllocateConsole)
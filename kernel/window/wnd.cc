@@ -55,13 +55,50 @@ PzStatus WndCreateWindow(
     return STATUS_SUCCESS;
 }
 
+/* Copies the windows of a list, referencing each of them, so that they can be
+   worked on without holding the list's lock. Returns nullptr if there is no memory. */
+static PzWindowObject **SnapshotWindows(LinkedList<PzWindowObject*> *list, int *length)
+{
+    for (;;) {
+        /* Leave some room for windows created before the lock is taken */
+        int capacity = list->Length + 4;
+        auto **windows = new PzWindowObject *[capacity];
+
+        if (!windows)
+            return nullptr;
+
+        PzAcquireSpinlock(&list->Spinlock);
+
+        if (list->Length > capacity) {
+            PzReleaseSpinlock(&list->Spinlock);
+            delete[] windows;
+            continue;
+        }
+
+        *length = 0;
+
+        ENUM_LIST(window, *list) {
+            ObReferenceObject(window->Value);
+            windows[(*length)++] = window->Value;
+        }
+
+        PzReleaseSpinlock(&list->Spinlock);
+        return windows;
+    }
+}
+
 void EnumRecursive(LinkedList<PzWindowObject*> *list,
     u32 *max_count, PzHandle *handles, int count, bool top_only, bool recurse)
 {
-    PzAcquireSpinlock(&list->Spinlock);
+    /* Creating handles takes other locks and may allocate, so don't do it under the list's lock */
+    int length;
+    PzWindowObject **windows = SnapshotWindows(list, &length);
+
+    if (!windows)
+        return;
 
-    ENUM_LIST(window, *list) {
-        auto *obj_window = (PzWindowObject *)window->Value;
+    for (int i = 0; i < length; i++) {
+        PzWindowObject *obj_window = windows[i];
 
         if (top_only && obj_window->Parent)
             continue;
@@ -69,10 +106,8 @@ void EnumRecursive(LinkedList<PzWindowObject*> *list,
         if (handles) {
             if (count < *max_count)
                 ObCreateHandle(nullptr, 0, handles + count++, obj_window);
-            else {
-                PzReleaseSpinlock(&list->Spinlock);
-                return;
-            }
+            else
+                break;
         }
         else
             (*max_count)++;
@@ -81,7 +116,10 @@ void EnumRecursive(LinkedList<PzWindowObject*> *list,
             EnumRecursive(&obj_window->Children, max_count, handles, count, false, true);
     }
 
-    PzReleaseSpinlock(&list->Spinlock);
+    for (int i = 0; i < length; i++)
+        ObDereferenceObject(windows[i]);
+
+    delete[] windows;
 }
 
 PzStatus WndEnumerateChildWindows(PzHandle window, u32 *max_count, PzHandle *handles, bool recursive)
@@ -47,7 +47,7 @@ void HalApicSetBase(u32 base)
     if (LapicRegisters)
         MmVirtualFreeMemory((void *)LapicRegisters, 1024);
 
-    LapicRegisters = (volatile u32 *)MmVirtualMapPhysical(nullptr, base, 1024, PAGE_READWRITE);
+    LapicRegisters = (volatile u32 *)MmVirtualMapPhysical(nullptr, base, 1024, PAGE_READWRITE | PAGE_CACHE_UC);
     HalMsrWrite(ApicBaseMsr, base & 0xFFFFF000 | 1 << 11, 0);
 }
 
@@ -124,7 +124,7 @@ bool HalApicSelectIoApic(int index)
         MmVirtualFreeMemory(CurrentIoApicVirtualBase, 32);
 
     CurrentIoApicVirtualBase = (u32 *)MmVirtualMapPhysical(nullptr,
-        CurrentIoApic->Base, 32, PAGE_READWRITE);
+        CurrentIoApic->Base, 32, PAGE_READWRITE | PAGE_CACHE_UC);
 
     return true;
 }
@@ -158,8 +158,9 @@ pmode_start:
     mov eax, 0x100000
     ; page directory physical base
     mov ebx, 0x500000
-    ; stack end physical base
-    mov edx, 0x501000
+    ; stack end physical base, 4 MiB aligned so that
+    ; the kernel can map its image with large pages
+    mov edx, 0x800000
     mov dword [kphysical_start], edx
     mov ecx, 0x80000000 / 4096
     xor edi, edi
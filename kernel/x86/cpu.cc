@@ -0,0 +1,24 @@
+#include <x86/cpu.hh>
+
+#ifdef __GNUC__
+void HalCpuid(u32 leaf, u32 *eax, u32 *ebx, u32 *ecx, u32 *edx)
+{
+    asm volatile("cpuid"
+        : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+        : "a"(leaf), "c"(0));
+}
+
+u64 HalReadTsc()
+{
+    u32 low, high;
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+    return u64(high) << 32 | low;
+}
+
+void HalPause()
+{
+    asm volatile("pause");
+}
+#else
+    #error TODO: msvc inline assembly for this file
+#endif
\ No newline at end of file
@@ -1,9 +1,11 @@
 #include <core.hh>
 #include <mm/virtual.hh>
+#include <mm/usercopy.hh>
 #include <debug.hh>
 #include <panic.hh>
 #include <processor.hh>
 #include <sched/scheduler.hh>
+#include <x86/gdt.hh>
 
 extern "C" void HandleNmi(void *state)
 {
@@ -12,10 +14,35 @@ extern "C" void HandleNmi(void *state)
 
 extern "C" u32 HalReadCr2();
 
+/* Entry point of the double fault task. Switching to it saved
+   the state of the code that faulted in the main task's TSS. */
+extern "C" void HalDoubleFaultTask()
+{
+    CpuInterruptState state = {
+        HalTss.Gs, HalTss.Fs, HalTss.Es, HalTss.Ds,
+        HalTss.Edi, HalTss.Esi, HalTss.Ebp, HalTss.Esp,
+        HalTss.Ebx, HalTss.Edx, HalTss.Ecx, HalTss.Eax,
+        8, 0, HalTss.Eip, HalTss.Cs, HalTss.Eflags, 0, 0
+    };
+
+    PzPanic(&state, PANIC_REASON_CPU_EXCEPTION,
+        "Double fault, most likely from a kernel stack overflow. System halted.\r\n"
+        "eip=0x%p esp=0x%p ebp=0x%p cr2=0x%p",
+        state.Eip, state.Esp, state.Ebp, HalReadCr2());
+}
+
 extern "C" void CpuExceptionHandler(CpuInterruptState * state)
 {
     bool usermode = state->Cs != 0x8;
 
+    /* Page faults on views of files are resolved by reading the page in */
+    if (state->InterruptNumber == 14 && MmHandlePageFault(state))
+        return;
+
+    /* Bad user pointers passed to the kernel make the copy routines fail instead */
+    if (!usermode && state->InterruptNumber == 14 && MmiFixupUserAccess(state))
+        return;
+
     if (usermode)
         ExHandleUserCpuException(state);
     else {
@@ -1,11 +1,16 @@
 #include <x86/gdt.hh>
+#include <mm/virtual.hh>
 #include <debug.hh>
 
 TssStructure HalTss;
+TssStructure HalDoubleFaultTss;
 GdtDescriptor HalGdtDesc;
 u64 HalGdtTable[64];
 
 extern "C" void HalLoadGdt(void *desc, int tss_descriptor);
+extern "C" void HalDoubleFaultTask();
+
+alignas(16) static u8 DoubleFaultStack[4096];
 
 u64 MakeEntry(u32 base, u32 limit,
     u8 rw, u8 dc, u8 ex, u8 s, u8 privl,
@@ -41,6 +46,18 @@ void HalGdtInitialize()
     HalGdtSetDataSegment(6, 0, 0xFFFFF, 1, 3);
     HalGdtSetTssSegment(7, (u32)&HalTss, sizeof(HalTss) - 1);
 
+    /* Double faults get a task and a stack of their own, since they usually
+       come from a kernel stack overflow that left no room to push anything */
+    HalDoubleFaultTss.Cr3 = HalReadCr3();
+    HalDoubleFaultTss.Eip = (u32)HalDoubleFaultTask;
+    HalDoubleFaultTss.Esp = (u32)DoubleFaultStack + sizeof(DoubleFaultStack);
+    HalDoubleFaultTss.Eflags = 1 << 1;
+    HalDoubleFaultTss.Cs = 0x08;
+    HalDoubleFaultTss.Ds = HalDoubleFaultTss.Es = HalDoubleFaultTss.Ss = HalDoubleFaultTss.Gs = 0x10;
+    HalDoubleFaultTss.Fs = 0x18;
+    HalDoubleFaultTss.IopbOffset = sizeof(HalDoubleFaultTss);
+    HalGdtSetTssSegment(8, (u32)&HalDoubleFaultTss, sizeof(HalDoubleFaultTss) - 1);
+
     HalGdtReload();
 
     DbgPrintStr("[HalGdtInitialize] GDT successfully initialized\r\n");
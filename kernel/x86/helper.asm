@@ -1,15 +1,19 @@
 bits 32
 section .text
 
+%define SPINLOCK_BACKOFF_MAX 64
+
 extern _CpuExceptionHandler, _IrqHandler, _SyscallHandler
 global _HalDisableInterrupts, _HalEnableInterrupts, _HalLoadGdt, _HalHaltCpu
 global _HalLoadIdt, _HalSwitchContext, _HalReadIfFlag, _HalWriteIfFlag
 global _HalSwitchPageTable, _HalIdtHandlerArray, _HalFlushCacheForPage
-global _HalReadCr0, _HalReadCr1, _HalReadCr2, _HalReadCr3
-global _HalWriteCr0, _HalWriteCr1, _HalWriteCr2, _HalWriteCr3
+global _HalReadCr0, _HalReadCr1, _HalReadCr2, _HalReadCr3, _HalReadCr4
+global _HalWriteCr0, _HalWriteCr1, _HalWriteCr2, _HalWriteCr3, _HalWriteCr4
 global _HalAcquireSpinlock, _HalReleaseSpinlock
 global _HalSwitchContextKernel, _HalSwitchContextUser
-global _HalLoadFs, _HalLoadGs, _HalSyscallEntry, _HalRepMemcpy, _HalEnableSSE, _HalFloatingPointSave
+global _HalLoadFs, _HalLoadGs, _HalSyscallEntry, _HalRepMemcpy, _HalRepMemset, _HalEnableSSE, _HalFloatingPointSave
+global _HalCopyUser, _HalTouchUser, _HalUserAccessFixups, _HalUserAccessFixupCount
+global _HalSse2Copy, _HalSse2Fill
 
 irq_handler:
     pusha
@@ -108,6 +112,194 @@ _HalRepMemcpy:
     pop esi
     ret
 
+; Fills [esp+12] bytes at [esp+4] with the byte pattern repeated in [esp+8]
+_HalRepMemset:
+    push edi
+    mov edi, [esp+8]
+    mov eax, [esp+12]
+    mov ecx, [esp+16]
+    mov edx, ecx
+    and edx, 3
+    shr ecx, 2
+    rep stosd
+    mov ecx, edx
+    rep stosb
+    pop edi
+    ret
+
+; Copies [esp+12] bytes, at least 128, from [esp+8] to [esp+4] in 64 byte blocks.
+; The stores bypass the caches if the bool at [esp+16] is true. xmm0-xmm3 are preserved,
+; as the interrupted code or the user thread making a system call may be using them.
+_HalSse2Copy:
+    push esi
+    push edi
+    push ebx
+    mov edi, [esp+16]
+    mov esi, [esp+20]
+    mov edx, [esp+24]
+    movzx ebx, byte [esp+28]
+    sub esp, 64
+    movdqu [esp], xmm0
+    movdqu [esp+16], xmm1
+    movdqu [esp+32], xmm2
+    movdqu [esp+48], xmm3
+    ; Copy bytes until the destination is aligned
+    mov ecx, edi
+    neg ecx
+    and ecx, 15
+    sub edx, ecx
+    rep movsb
+    mov eax, edx
+    shr eax, 6
+    and edx, 63
+    test ebx, ebx
+    jnz .stream
+.block:
+    movdqu xmm0, [esi]
+    movdqu xmm1, [esi+16]
+    movdqu xmm2, [esi+32]
+    movdqu xmm3, [esi+48]
+    movdqa [edi], xmm0
+    movdqa [edi+16], xmm1
+    movdqa [edi+32], xmm2
+    movdqa [edi+48], xmm3
+    add esi, 64
+    add edi, 64
+    dec eax
+    jnz .block
+    jmp .tail
+.stream:
+    prefetchnta [esi+256]
+    movdqu xmm0, [esi]
+    movdqu xmm1, [esi+16]
+    movdqu xmm2, [esi+32]
+    movdqu xmm3, [esi+48]
+    movntdq [edi], xmm0
+    movntdq [edi+16], xmm1
+    movntdq [edi+32], xmm2
+    movntdq [edi+48], xmm3
+    add esi, 64
+    add edi, 64
+    dec eax
+    jnz .stream
+    sfence
+.tail:
+    mov ecx, edx
+    rep movsb
+    movdqu xmm0, [esp]
+    movdqu xmm1, [esp+16]
+    movdqu xmm2, [esp+32]
+    movdqu xmm3, [esp+48]
+    add esp, 64
+    pop ebx
+    pop edi
+    pop esi
+    ret
+
+; Fills [esp+12] bytes, at least 128, at [esp+4] with the byte pattern repeated in [esp+8].
+; The stores bypass the caches if the bool at [esp+16] is true. xmm0 is preserved.
+_HalSse2Fill:
+    push edi
+    push ebx
+    mov edi, [esp+12]
+    mov eax, [esp+16]
+    mov edx, [esp+20]
+    movzx ebx, byte [esp+24]
+    sub esp, 16
+    movdqu [esp], xmm0
+    movd xmm0, eax
+    pshufd xmm0, xmm0, 0
+    ; Fill bytes until the destination is aligned
+    mov ecx, edi
+    neg ecx
+    and ecx, 15
+    sub edx, ecx
+    rep stosb
+    mov ecx, edx
+    shr ecx, 6
+    and edx, 63
+    test ebx, ebx
+    jnz .stream
+.block:
+    movdqa [edi], xmm0
+    movdqa [edi+16], xmm0
+    movdqa [edi+32], xmm0
+    movdqa [edi+48], xmm0
+    add edi, 64
+    dec ecx
+    jnz .block
+    jmp .tail
+.stream:
+    movntdq [edi], xmm0
+    movntdq [edi+16], xmm0
+    movntdq [edi+32], xmm0
+    movntdq [edi+48], xmm0
+    add edi, 64
+    dec ecx
+    jnz .stream
+    sfence
+.tail:
+    mov ecx, edx
+    rep stosb
+    movdqu xmm0, [esp]
+    add esp, 16
+    pop ebx
+    pop edi
+    ret
+
+; Same as _HalRepMemcpy, but returns 1 instead of taking the system down
+; if one of the moves faults on a bad user address, and 0 otherwise
+_HalCopyUser:
+    push esi
+    push edi
+    mov esi, [esp+16]
+    mov edi, [esp+12]
+    mov ecx, [esp+20]
+    mov edx, ecx
+    and edx, 3
+    shr ecx, 2
+.copy_dwords:
+    rep movsd
+    mov ecx, edx
+.copy_bytes:
+    rep movsb
+    xor eax, eax
+.out:
+    pop edi
+    pop esi
+    ret
+.fault:
+    mov eax, 1
+    jmp .out
+
+; Reads a byte of user memory, or adds nothing to it if the second argument
+; is nonzero, to take any page fault it causes. Returns 1 if it faults on
+; a bad user address and 0 otherwise.
+_HalTouchUser:
+    mov edx, [esp+4]
+    xor eax, eax
+    cmp dword [esp+8], 0
+    jne .write
+.read:
+    mov cl, [edx]
+    ret
+.write:
+    lock or byte [edx], 0
+    ret
+.fault:
+    mov eax, 1
+    ret
+
+; Pairs of instructions that may fault on user memory
+; and where to resume execution when they do
+_HalUserAccessFixups:
+    dd _HalCopyUser.copy_dwords, _HalCopyUser.fault
+    dd _HalCopyUser.copy_bytes, _HalCopyUser.fault
+    dd _HalTouchUser.read, _HalTouchUser.fault
+    dd _HalTouchUser.write, _HalTouchUser.fault
+_HalUserAccessFixupCount:
+    dd (_HalUserAccessFixupCount - _HalUserAccessFixups) / 8
+
 %assign i 0
 %rep 32
 stub%+i:
@@ -266,7 +458,7 @@ _HalLoadGs:
     ret
 
 %assign i 0
-%rep 4
+%rep 5
 _HalReadCr%+i:
     mov eax, cr%+i
     ret
@@ -278,24 +470,45 @@ _HalWriteCr%+i:
 %assign i i+1
 %endrep
 
+; Takes a ticket from the high half of the lock and waits for the low half to reach it,
+; backing off exponentially between polls. Returns the number of polls, 0 if uncontended.
 _HalAcquireSpinlock:
     mov edx, [esp+4]
-    mov ecx, 1
-.retry:
+    mov eax, 10000h
+    lock xadd [edx], eax
+    mov ecx, eax
+    shr ecx, 16
+    cmp ax, cx
+    jne .contended
     xor eax, eax
-    xacquire lock cmpxchg [edx], ecx
-    je .out
+    ret
+.contended:
+    push ebx
+    push esi
+    mov ebx, 1
+    xor esi, esi
+.backoff:
+    mov eax, ebx
 .pause:
-    mov eax, [edx]
-    test eax, eax
-    jz .retry
     rep nop
-    jmp .pause
-.out:
+    dec eax
+    jnz .pause
+    inc esi
+    add ebx, ebx
+    cmp ebx, SPINLOCK_BACKOFF_MAX
+    jbe .poll
+    mov ebx, SPINLOCK_BACKOFF_MAX
+.poll:
+    cmp cx, [edx]
+    jne .backoff
+    mov eax, esi
+    pop esi
+    pop ebx
     ret
 
+; Only the holder writes the low half, and the xadd of acquirers never splits
+; around this store, so it needs no lock prefix
 _HalReleaseSpinlock:
-    xor eax, eax
-    mov ecx, dword [esp+4]
-    xrelease lock xchg dword [ecx], eax
+    mov ecx, [esp+4]
+    inc word [ecx]
     ret
\ No newline at end of file
@@ -40,6 +40,12 @@ void HalIdtInitialize(void)
         }
     }
     
+    /* Task gate, present, switching to the double fault task */
+    HalIdtEntries[8].OffsetLow  = 0;
+    HalIdtEntries[8].OffsetHigh = 0;
+    HalIdtEntries[8].Selector   = 8 * 8;
+    HalIdtEntries[8].Flags      = 0x5 | 0x80;
+
     /* Set up IDT entry for syscall */
     HalIdtEntries[0x80].OffsetLow  = (u32)HalSyscallEntry >> 0  & 0xFFFF;
     HalIdtEntries[0x80].OffsetHigh = (u32)HalSyscallEntry >> 16 & 0xFFFF;
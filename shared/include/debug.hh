@@ -21,6 +21,28 @@
 #define ERROR_ACCESS_VIOLATION (FLAG_ERROR | 1)
 #define ERROR_COMMAND_ABORTED  (FLAG_ERROR | 2)
 
+/* Size of every processor's log ring, a power of two */
+#define LOG_RING_SIZE 16384
+/* Longest message that is logged, longer ones are cut off */
+#define LOG_MAX_MESSAGE 512
+/* Set in a record's length word once its text has been written */
+#define LOG_RECORD_READY 0x80000000
+
+/*
+    Log messages of a processor waiting to be sent to the debugger.
+    Writers claim room by advancing Head with compare-and-swap, so code that
+    interrupts a writer on the same processor just takes the next record.
+    Every record is a length word followed by the text, padded to 4 bytes, and
+    the writer sets LOG_RECORD_READY in the length word last. Messages that
+    don't fit are counted in Dropped instead of waiting for room.
+*/
+struct PzLogRing
+{
+    u32 Head, Tail;
+    u32 Dropped;
+    u8 Data[LOG_RING_SIZE];
+};
+
 extern bool DbgSchedulerEnabled;
 
 void DbgWriteChar(char data);
@@ -34,6 +56,8 @@ u16 DbgRead16();
 u32 DbgRead32();
 uptr DbgReadPtr();
 PzHandle DbgStartListener();
+PzHandle DbgStartLogDrain();
+void DbgFlushLog();
 int DbgListener(void *param);
 void DbgEnterBreakpointMode(CpuInterruptState *state);
 void DbgWriteStackTraceAndRegs(CpuInterruptState *state);
@@ -42,6 +42,6 @@ struct PzStackEnvironment {
 
 void ExCallNextHandler(CpuInterruptState *user_state);
 void ExContinueExecution();
-void ExPushExceptionHandler(PzExceptionHandler handler, uptr stack_context);
+bool ExPushExceptionHandler(PzExceptionHandler handler, uptr stack_context);
 void ExPopExceptionHandler();
 void ExHandleUserCpuException(CpuInterruptState *state);
\ No newline at end of file
@@ -2,8 +2,18 @@
 
 #include <defs.hh>
 
+/* IDs of kernel objects count down from -7, below the pseudo-handles */
 #define NAMESPACE_KERNEL_OBJECT  1
+/* IDs of user objects count up from 1 */
 #define NAMESPACE_USER_OBJECT    2
+/* IDs shared by threads and processes count up from 1 */
 #define NAMESPACE_THREAD_PROCESS 3
 
+/*
+    Function to hand out the next ID of a namespace, or -1 for an unknown namespace.
+    IDs are generated without any lock and are unique within their namespace.
+    Each caller gets an ID past all those handed out before its call began, but
+    calls that overlap may return theirs in either order, and generating an ID
+    orders no other memory accesses, so it can't be used to publish anything.
+*/
 uptr IdGenerateUniqueId(int id_namespace);
\ No newline at end of file
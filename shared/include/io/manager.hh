@@ -27,7 +27,12 @@
 #define IRP_MJ_LAST            IRP_MJ_MOUNT_FS
 #define MJ_FUNC_MAX            31
 
+/* The device transfers straight to and from the caller's memory, so read and
+   write requests come with a memory descriptor list of the buffer in the IRP. */
+#define DEVICE_FLAG_DIRECT_IO 1
+
 struct PzIoRequestPacket;
+struct PzMemoryDescriptorList;
 
 struct PzIoControlBlock
 {
@@ -137,7 +142,8 @@ struct PzIoRequestPacket
         UserStatus,
         AssociatedThread,
         CurrentLocation,
-        Iocb;
+        Iocb,
+        Mdl;
 #else
     void *UserBuffer;
     void *SystemBuffer;
@@ -145,6 +151,8 @@ struct PzIoRequestPacket
     PzThreadObject *AssociatedThread;
     PzIoStackLocation *CurrentLocation;
     PzIoControlBlock *Iocb;
+    /* Locked pages of the buffer of a read or write, for devices with DEVICE_FLAG_DIRECT_IO */
+    PzMemoryDescriptorList *Mdl;
 #endif
 };
 
@@ -164,6 +172,10 @@ PZ_KERNEL_EXPORT PzStatus PzCreateFile(
     bool kernel, PzHandle *handle, const PzString *filename,
     PzIoStatusBlock *iosb, u32 access, u32 disposition
 );
+/* Given a pointer to an I/O control block, opens the same file again
+   with a new control block, which has its own offset. */
+PZ_KERNEL_EXPORT PzStatus IoReopenFile(
+    PzIoControlBlock *control_block, u32 access, PzIoControlBlock **reopened);
 /* Given a pointer to an I/O control block,
    reads `count` byte from a file from the offset `offset` into the specified buffer. */
 PZ_KERNEL_EXPORT PzStatus PzReadFileRaw(
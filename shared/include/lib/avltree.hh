@@ -0,0 +1,234 @@
+#pragma once
+
+#include <defs.hh>
+#include <lib/util.hh>
+
+template<typename T>
+struct AvlNode
+{
+#ifdef DEBUGGER_INCLUDE
+    DEBUGGER_TARGET_PTR Left, Right, Parent;
+#else
+    AvlNode<T> *Left, *Right, *Parent;
+#endif
+    int Height;
+    T Value;
+};
+
+/*
+    Intrusive AVL tree. Nodes are allocated by the caller, which lets
+    the memory manager use the tree before the kernel heap exists.
+    Ops must provide:
+        static int Compare(const T &a, const T &b);
+        static void Update(AvlNode<T> *node);
+    Update is called whenever a node's children change, so that it can
+    recompute data augmented from its subtrees (such as the largest free
+    range below it), which is what makes O(log n) fit searches possible.
+*/
+template<typename T, typename Ops>
+struct AvlTree
+{
+#ifdef DEBUGGER_INCLUDE
+    DEBUGGER_TARGET_PTR Root;
+#else
+    AvlNode<T> *Root;
+#endif
+    int Count;
+
+#ifndef DEBUGGER_INCLUDE
+    inline AvlTree()
+    {
+        Root = nullptr;
+        Count = 0;
+    }
+
+    inline static int HeightOf(AvlNode<T> *node)
+    {
+        return node ? node->Height : 0;
+    }
+
+    inline static AvlNode<T> *Leftmost(AvlNode<T> *node)
+    {
+        if (node)
+            while (node->Left)
+                node = node->Left;
+        return node;
+    }
+
+    inline static AvlNode<T> *Rightmost(AvlNode<T> *node)
+    {
+        if (node)
+            while (node->Right)
+                node = node->Right;
+        return node;
+    }
+
+    inline AvlNode<T> *First() { return Leftmost(Root); }
+    inline AvlNode<T> *Last() { return Rightmost(Root); }
+
+    inline static AvlNode<T> *Next(AvlNode<T> *node)
+    {
+        if (node->Right)
+            return Leftmost(node->Right);
+
+        while (node->Parent && node == node->Parent->Right)
+            node = node->Parent;
+
+        return node->Parent;
+    }
+
+    inline static AvlNode<T> *Previous(AvlNode<T> *node)
+    {
+        if (node->Left)
+            return Rightmost(node->Left);
+
+        while (node->Parent && node == node->Parent->Left)
+            node = node->Parent;
+
+        return node->Parent;
+    }
+
+    inline void Insert(AvlNode<T> *node)
+    {
+        AvlNode<T> *parent = nullptr, **link = &Root;
+
+        while (*link) {
+            parent = *link;
+            link = Ops::Compare(node->Value, parent->Value) < 0 ?
+                &parent->Left : &parent->Right;
+        }
+
+        node->Left = nullptr;
+        node->Right = nullptr;
+        node->Parent = parent;
+        node->Height = 1;
+        *link = node;
+        Count++;
+
+        Ops::Update(node);
+        Retrace(parent);
+    }
+
+    inline void Remove(AvlNode<T> *node)
+    {
+        AvlNode<T> *retrace;
+
+        if (node->Left && node->Right) {
+            /* Put the in-order successor (which has no left child) in place of the node */
+            AvlNode<T> *successor = Leftmost(node->Right);
+
+            if (successor->Parent != node) {
+                retrace = successor->Parent;
+                Relink(successor->Parent, successor, successor->Right);
+                successor->Right = node->Right;
+                successor->Right->Parent = successor;
+            }
+            else
+                retrace = successor;
+
+            Relink(node->Parent, node, successor);
+            successor->Left = node->Left;
+            successor->Left->Parent = successor;
+        }
+        else {
+            retrace = node->Parent;
+            Relink(node->Parent, node, node->Left ? node->Left : node->Right);
+        }
+
+        Count--;
+        Retrace(retrace);
+    }
+
+    /* Must be called after a node's value changes in a way that
+       keeps its position in the tree but alters augmented data. */
+    inline void Updated(AvlNode<T> *node)
+    {
+        Retrace(node);
+    }
+
+private:
+    inline static void Refresh(AvlNode<T> *node)
+    {
+        node->Height = Max(HeightOf(node->Left), HeightOf(node->Right)) + 1;
+        Ops::Update(node);
+    }
+
+    inline void Relink(AvlNode<T> *parent, AvlNode<T> *old_child, AvlNode<T> *new_child)
+    {
+        if (!parent)
+            Root = new_child;
+        else if (parent->Left == old_child)
+            parent->Left = new_child;
+        else
+            parent->Right = new_child;
+
+        if (new_child)
+            new_child->Parent = parent;
+    }
+
+    inline AvlNode<T> *RotateLeft(AvlNode<T> *node)
+    {
+        AvlNode<T> *pivot = node->Right;
+
+        Relink(node->Parent, node, pivot);
+        node->Right = pivot->Left;
+
+        if (pivot->Left)
+            pivot->Left->Parent = node;
+
+        pivot->Left = node;
+        node->Parent = pivot;
+
+        Refresh(node);
+        Refresh(pivot);
+        return pivot;
+    }
+
+    inline AvlNode<T> *RotateRight(AvlNode<T> *node)
+    {
+        AvlNode<T> *pivot = node->Left;
+
+        Relink(node->Parent, node, pivot);
+        node->Left = pivot->Right;
+
+        if (pivot->Right)
+            pivot->Right->Parent = node;
+
+        pivot->Right = node;
+        node->Parent = pivot;
+
+        Refresh(node);
+        Refresh(pivot);
+        return pivot;
+    }
+
+    inline AvlNode<T> *Rebalance(AvlNode<T> *node)
+    {
+        Refresh(node);
+        int balance = HeightOf(node->Right) - HeightOf(node->Left);
+
+        if (balance > 1) {
+            if (HeightOf(node->Right->Left) > HeightOf(node->Right->Right))
+                RotateRight(node->Right);
+
+            return RotateLeft(node);
+        }
+
+        if (balance < -1) {
+            if (HeightOf(node->Left->Right) > HeightOf(node->Left->Left))
+                RotateLeft(node->Left);
+
+            return RotateRight(node);
+        }
+
+        return node;
+    }
+
+    /* Restores heights, balance and augmented data from a node up to the root */
+    inline void Retrace(AvlNode<T> *node)
+    {
+        while (node)
+            node = Rebalance(node)->Parent;
+    }
+#endif
+};
\ No newline at end of file
@@ -20,6 +20,19 @@ struct LLNode
         Previous = nullptr;
         Next = nullptr;
     }
+
+#ifndef DEBUGGER_INCLUDE
+    /* Nodes come from object caches sized to fit them rather than the general heap */
+    inline static void *operator new(size_t size)
+    {
+        return MmAllocateListNode(size);
+    }
+
+    inline static void operator delete(void *node, size_t size)
+    {
+        MmFreeListNode(node, size);
+    }
+#endif
 };
 
 #define ENUM_LIST(n, list) for (auto *n = (list).First; n; n = n->Next)
@@ -105,6 +118,40 @@ struct LinkedList
         return node;
     }
 
+    /* Appends a node allocated by the caller, for lists
+       that are modified where allocating is not allowed */
+    inline void AddNode(LLNode<T> *node)
+    {
+        node->Previous = Last;
+        node->Next = nullptr;
+
+        if (Length > 0)
+            Last->Next = node;
+        else
+            First = node;
+
+        Last = node;
+        Length++;
+    }
+
+    /* Removes a node from the list without freeing it */
+    inline void Unlink(LLNode<T> *node)
+    {
+        if (node->Previous)
+            node->Previous->Next = node->Next;
+        else
+            First = node->Next;
+
+        if (node->Next)
+            node->Next->Previous = node->Previous;
+        else
+            Last = node->Previous;
+
+        node->Previous = nullptr;
+        node->Next = nullptr;
+        Length--;
+    }
+
     inline LLNode<T> *Prepend(const T &value)
     {
         if (Length > 0) {
@@ -4,4 +4,9 @@
 #include <defs.hh>
 #include <lib/string.hh>
 
-void PrintfWithCallbackV(void (*print_func)(char), const char *format, va_list params);
\ No newline at end of file
+void PrintfWithCallbackV(void (*print_func)(char), const char *format, va_list params);
+void PrintfWithContextV(void (*print_func)(void *context, char),
+    void *context, const char *format, va_list params);
+/* Formats into a buffer of `size` bytes, cutting off whatever doesn't fit.
+   Returns the length of the null-terminated result. */
+int FormatStringV(char *buffer, int size, const char *format, va_list params);
\ No newline at end of file
@@ -151,6 +151,10 @@ PZ_KERNEL_EXPORT PzString *PzDuplicateString(const PzString *src);
    with a flag to check if it is accessible in usermode. */
 PZ_KERNEL_EXPORT bool PzValidateString(bool as_usermode, const PzString *str, bool write);
 
+/* Copies a string object and its character buffer out of user memory into a new string object,
+   returning nullptr if either can't be read or there is no memory. Free it with PzFreeString. */
+PZ_KERNEL_EXPORT PzString *PzCaptureUserString(const PzString *src);
+
 /* Frees a string object and its character buffer. */
 PZ_KERNEL_EXPORT void PzFreeString(PzString *str);
 
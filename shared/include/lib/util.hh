@@ -33,6 +33,13 @@ template<typename T> inline void Swap(T &a, T &b)
 PZ_KERNEL_EXPORT void MemCopy(void *dest, const void *src, int count);
 PZ_KERNEL_EXPORT void MemSet(void *dest, int value, int count);
 
+/* Picks the fastest MemCopy and MemSet paths the processor supports.
+   Until it runs, they stick to instructions every processor has. */
+void MemInitializeRoutines();
+
+/* Times MemCopy and MemSet over a range of sizes and prints their throughput. */
+void MemRunBenchmark();
+
 inline int HighestSetBit(int value)
 {
 #if __GNUC__
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <defs.hh>
+
+/* Number of spare extent descriptors below which the
+   virtual memory manager should hand the allocator more of them. */
+#define KVA_DESCRIPTORS_LOW 16
+
+/*
+    Kernel virtual address space allocator. It keeps the free page ranges of the
+    upper half in a balanced tree, so that allocating and freeing never has to scan
+    the page tables. All routines operate on page indices relative to
+    KERNEL_SPACE_START and expect the caller to hold the virtual memory lock.
+*/
+
+/* Function to initialize the allocator with a single free range of the specified size. */
+void MmKvaInitialize(u32 total_pages);
+
+/* Function to donate memory that will be carved into extent descriptors. */
+void MmKvaAddDescriptors(void *memory, u32 bytes);
+
+/* Returns whether the allocator is running low on extent descriptors. */
+bool MmKvaNeedsDescriptors();
+
+/* Function to allocate the lowest free range of `pages` pages, returning its index or -1. */
+int MmKvaAllocate(u32 pages);
+
+/* Function to allocate a range of `pages` pages whose index is congruent to `offset` modulo the
+   power of two `alignment`, returning its index or -1. It looks for the lowest extent that is
+   sure to hold such a range whatever its position, so it may pass over tighter fits below. */
+int MmKvaAllocateAligned(u32 pages, u32 alignment, u32 offset);
+
+/* Function to mark a specific range as used, failing if any of it is already in use. */
+bool MmKvaReserve(u32 index, u32 pages);
+
+/* Function to return a range to the allocator, merging it with its free neighbours. */
+bool MmKvaFree(u32 index, u32 pages);
\ No newline at end of file
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <defs.hh>
+
+struct PzProcessObject;
+
+/*
+    Memory descriptor list, describing the physical pages behind a buffer so that
+    devices can transfer to and from it directly. As long as the list exists, the
+    user memory regions the buffer lies in can't be freed.
+*/
+struct PzMemoryDescriptorList
+{
+    void *VirtualAddress;
+    u32 ByteCount;
+    /* Offset of the buffer into its first page */
+    u32 ByteOffset;
+    u32 PageCount;
+    /* Process whose regions are locked, or nullptr for buffers in the kernel half */
+    PzProcessObject *Process;
+    /* Physical address of every page of the buffer */
+    uptr Pages[0];
+};
+
+/* Function to lock the pages of a buffer in the current address space and describe them.
+   If `write` is set, the device is going to write to the buffer, so it has to be writable. */
+PZ_KERNEL_EXPORT PzMemoryDescriptorList *MmCreateMdl(void *buffer, u32 bytes, bool write);
+
+/* Function to unlock the pages described by a list and free it. */
+PZ_KERNEL_EXPORT void MmFreeMdl(PzMemoryDescriptorList *mdl);
\ No newline at end of file
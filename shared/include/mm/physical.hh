@@ -3,6 +3,36 @@
 #include <defs.hh>
 #include <boot.hh>
 
+/* Number of block sizes the allocator manages, from a single page up to 128 pages */
+#define PHYSICAL_ORDERS 8
+
+struct PzPhysicalMemoryInformation;
+struct PzTlbBatch;
+
+/* Usage of one of the ranges of physical memory managed by the allocator */
+struct PzPhysicalZoneInfo
+{
+    uptr Start, End;
+    u32 FreePages, UsedPages;
+};
+
+/* Number of pages a batch gathers before handing them back to the allocator */
+#define PAGE_BATCH_MAX_PAGES 64
+
+/*
+    A batch of single pages waiting to be freed. Code tearing down mappings adds
+    every page it unmaps, and the batch returns them with the allocator's lock
+    taken once per PAGE_BATCH_MAX_PAGES pages instead of once per page.
+*/
+struct PzPageBatch
+{
+    u32 Count;
+    /* Batch holding the invalidations of the pages' old translations, if they may still be cached.
+       It is flushed before any page is freed, so that nothing reaches a page once it is reused. */
+    PzTlbBatch *Invalidations;
+    uptr Pages[PAGE_BATCH_MAX_PAGES];
+};
+
 /* Function to initialize the physical page allocator's state. */
 void MmPhysicalInitializeState(KernelBootInfo *info);
 
@@ -11,8 +41,31 @@ void MmiPhysicalPostVirtualInit();
 /* Function to allocate a single physical page of a certain order. */
 PZ_KERNEL_EXPORT uptr MmPhysicalAllocatePage(int order);
 
+/* Function to allocate `count` pages of a certain order that don't have to be contiguous, storing
+   their physical addresses in `pages`. Either all of them are allocated, or none and it returns false. */
+PZ_KERNEL_EXPORT bool MmPhysicalAllocatePages(u32 order, u32 count, uptr *pages);
+
 /* Function to allocate to allocate several physically contiguous pages of a certain order. */
 PZ_KERNEL_EXPORT uptr MmPhysicalAllocateContiguousPages(u32 order, u32 count);
 
 /* Function to mark at least one page of a certain order as free, given the physical address of the first page. */
-PZ_KERNEL_EXPORT bool MmPhysicalFreePages(uptr address, u32 order, u32 number);
\ No newline at end of file
+PZ_KERNEL_EXPORT bool MmPhysicalFreePages(uptr address, u32 order, u32 number);
+
+/* Function to free `count` separate pages of a certain order, given their physical addresses.
+   Returns false if any of them isn't managed by the allocator. */
+PZ_KERNEL_EXPORT bool MmPhysicalFreePageArray(const uptr *pages, u32 order, u32 count);
+
+/* Function to prepare an empty batch of pages to be freed. */
+void MmPageBatchInitialize(PzPageBatch *batch, PzTlbBatch *invalidations);
+
+/* Function to queue a single page for freeing, freeing the whole batch when it's full. */
+void MmPageBatchAdd(PzPageBatch *batch, uptr page);
+
+/* Function to free every queued page and empty the batch. */
+void MmPageBatchFlush(PzPageBatch *batch);
+
+/* Function to fill in the usage of up to `max_zones` physical memory zones, returning how many zones there are. */
+PZ_KERNEL_EXPORT int MmPhysicalQueryZones(PzPhysicalZoneInfo *zones, int max_zones);
+
+/* Function to fill in the usage of physical memory as a whole, and how fragmented it is. */
+PZ_KERNEL_EXPORT void MmPhysicalQueryUsage(PzPhysicalMemoryInformation *info);
\ No newline at end of file
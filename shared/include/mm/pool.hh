@@ -4,28 +4,58 @@
 #include <spinlock.hh>
 #include <mm/virtual.hh>
 
+struct PzKernelPoolInformation;
+
 #define PL_ALLOC_FLAGS_ZERO 1
-#define PL_DEFAULT_GRANULARITY 64
 
-struct PzPoolBlockHeader
+/* Alignment guaranteed for every allocation */
+#define PL_ALIGNMENT 16
+
+#define PL_SIZE_CLASSES 12
+
+/* Allocations above this size get whole pages straight from the virtual memory manager */
+#define PL_MAX_SMALL_SIZE 1024
+
+#define PL_LARGE_CLASS 0xFFFF
+#define PL_PAGE_MAGIC 0x4C4F4F50
+
+/*
+    Descriptor at the start of every page (or run of pages, for large allocations)
+    owned by the pool. Data never starts in a page other than the first one,
+    so the descriptor of any allocation is found by masking its address.
+*/
+struct PzPoolPage
 {
-    PzPoolBlockHeader *Previous, *Next;
-    u32 Granularity;
-    u32 LastIndex;
-    u32 Used, Size;
-    u32 BitmapSize;
-    alignas(64) u8 BitmapStart[0];
+    PzPoolPage *Previous, *Next;
+    void *FreeObjects;
+    u32 Magic;
+    u16 SizeClass;
+    u16 InUse;
+    u32 Pages;
+    alignas(PL_ALIGNMENT) u8 Data[0];
 };
 
-struct PzKernelPool
+struct PzPoolSizeClass
 {
     PzSpinlock Lock;
-    PzPoolBlockHeader *FirstBlock, *LastBlock;
+    u32 Size, ObjectsPerPage;
+    /* Pages with at least one free object; full pages are not tracked */
+    PzPoolPage *PartialPages;
+    /* One empty page is kept around to avoid remapping on every allocation */
+    PzPoolPage *EmptyPage;
+    u32 PageCount, ObjectsInUse;
+};
+
+struct PzKernelPool
+{
+    PzPoolSizeClass Classes[PL_SIZE_CLASSES];
+    u8 SizeToClass[PL_MAX_SMALL_SIZE / PL_ALIGNMENT];
+    PzSpinlock LargeLock;
+    u32 LargeAllocations, LargePages;
 };
 
-void PlInitializeKernelPool(PzKernelPool *pool, int init_size);
-PzPoolBlockHeader *PlCreateBlock(PzKernelPool *pool, int size, int granularity);
-void PlUnlinkBlock(PzKernelPool *pool, PzPoolBlockHeader *header);
+void PlInitializeKernelPool(PzKernelPool *pool);
 void *PlAllocateMemory(PzKernelPool *pool, int bytes, u32 flags);
 void *PlReAllocateMemory(PzKernelPool *pool, void *ptr, int bytes);
-int PlFreeMemory(PzKernelPool *pool, void *ptr);
\ No newline at end of file
+int PlFreeMemory(PzKernelPool *pool, void *ptr);
+void PlQueryPool(PzKernelPool *pool, PzKernelPoolInformation *info);
\ No newline at end of file
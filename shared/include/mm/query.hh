@@ -0,0 +1,51 @@
+#pragma once
+
+#include <defs.hh>
+#include <mm/physical.hh>
+#include <mm/pool.hh>
+
+#define SYSTEM_INFORMATION_PHYSICAL_MEMORY 1
+#define SYSTEM_INFORMATION_KERNEL_POOL     2
+
+#define PROCESS_INFORMATION_MEMORY 1
+
+struct PzPhysicalMemoryInformation
+{
+    u32 TotalPages, FreePages;
+    /* Number of naturally aligned blocks of each order that are entirely free,
+       and of those that are at least partly in use */
+    u32 FreeBlocks[PHYSICAL_ORDERS], UsedBlocks[PHYSICAL_ORDERS];
+};
+
+struct PzPoolSizeClassInformation
+{
+    u32 Size, Pages;
+    u32 ObjectsInUse, ObjectsFree;
+};
+
+struct PzKernelPoolInformation
+{
+    PzPoolSizeClassInformation Classes[PL_SIZE_CLASSES];
+    /* Allocations too large for any size class, which get pages of their own */
+    u32 LargeAllocations, LargePages;
+};
+
+struct PzProcessMemoryInformation
+{
+    /* Pages covered by the process' regions, whether they are backed or not */
+    u32 ReservedPages;
+    /* Pages mapped in the process, and how many of them belong to it
+       rather than being shared pages of views of files */
+    u32 ResidentPages, CommittedPages;
+    /* Pages taken up by the process' page directory and page tables */
+    u32 PageTablePages;
+};
+
+/* Function to retrieve information of a certain type about the whole system.
+   Fails if `size` is too small to hold the information. */
+PZ_KERNEL_EXPORT PzStatus PzQuerySystemInformation(bool as_user, u32 type, void *buffer, u32 size);
+
+/* Function to retrieve information of a certain type about a process, given a handle to it.
+   Fails if `size` is too small to hold the information. */
+PZ_KERNEL_EXPORT PzStatus PzQueryProcessInformation(
+    bool as_user, PzHandle process, u32 type, void *buffer, u32 size);
\ No newline at end of file
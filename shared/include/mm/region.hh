@@ -0,0 +1,98 @@
+#pragma once
+
+#include <defs.hh>
+#include <spinlock.hh>
+#include <lib/avltree.hh>
+
+/* The region is a view of a file, whose pages are filled in on demand */
+#define REGION_FILE_VIEW 1
+/* The region is a thread stack, whose pages are committed as it grows down.
+   Its lowest page is never committed and catches overflows. */
+#define REGION_STACK 2
+
+struct PzSection;
+
+struct PzUserVirtualRegion
+{
+    uptr Start, End, Flags;
+    /* Section that a view maps, and the index of its page mapped at Start */
+#ifdef DEBUGGER_INCLUDE
+    DEBUGGER_TARGET_PTR Section;
+#else
+    PzSection *Section;
+#endif
+    u32 SectionPage;
+    /* Number of memory descriptor lists pinning the region, which can't be freed until it drops to 0 */
+    u32 LockCount;
+};
+
+struct PzVirtualRegionEntry
+{
+    PzUserVirtualRegion Region;
+    /* Lowest start and highest end of the regions in the subtree rooted at this one */
+    uptr SubtreeStart, SubtreeEnd;
+    /* Size of the largest unallocated gap between two regions of the subtree */
+    uptr LargestGap;
+};
+
+typedef AvlNode<PzVirtualRegionEntry> PzVirtualRegionNode;
+
+struct PzVirtualRegionOps
+{
+#ifndef DEBUGGER_INCLUDE
+    static int Compare(const PzVirtualRegionEntry &a, const PzVirtualRegionEntry &b)
+    {
+        return a.Region.Start < b.Region.Start ? -1 : a.Region.Start > b.Region.Start;
+    }
+
+    static void Update(PzVirtualRegionNode *node)
+    {
+        PzVirtualRegionEntry &entry = node->Value;
+
+        entry.SubtreeStart = entry.Region.Start;
+        entry.SubtreeEnd = entry.Region.End;
+        entry.LargestGap = 0;
+
+        if (PzVirtualRegionNode *left = node->Left) {
+            entry.SubtreeStart = left->Value.SubtreeStart;
+            entry.LargestGap = Max(left->Value.LargestGap,
+                entry.Region.Start - left->Value.SubtreeEnd);
+        }
+
+        if (PzVirtualRegionNode *right = node->Right) {
+            entry.SubtreeEnd = right->Value.SubtreeEnd;
+            entry.LargestGap = Max(entry.LargestGap, Max(right->Value.LargestGap,
+                right->Value.SubtreeStart - entry.Region.End));
+        }
+    }
+#endif
+};
+
+/*
+    Sorted, non-overlapping set of the virtual memory regions a process has
+    allocated. Every entry knows the largest gap between the regions below it,
+    which lets first-fit searches skip whole subtrees that have no room.
+    The spinlock also serializes all changes to the process' page tables.
+*/
+struct PzVirtualRegionTree
+{
+    PzSpinlock Spinlock;
+    AvlTree<PzVirtualRegionEntry, PzVirtualRegionOps> Tree;
+};
+
+/* Function to find the lowest address where `bytes` bytes fit between the regions of the tree,
+   returning 0 if there is none. All regions must lie within [lowest, highest). */
+uptr MmRegionFindGap(PzVirtualRegionTree *tree, uptr lowest, uptr highest, uptr bytes);
+
+/* Function to add the region [start, end) to the tree.
+   Fails if it overlaps with any existing region or if no memory is left. */
+PzVirtualRegionNode *MmRegionInsert(PzVirtualRegionTree *tree, uptr start, uptr end, uptr flags);
+
+/* Function to find the region that starts exactly at `start`. */
+PzVirtualRegionNode *MmRegionFind(PzVirtualRegionTree *tree, uptr start);
+
+/* Function to find the region that contains `address`. */
+PzVirtualRegionNode *MmRegionFindContaining(PzVirtualRegionTree *tree, uptr address);
+
+/* Function to remove a region from the tree and free it. */
+void MmRegionRemove(PzVirtualRegionTree *tree, PzVirtualRegionNode *node);
\ No newline at end of file
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <defs.hh>
+#include <spinlock.hh>
+#include <lib/list.hh>
+#include <io/manager.hh>
+
+/*
+    A section holds the pages of a file that are mapped by views. There is a single
+    section per file, so every process (and the kernel) mapping the same file shares
+    its pages. Pages are read through the file system the first time a view touches
+    them and stay cached until the last view of the file goes away.
+    Views are read-only, since nothing writes dirty pages back to the file.
+*/
+struct PzSection
+{
+    PzSpinlock Lock;
+    /* Number of views, plus page faults that are currently filling pages */
+    int References;
+    /* Control block of the section's own, so that reads don't move the offset of any handle */
+    PzIoControlBlock *File;
+    /* Mutex serializing reads through `File` */
+    PzHandle ReadLock;
+    u64 Size;
+    u32 PageCount;
+    /* Physical address of every page of the file, or 0 if it hasn't been read yet */
+    uptr *Pages;
+    LLNode<PzSection *> *ListNode;
+};
+
+/* Function to map `bytes` bytes of a file starting at the page-aligned `offset` into a process,
+   or into the kernel half if the process is the kernel process. */
+PzStatus MmiMapViewOfFile(
+    PzProcessObject *process, PzIoControlBlock *file,
+    u64 offset, u32 bytes, void **base);
+
+/* Function to unmap a view of a file, given its base address. */
+bool MmiUnmapViewOfFile(PzProcessObject *process, void *base);
+
+/* Function to read in all pages of a view ahead of time, so that
+   it can be accessed with the IRQL raised to DISPATCH_LEVEL. */
+PzStatus MmiPopulateView(PzProcessObject *process, void *base, u32 bytes);
+
+/* Function to fill in and map the page of a view that `address` lies in.
+   It may have to wait for disk I/O, so interrupts must be enabled. */
+bool MmiResolveViewFault(uptr address, bool write);
+
+/* Function to drop a reference to a section, freeing it along with its pages after the last one. */
+void MmiDereferenceSection(PzSection *section);
+
+/* Given a process handle and a handle to a file, maps a read-only view of the file into the process.
+   Unless `as_user` is false, the process can't be the kernel process. */
+PZ_KERNEL_EXPORT PzStatus PzMapViewOfFile(
+    bool as_user, PzHandle process, PzHandle file,
+    u64 offset, u32 bytes, void **base);
+
+/* Given a process handle, unmaps the view of a file starting at `base`. */
+PZ_KERNEL_EXPORT PzStatus PzUnmapViewOfFile(bool as_user, PzHandle process, void *base);
\ No newline at end of file
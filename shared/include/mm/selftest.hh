@@ -0,0 +1,8 @@
+#pragma once
+
+#include <defs.hh>
+
+/* Function to exercise the memory manager's allocators against their expected
+   behaviour and print timings to the debug output. Meant to be run once at boot,
+   after the heap is initialized, when PRIZM_MM_SELFTEST is defined in kinit.cc. */
+void MmRunSelfTests();
\ No newline at end of file
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <defs.hh>
+#include <spinlock.hh>
+#include <processor.hh>
+#include <lib/util.hh>
+
+/* Number of objects each processor can keep at hand before touching the slabs */
+#define SLAB_MAGAZINE_SIZE 16
+
+/* Largest object the caches handle, so that a one-page slab holds at least eight of them */
+#define SLAB_MAX_OBJECT_SIZE 448
+
+#define SLAB_ALIGNMENT 8
+
+struct PzObjectCache;
+
+/* Header at the start of every page-sized slab, followed by its objects */
+struct PzSlab
+{
+    PzSlab *Previous, *Next;
+    PzObjectCache *Cache;
+    void *FreeObjects;
+    u32 InUse;
+};
+
+/* Per-processor stack of free objects, only ever touched at DISPATCH_LEVEL by its owner */
+struct PzObjectMagazine
+{
+    u32 Rounds;
+    void *Objects[SLAB_MAGAZINE_SIZE];
+    u32 Allocations, Frees, Misses;
+};
+
+struct PzObjectCacheStatistics
+{
+    u32 Allocations, Frees;
+    /* Allocations and frees that had to go to the slab layer */
+    u32 MagazineMisses;
+    u32 SlabCount, ObjectsInUse;
+};
+
+/*
+    Cache of fixed-size objects carved from page-sized slabs. Objects are handed
+    to the constructor once, when their slab is created, and must be freed back
+    in their constructed state, so that reusing them costs no initialization.
+    Each processor keeps a magazine of free objects that it can use without
+    taking the cache lock.
+*/
+struct PzObjectCache
+{
+    PzSpinlock Lock;
+    const char *Name;
+    u32 ObjectSize, Stride, ObjectsPerSlab;
+    void (*Constructor)(void *object);
+    PzSlab *PartialSlabs, *FullSlabs, *EmptySlabs;
+    u32 SlabCount, ObjectsInUse;
+    PzObjectMagazine Magazines[MAX_PROCESSORS];
+    bool Registered;
+    PzObjectCache *NextCache;
+};
+
+#define SLAB_OBJECTS_OFFSET u32(ALIGN(sizeof(PzSlab), SLAB_ALIGNMENT))
+
+/* Each object is followed by the link used while it is free */
+#define SLAB_STRIDE(size) u32(ALIGN(ALIGN(size, sizeof(void *)) + sizeof(void *), SLAB_ALIGNMENT))
+
+/* Static initializer for caches that must be usable without any setup call */
+#define OBJECT_CACHE_INITIALIZER(name, size, constructor) \
+    PzObjectCache { {}, (name), (size), SLAB_STRIDE(size), \
+        (PAGE_SIZE - SLAB_OBJECTS_OFFSET) / SLAB_STRIDE(size), (constructor) }
+
+/* Function to set up a cache in storage provided by the caller. */
+PZ_KERNEL_EXPORT bool MmInitializeObjectCache(
+    PzObjectCache *cache, const char *name, u32 size, void (*constructor)(void *object));
+
+/* Function to allocate a constructed object from a cache. */
+PZ_KERNEL_EXPORT void *MmCacheAllocate(PzObjectCache *cache);
+
+/* Function to return an object, in its constructed state, to its cache. */
+PZ_KERNEL_EXPORT void MmCacheFree(PzObjectCache *cache, void *object);
+
+/* Function to sum up the usage of a cache across its slabs and magazines. */
+PZ_KERNEL_EXPORT void MmQueryObjectCache(PzObjectCache *cache, PzObjectCacheStatistics *stats);
+
+/* Function to print the statistics of every cache to the debug output. */
+PZ_KERNEL_EXPORT void MmPrintObjectCaches();
\ No newline at end of file
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <defs.hh>
+
+/* Number of pages a batch invalidates one by one. Past that,
+   reloading CR3 and refilling the TLB is cheaper than more invlpg's. */
+#define TLB_BATCH_MAX_PAGES 32
+
+/*
+    A batch of pending TLB invalidations. Paging code queues every page whose
+    translation it weakens or removes while holding its lock, then flushes the
+    whole batch once before dropping it, instead of issuing an invlpg per page.
+    Keeping the list of pages around is also what a TLB shootdown needs to send
+    to other processors, so the batch is the unit that would get broadcast there.
+*/
+struct PzTlbBatch
+{
+    u32 Count;
+    bool FlushAll;
+    /* Set once a kernel page is queued. Kernel mappings are global,
+       so a full flush then has to go further than a CR3 reload. */
+    bool FlushGlobal;
+    void *Pages[TLB_BATCH_MAX_PAGES];
+};
+
+/* Function to prepare an empty batch. */
+void MmTlbBatchInitialize(PzTlbBatch *batch);
+
+/* Function to queue the invalidation of a single page. */
+void MmTlbBatchAdd(PzTlbBatch *batch, void *page);
+
+/* Function to queue the invalidation of a range of pages. */
+void MmTlbBatchAddRange(PzTlbBatch *batch, void *start, u32 pages);
+
+/* Function to perform every queued invalidation and empty the batch. */
+void MmTlbBatchFlush(PzTlbBatch *batch);
\ No newline at end of file
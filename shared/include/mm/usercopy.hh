@@ -0,0 +1,24 @@
+#pragma once
+
+#include <defs.hh>
+
+struct CpuInterruptState;
+
+/* Function to copy `bytes` bytes from user memory into a kernel buffer.
+   Returns false if any part of the source isn't readable user memory,
+   in which case the destination may have been partially written to. */
+PZ_KERNEL_EXPORT bool MmCopyFromUser(void *dest, const void *src, usize bytes);
+
+/* Function to copy `bytes` bytes from a kernel buffer into user memory.
+   Returns false if any part of the destination isn't writable user memory. */
+PZ_KERNEL_EXPORT bool MmCopyToUser(void *dest, const void *src, usize bytes);
+
+/* Function to fault in `pages` pages of the current process starting at the page-aligned
+   `start`, as if they were read from or written to, without changing their contents.
+   Returns false if any of them can't be accessed that way. */
+bool MmiFaultInUserPages(uptr start, u32 pages, bool write);
+
+/* Function to resume execution after a kernel-mode page fault taken while
+   accessing user memory on behalf of the routines above.
+   Returns false if the faulting instruction isn't one that may touch user memory. */
+bool MmiFixupUserAccess(CpuInterruptState *state);
\ No newline at end of file
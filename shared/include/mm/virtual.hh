@@ -9,10 +9,23 @@
 #define PAGE_READWRITE (PAGE_READ | PAGE_WRITE)
 #define PAGE_EXECUTE_READWRITE (PAGE_READWRITE | PAGE_EXECUTE)
 
+/* Caching attribute of kernel mappings, to be combined with the protection flags.
+   Write-back is the default; device memory is usually mapped uncached, and
+   frame buffers write-combining. Ignored for user memory. */
+#define PAGE_CACHE_WB 0
+#define PAGE_CACHE_WT (1 << 4)
+#define PAGE_CACHE_WC (2 << 4)
+#define PAGE_CACHE_UC (3 << 4)
+#define PAGE_CACHE_MASK (3 << 4)
+
 #define KERNEL_SPACE_START 0x8000'0000u
 #define KERNEL_SPACE_SIZE  0x8000'0000u
 
+#define LARGE_PAGE_SIZE 0x40'0000u
+
 struct PzProcessObject;
+struct PzProcessMemoryInformation;
+struct CpuInterruptState;
 
 extern "C" void HalSwitchPageTable(uptr dir_pointer);
 extern "C" uptr HalReadCr3();
@@ -23,10 +36,26 @@ PZ_KERNEL_EXPORT bool MmVirtualProtectMemory(void *start, u32 bytes, u32 flags);
 PZ_KERNEL_EXPORT void *MmVirtualAllocateMemory(
     void *start, u32 bytes, u32 flags, uptr *last_page_physical);
 PZ_KERNEL_EXPORT bool MmVirtualFreeMemory(void *start, u32 bytes);
+void *MmiReserveKernelRange(u32 pages);
+void *MmiAllocateKernelStack(u32 bytes);
+void MmiFreeKernelStack(void *stack, u32 bytes);
+void MmiReleaseKernelRange(void *start, u32 pages);
+bool MmiMapForeignPage(PzProcessObject *process, void *address, uptr physical, u32 flags);
+bool MmHandlePageFault(CpuInterruptState *state);
+void *MmiReserveUserStack(PzProcessObject *process, u32 bytes, u32 committed);
+bool MmiResolveStackFault(uptr address);
 uptr MmiVirtualToPhysical(void *page, PzProcessObject *process);
+/* Tells whether a kernel page is mapped without taking any lock, so the answer
+   is only meaningful for pages the caller expects to stay mapped */
+bool MmiIsKernelPageMapped(uptr address);
+bool MmiLockPages(PzProcessObject *process, uptr start, u32 pages, bool write, uptr *physical);
+void MmiUnlockPages(PzProcessObject *process, uptr start, u32 pages);
 PZ_KERNEL_EXPORT uptr MmVirtualToPhysical(void *page, PzHandle process);
 uptr **MmiAllocateProcessPageDirectory(PzProcessObject *process);
+/* Tears down the whole user half of a process that nothing runs in anymore:
+   its regions, committed pages, page tables and both page directories. */
 void MmiFreeProcessPageDirectory(PzProcessObject *process);
+void MmiQueryProcessMemory(PzProcessObject *process, PzProcessMemoryInformation *info);
 void *MmiVirtualAllocateUserMemory(
     PzProcessObject *process, void *start, u32 bytes, u32 flags);
 bool MmiVirtualFreeUserMemory(
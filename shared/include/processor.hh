@@ -1,14 +1,22 @@
+#pragma once
+
 #include <lib/list.hh>
 #include <sched/scheduler.hh>
+#include <debug.hh>
 
 #define PASSIVE_LEVEL 0 
 #define DISPATCH_LEVEL 1
 
+/* Only the bootstrap processor is brought up so far */
+#define MAX_PROCESSORS 1
+
 struct SchedulerQueue {
     LinkedList<PzThreadObject *> ThreadList;
     LinkedList<PzTimerObject *> ActiveTimers;
     int NumberOfActiveThreads;
     bool SoftwareInducedTick;
+    /* Number of scheduler ticks taken at PASSIVE_LEVEL, each one a quiescent state for RCU */
+    u32 QuiescentStates;
     PzThreadContext FsSpace;
 };
 
@@ -16,9 +24,12 @@ struct PzProcessor {
     volatile int IntLevel;
     LinkedList<uptr> AddressSpaceStack;
     SchedulerQueue Queue;
+    PzLogRing LogRing;
 };
 
 PZ_KERNEL_EXPORT PzProcessor *PzGetCurrentProcessor();
+PZ_KERNEL_EXPORT int PzGetCurrentProcessorNumber();
+PZ_KERNEL_EXPORT PzProcessor *PzGetProcessor(int number);
 PZ_KERNEL_EXPORT int PzRaiseIrql(int new_irql);
 PZ_KERNEL_EXPORT int PzGetCurrentIrql();
 PZ_KERNEL_EXPORT int PzLowerIrql(int new_irql);
\ No newline at end of file
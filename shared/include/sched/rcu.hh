@@ -0,0 +1,45 @@
+#pragma once
+
+#include <defs.hh>
+
+/*
+    Read-copy-update, for structures that are read far more often than changed.
+    Readers run at DISPATCH_LEVEL, where the scheduler can't switch them out, and
+    write nothing shared. Writers publish new versions with PzRcuAssign and free the
+    old ones only after a grace period, once every processor has taken a scheduler
+    tick at PASSIVE_LEVEL and so can no longer be looking at them.
+    Writers still have to serialize among themselves, with a lock of their own.
+*/
+
+/* Link embedded in objects waiting for a grace period to pass */
+struct PzRcuHead
+{
+    PzRcuHead *Next;
+    void (*Callback)(PzRcuHead *head);
+};
+
+/* Loads a pointer published with PzRcuAssign, only valid until PzRcuReadUnlock */
+#define PzRcuDereference(pointer) __atomic_load_n(&(pointer), __ATOMIC_CONSUME)
+
+/* Publishes a pointer, making everything written to its target before visible to readers */
+#define PzRcuAssign(pointer, value) __atomic_store_n(&(pointer), (value), __ATOMIC_RELEASE)
+
+/* Function to begin a read-side critical section, returning the IRQL to give to PzRcuReadUnlock.
+   The thread must not yield or wait until it ends. */
+PZ_KERNEL_EXPORT int PzRcuReadLock();
+
+/* Function to end a read-side critical section. */
+PZ_KERNEL_EXPORT void PzRcuReadUnlock(int irql);
+
+/* Function to wait until all read-side critical sections that began before the call have ended.
+   Must be called at PASSIVE_LEVEL. The caller blocks until the RCU worker has seen a grace period. */
+PZ_KERNEL_EXPORT PzStatus PzSynchronizeRcu();
+
+/* Function to have `callback` called on `head` by the RCU worker after a grace period. */
+PZ_KERNEL_EXPORT void PzCallRcu(PzRcuHead *head, void (*callback)(PzRcuHead *head));
+
+/* Function to start the thread running callbacks queued with PzCallRcu. */
+PzStatus SchStartRcuWorker();
+
+/* Function called by every scheduler tick taken at PASSIVE_LEVEL, which is a quiescent state. */
+void SchRcuQuiescentState();
\ No newline at end of file
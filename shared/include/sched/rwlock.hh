@@ -0,0 +1,43 @@
+#pragma once
+
+#include <defs.hh>
+
+/* Layout of the state word shared by reader-writer spinlocks and pushlocks */
+#define RWLOCK_EXCLUSIVE      0x80000000
+/* Set by waiting writers to hold off new readers, so that writers don't starve */
+#define RWLOCK_WRITER_WAITING 0x40000000
+#define RWLOCK_READERS        0x3FFFFFFF
+
+/*
+    Spinlock that can be held by any number of readers at once, or by a single writer.
+    Like PzSpinlock, it raises the IRQL to DISPATCH_LEVEL while held. Since there is no
+    single owner to remember it, the IRQL to return to is handed back to the caller.
+    Readers still write the lock word, so for read paths that must not touch shared
+    cache lines at all, see RCU in sched/rcu.hh. All zeroes means unlocked.
+*/
+typedef struct { u32 State; } PzRwSpinlock;
+
+/*
+    Reader-writer lock for code running at PASSIVE_LEVEL that may block while
+    holding it. Threads that can't take it block on its semaphore, which a release
+    that may let them in raises once for every thread waiting. Has to be set up
+    with PzInitializePushlock before use.
+*/
+typedef struct
+{
+    u32 State;
+    u32 Waiters;
+    PzHandle Semaphore;
+} PzPushlock;
+
+PZ_KERNEL_EXPORT int PzAcquireRwSpinlockShared(PzRwSpinlock *lock);
+PZ_KERNEL_EXPORT void PzReleaseRwSpinlockShared(PzRwSpinlock *lock, int irql);
+PZ_KERNEL_EXPORT int PzAcquireRwSpinlockExclusive(PzRwSpinlock *lock);
+PZ_KERNEL_EXPORT void PzReleaseRwSpinlockExclusive(PzRwSpinlock *lock, int irql);
+
+PZ_KERNEL_EXPORT PzStatus PzInitializePushlock(PzPushlock *lock);
+PZ_KERNEL_EXPORT void PzDeletePushlock(PzPushlock *lock);
+PZ_KERNEL_EXPORT void PzAcquirePushlockShared(PzPushlock *lock);
+PZ_KERNEL_EXPORT void PzReleasePushlockShared(PzPushlock *lock);
+PZ_KERNEL_EXPORT void PzAcquirePushlockExclusive(PzPushlock *lock);
+PZ_KERNEL_EXPORT void PzReleasePushlockExclusive(PzPushlock *lock);
\ No newline at end of file
@@ -5,6 +5,9 @@
 
 #define KERNEL_CALL_STACK_SIZE    32768
 #define DEFAULT_THREAD_STACK_SIZE 32768
+/* Stacks of user threads are only reserved, and committed as they grow down from the top */
+#define DEFAULT_USER_STACK_SIZE   0x100000
+#define USER_STACK_COMMIT_SIZE    0x2000
 #define PZ_KPROC (PsGetKernelProcess())
 #define PZ_CPROC (PsGetCurrentProcess())
 
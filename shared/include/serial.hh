@@ -2,8 +2,21 @@
 
 #include <defs.hh>
 
+#define SERIAL_PORT_COUNT 4
+
+/* Type of the devices of the COM ports, named Serial1 to Serial4 */
+#define DEVICE_SERIAL 5
+
 PZ_KERNEL_EXPORT void SerialSetRate(int baud);
 PZ_KERNEL_EXPORT void SerialInitializePort(int n, int baud);
 PZ_KERNEL_EXPORT char SerialReadChar();
 PZ_KERNEL_EXPORT void SerialPrintChar(char c);
-PZ_KERNEL_EXPORT void SerialPrintStr(const char *str, ...);
\ No newline at end of file
+PZ_KERNEL_EXPORT void SerialPrintStr(const char *str, ...);
+/* Queues `size` bytes for the COM port `n`, waiting only while its transmit ring is full.
+   With interrupts disabled, or before SerialInitializeDevices, the bytes are written out by polling. */
+PZ_KERNEL_EXPORT void SerialWrite(int n, const void *data, int size);
+/* Reads up to `size` bytes that the COM port `n` has received,
+   waiting until there is at least one. Returns how many were read. */
+PZ_KERNEL_EXPORT int SerialRead(int n, void *buffer, int size);
+/* Creates the devices of the COM ports besides the debugger's and switches all of them to interrupts. */
+void SerialInitializeDevices();
\ No newline at end of file
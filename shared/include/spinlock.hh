@@ -2,8 +2,51 @@
 
 #include <defs.hh>
 
-typedef struct { bool Acquired; int ReturnIrql; } PzSpinlock;
+/* Uncomment to have locks passed to PzTrackSpinlock count their acquisitions and contention */
+//#define PRIZM_SPINLOCK_STATISTICS
+
+/* Most pause instructions a waiter executes between polls of a lock, also defined in helper.asm */
+#define SPINLOCK_BACKOFF_MAX 64
+
+/* Most locks that can be tracked at once */
+#define MAX_TRACKED_SPINLOCKS 32
+
+struct PzSpinlockStatistics
+{
+    const char *Name;
+    void *Lock;
+    u64 Acquisitions, ContendedAcquisitions;
+    /* Cycles spent waiting for the lock, and the longest it was ever held for */
+    u64 SpinCycles, MaxHoldCycles;
+    u64 AcquiredAt;
+};
+
+/*
+    Ticket lock, handing the lock over in the order it was asked for.
+    Acquirers take a ticket by incrementing NextTicket and wait until NowServing
+    reaches it; releasing increments NowServing. All zeroes means unlocked.
+*/
+typedef struct
+{
+    u16 NowServing, NextTicket;
+    int ReturnIrql;
+#ifdef PRIZM_SPINLOCK_STATISTICS
+    PzSpinlockStatistics *Statistics;
+#endif
+} PzSpinlock;
+
+/* Raw acquisition without touching the IRQL, returning how many times it polled the lock */
+extern "C" u32 HalAcquireSpinlock(PzSpinlock *spinlock);
+extern "C" void HalReleaseSpinlock(PzSpinlock *spinlock);
 
 PZ_KERNEL_EXPORT void PzAcquireSpinlock(PzSpinlock *spinlock);
 PZ_KERNEL_EXPORT void PzReleaseSpinlock(PzSpinlock *spinlock);
-PZ_KERNEL_EXPORT bool PzIsSpinlockAcquired(PzSpinlock spinlock);
\ No newline at end of file
+PZ_KERNEL_EXPORT bool PzIsSpinlockAcquired(PzSpinlock spinlock);
+
+/* Function to start collecting statistics for a lock, which must not be held.
+   Does nothing unless PRIZM_SPINLOCK_STATISTICS is defined. */
+PZ_KERNEL_EXPORT void PzTrackSpinlock(PzSpinlock *spinlock, const char *name);
+
+/* Function to print the statistics of all tracked locks to the debug output,
+   the ones that were waited on the longest first. */
+PZ_KERNEL_EXPORT void PzPrintSpinlockStatistics();
\ No newline at end of file
@@ -1,8 +1,27 @@
 #pragma once
 
 #include <core.hh>
+#include <mm/usercopy.hh>
 
 #define DECL_SYSCALL(x) PzStatus x(CpuInterruptState *state, void *params)
 
+/* Declares `name` as a pointer to a kernel copy of the syscall's parameters, failing the
+   syscall if they can't be read. Since other threads can't change the copy, pointers in
+   it stay valid after they have been checked. */
+#define COPY_SYSCALL_PARAMS(name, type) \
+    type name##Copy; \
+    if (!MmCopyFromUser(&name##Copy, params, sizeof(type))) \
+        return STATUS_INVALID_ARGUMENT; \
+    type *name = &name##Copy
+
 extern "C" void SyscallHandler(CpuInterruptState *state);
-void ScInitializeTable();
\ No newline at end of file
+void ScInitializeTable();
+
+/* Function to copy `bytes` bytes of user memory into a new heap block, to be freed with
+   PzHeapFree. Returns nullptr if there is no memory or the source can't be read. */
+void *ScCaptureBuffer(const void *src, u32 bytes);
+
+/* Function to hand handles that a syscall opened in the current process over to the caller.
+   If they can't be written to `dest`, they are closed, as the caller could never use them.
+   Null handles are skipped. */
+PzStatus ScReturnHandles(PzHandle *dest, const PzHandle *handles, u32 count);
\ No newline at end of file
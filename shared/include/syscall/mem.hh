@@ -27,6 +27,40 @@ struct UmFreeVirtualMemoryParams
     u32 *Size;
 };
 
+struct UmMapViewOfFileParams
+{
+    PzHandle ProcessHandle;
+    PzHandle FileHandle;
+    u64 Offset;
+    u32 Size;
+    void **BaseAddress;
+};
+
+struct UmUnmapViewOfFileParams
+{
+    PzHandle ProcessHandle;
+    void *BaseAddress;
+};
+
+struct UmQuerySystemInformationParams
+{
+    u32 Type;
+    void *Buffer;
+    u32 Size;
+};
+
+struct UmQueryProcessInformationParams
+{
+    PzHandle ProcessHandle;
+    u32 Type;
+    void *Buffer;
+    u32 Size;
+};
+
 DECL_SYSCALL(UmAllocateVirtualMemory);
 DECL_SYSCALL(UmProtectVirtualMemory);
-DECL_SYSCALL(UmFreeVirtualMemory);
\ No newline at end of file
+DECL_SYSCALL(UmFreeVirtualMemory);
+DECL_SYSCALL(UmMapViewOfFile);
+DECL_SYSCALL(UmUnmapViewOfFile);
+DECL_SYSCALL(UmQuerySystemInformation);
+DECL_SYSCALL(UmQueryProcessInformation);
\ No newline at end of file
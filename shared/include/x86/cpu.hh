@@ -0,0 +1,34 @@
+#pragma once
+
+#include <defs.hh>
+
+#define CPUID_LEAF_FEATURES 1
+
+/* Feature bits reported in EDX by CPUID_LEAF_FEATURES */
+#define CPUID_EDX_PSE (1u << 3)
+#define CPUID_EDX_PGE (1u << 13)
+#define CPUID_EDX_PAT (1u << 16)
+#define CPUID_EDX_FXSR (1u << 24)
+#define CPUID_EDX_SSE2 (1u << 26)
+
+#define CR0_WP (1u << 16)
+
+#define CR4_PSE (1u << 4)
+#define CR4_PGE (1u << 7)
+
+/* Page attribute table, holding the memory type of each PAT/PCD/PWT combination */
+#define MSR_PAT 0x277
+
+#define PAT_TYPE_UC 0
+#define PAT_TYPE_WC 1
+#define PAT_TYPE_WT 4
+#define PAT_TYPE_WB 6
+
+extern "C" uptr HalReadCr0();
+extern "C" void HalWriteCr0(uptr value);
+extern "C" uptr HalReadCr4();
+extern "C" void HalWriteCr4(uptr value);
+PZ_KERNEL_EXPORT u64 HalReadTsc();
+/* Hints to the processor that the caller is spinning on a memory location */
+PZ_KERNEL_EXPORT void HalPause();
+PZ_KERNEL_EXPORT void HalCpuid(u32 leaf, u32 *eax, u32 *ebx, u32 *ecx, u32 *edx);
\ No newline at end of file
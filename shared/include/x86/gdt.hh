@@ -13,6 +13,9 @@ extern struct TssStructure {
     u16 _, IopbOffset;
 } HalTss;
 
+/* State of the task that double faults switch to */
+extern TssStructure HalDoubleFaultTss;
+
 extern struct GdtDescriptor {
     u16 Limit;
     void *Base;
@@ -161,6 +161,38 @@ typedef struct
     u64 Size;
 } PzFileInformationBasic;
 
+#define SYSTEM_INFORMATION_PHYSICAL_MEMORY 1
+#define SYSTEM_INFORMATION_KERNEL_POOL     2
+
+#define PROCESS_INFORMATION_MEMORY 1
+
+#define PHYSICAL_ORDERS 8
+#define POOL_SIZE_CLASSES 12
+
+typedef struct
+{
+    u32 TotalPages, FreePages;
+    /* Number of naturally aligned blocks of 2^i pages that are entirely free,
+       and of those that are at least partly in use */
+    u32 FreeBlocks[PHYSICAL_ORDERS], UsedBlocks[PHYSICAL_ORDERS];
+} PzPhysicalMemoryInformation;
+
+typedef struct
+{
+    struct {
+        u32 Size, Pages;
+        u32 ObjectsInUse, ObjectsFree;
+    } Classes[POOL_SIZE_CLASSES];
+    u32 LargeAllocations, LargePages;
+} PzKernelPoolInformation;
+
+typedef struct
+{
+    u32 ReservedPages;
+    u32 ResidentPages, CommittedPages;
+    u32 PageTablePages;
+} PzProcessMemoryInformation;
+
 typedef struct {
     u32 Type;
     uptr Params[4];
@@ -247,6 +279,36 @@ PzStatus PzFreeVirtualMemory(
     void *base_address,
     u32 *size);
 
+/* Given a process handle and a file handle, maps a read-only view of `size` bytes
+    of the file starting at the page-aligned `offset` into the specified process.
+    Pages of the file are read in when they are first accessed. */
+PzStatus PzMapViewOfFile(
+    PzHandle process_handle,
+    PzHandle file_handle,
+    u64 offset,
+    u32 size,
+    void **base_address);
+
+/* Given a process handle, unmaps the view of a file starting at `base_address`. */
+PzStatus PzUnmapViewOfFile(
+    PzHandle process_handle,
+    void *base_address);
+
+/* Retrieves information of a SYSTEM_INFORMATION_* type about the whole system.
+    Fails unless `size` is large enough for the structure of that type. */
+PzStatus PzQuerySystemInformation(
+    u32 type,
+    void *buffer,
+    u32 size);
+
+/* Given a process handle, retrieves information of a PROCESS_INFORMATION_* type about the process.
+    Fails unless `size` is large enough for the structure of that type. */
+PzStatus PzQueryProcessInformation(
+    PzHandle process_handle,
+    u32 type,
+    void *buffer,
+    u32 size);
+
 /* Creates or opens a file given a filename, an access mask
     and a disposition type, and opens a handle to it. */
 PzStatus PzCreateFile(
@@ -401,7 +463,8 @@ void MemSet(void *dest, int value, int count);
       { \
           PzExceptionInfoExt _exception_data; \
           PzExceptionInfo *ExceptionInfo = &_exception_data.Info; \
-          ExPushExceptionHandler(PzExceptionRouter, (uptr)&_exception_data); \
+          PzStatus _push_status = \
+              ExPushExceptionHandler(PzExceptionRouter, (uptr)&_exception_data); \
           int _save_result = PzSaveStackEnvironment(&_exception_data.Buffer); \
           \
           for (;;) { \
@@ -411,7 +474,8 @@ void MemSet(void *dest, int value, int count);
 #define __except \
               break; \
           } \
-          ExPopExceptionHandler(); \
+          if (_push_status == STATUS_SUCCESS) \
+              ExPopExceptionHandler(); \
           if (_save_result)
 #define __finally
 #define __end }
@@ -64,7 +64,11 @@ enum {
     PZ_SYSCALL_ENUMERATE_CHILD_WINDOWS,
     PZ_SYSCALL_ALLOCATE_CONSOLE,
     PZ_SYSCALL_REGISTER_CONSOLE_HOST,
-    PZ_SYSCALL_UNREGISTER_CONSOLE_HOST
+    PZ_SYSCALL_UNREGISTER_CONSOLE_HOST,
+    PZ_SYSCALL_MAP_VIEW_OF_FILE,
+    PZ_SYSCALL_UNMAP_VIEW_OF_FILE,
+    PZ_SYSCALL_QUERY_SYSTEM_INFORMATION,
+    PZ_SYSCALL_QUERY_PROCESS_INFORMATION
 };
 
 PzStatus PzExecuteSystemCall(int number, const void *params)
@@ -460,6 +464,29 @@ PZDLL_EXPORT PzStatus PzUnregisterConsoleHost()
     return PzExecuteSystemCall(PZ_SYSCALL_UNREGISTER_CONSOLE_HOST, nullptr);
 }
 
+PZDLL_EXPORT PzStatus PzMapViewOfFile(
+    PzHandle process_handle, PzHandle file_handle,
+    u64 offset, u32 size, void **base_address)
+{
+    return PzExecuteSystemCall(PZ_SYSCALL_MAP_VIEW_OF_FILE, &process_handle);
+}
+
+PZDLL_EXPORT PzStatus PzUnmapViewOfFile(PzHandle process_handle, void *base_address)
+{
+    return PzExecuteSystemCall(PZ_SYSCALL_UNMAP_VIEW_OF_FILE, &process_handle);
+}
+
+PZDLL_EXPORT PzStatus PzQuerySystemInformation(u32 type, void *buffer, u32 size)
+{
+    return PzExecuteSystemCall(PZ_SYSCALL_QUERY_SYSTEM_INFORMATION, &type);
+}
+
+PZDLL_EXPORT PzStatus PzQueryProcessInformation(
+    PzHandle process_handle, u32 type, void *buffer, u32 size)
+{
+    return PzExecuteSystemCall(PZ_SYSCALL_QUERY_PROCESS_INFORMATION, &process_handle);
+}
+
 PZDLL_EXPORT int PzSaveStackEnvironment(PzStackEnvBuffer *buffer)
 {
 #ifdef __GNUC__